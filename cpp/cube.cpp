@@ -1,16 +1,34 @@
+#pragma once
+
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <ostream>
+#include <span>
 #include <sstream>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
 #include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "telemetry.cpp"
+#include "time_budget.cpp"
+
 using std::array;
 using std::cerr;
 using std::cout;
@@ -19,7 +37,9 @@ using std::format;
 using std::getline;
 using std::ifstream;
 using std::is_same_v;
+using std::istreambuf_iterator;
 using std::istringstream;
+using std::lexicographical_compare;
 using std::make_shared;
 using std::ofstream;
 using std::ostream;
@@ -27,13 +47,19 @@ using std::pair;
 using std::reverse;
 using std::same_as;
 using std::shared_ptr;
+using std::sort;
 using std::string;
 using std::stringstream;
 using std::tuple;
+using std::unique;
+using std::unordered_map;
+using std::unordered_set;
 using std::vector;
 using ios = std::ios;
 
 using i8 = signed char;
+using u8 = unsigned char;
+using u16 = unsigned short;
 using u64 = unsigned long long;
 
 struct RandomNumberGenerator {
@@ -49,6 +75,195 @@ struct RandomNumberGenerator {
     }
 };
 
+// チェックポイント用のバイナリ入出力
+// 同じバイナリで書いて読む前提なので、エンディアン等は気にしない
+// Serialize / Deserialize を持つ型はそれを使う
+template <typename T> inline void WriteBinary(ostream& os, const T& value) {
+    if constexpr (requires { value.Serialize(os); }) {
+        value.Serialize(os);
+    } else {
+        static_assert(std::is_trivially_copyable_v<T>);
+        os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+}
+
+template <typename T>
+inline void WriteBinary(ostream& os, const vector<T>& values) {
+    WriteBinary(os, (u64)values.size());
+    for (const auto& value : values)
+        WriteBinary(os, value);
+}
+
+template <typename T> inline void ReadBinary(std::istream& is, T& value) {
+    if constexpr (requires { value.Deserialize(is); }) {
+        value.Deserialize(is);
+    } else {
+        static_assert(std::is_trivially_copyable_v<T>);
+        is.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+}
+
+template <typename T>
+inline void ReadBinary(std::istream& is, vector<T>& values) {
+    auto size = (u64)0;
+    ReadBinary(is, size);
+    values.resize(size);
+    for (auto& value : values)
+        ReadBinary(is, value);
+}
+
+// --checkpoint <秒> で途中経過を定期的に保存し、--resume でそこから再開する
+struct CheckpointOptions {
+    string filename; // 空なら保存しない (呼び出し側で決める)
+    double interval; // 保存の間隔 (秒)。0 以下なら保存しない
+    bool resume;
+
+    inline CheckpointOptions() : filename(), interval(), resume() {}
+
+    inline bool Enabled() const { return !filename.empty() && interval > 0.0; }
+
+    // 再開できるのは --resume が指定されていて、ファイルが読めるとき
+    inline bool CanResume() const {
+        return resume && !filename.empty() && ifstream(filename).good();
+    }
+
+    inline static CheckpointOptions FromArgs(vector<const char*>& args) {
+        auto options = CheckpointOptions();
+        for (auto i = 0; i < (int)args.size();) {
+            if (string(args[i]) == "--resume") {
+                options.resume = true;
+                args.erase(args.begin() + i);
+            } else if (string(args[i]) == "--checkpoint") {
+                if (i + 1 >= (int)args.size()) {
+                    cerr << "--checkpoint requires seconds" << endl;
+                    abort();
+                }
+                options.interval = std::stod(args[i + 1]);
+                args.erase(args.begin() + i, args.begin() + i + 2);
+            } else {
+                i++;
+            }
+        }
+        return options;
+    }
+};
+
+// ファイルの書き出しを別スレッドで行う
+// 前回の書き出しが終わっていなければ、それを待ってから次を書き出す
+// 書き出し中に落ちても前のファイルが壊れないよう、一時ファイルを rename する
+struct AsyncFileWriter {
+    std::chrono::steady_clock::time_point last_write;
+    std::thread worker;
+
+    inline AsyncFileWriter()
+        : last_write(std::chrono::steady_clock::now()), worker() {}
+    inline ~AsyncFileWriter() { Wait(); }
+
+    inline void Wait() {
+        if (worker.joinable())
+            worker.join();
+    }
+
+    inline double SinceLastWrite() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             last_write)
+            .count();
+    }
+
+    // serialize(ostream&) を別スレッドで呼ぶ
+    // serialize が参照するものは呼び出し側で値として持たせておくこと
+    template <typename Serializer>
+    inline void Write(const string& filename, Serializer serialize) {
+        Wait();
+        last_write = std::chrono::steady_clock::now();
+        worker = std::thread([filename, serialize = std::move(serialize)] {
+            const auto t0 = std::chrono::steady_clock::now();
+            const auto tmp_filename = filename + ".tmp";
+            auto ofs = ofstream(tmp_filename, ios::binary);
+            if (!ofs.good()) {
+                cerr << format("Cannot open file `{}`.", tmp_filename) << endl;
+                return;
+            }
+            serialize(ofs);
+            ofs.close();
+            if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+                cerr << format("Cannot rename `{}`.", tmp_filename) << endl;
+                return;
+            }
+            cerr << format("checkpoint saved: {} ({:.1f}s)", filename,
+                           std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - t0)
+                               .count())
+                 << endl;
+        });
+    }
+};
+
+// 手筋のデータベース (edge_cube.cpp, face_cube.cpp) の中身から作る
+// ハッシュ値 (FNV-1a)
+struct ContentHash {
+    u64 value;
+
+    inline ContentHash() : value(0xcbf2'9ce4'8422'2325ull) {}
+
+    inline void Add(const u64 x) {
+        for (auto i = 0; i < 8; i++) {
+            value ^= (x >> (i * 8)) & 0xff;
+            value *= 0x100'0000'01b3ull;
+        }
+    }
+};
+
+// 手筋のデータベースのファイルを読み取り専用で mmap する
+// 同じファイルは 1 度だけ mmap し、プロセスが終わるまで解放しない
+// 中身が合わなければ forget で忘れて次は開き直す
+inline std::span<const char> MapSharedFile(const string& filename,
+                                           const bool forget = false) {
+    static std::mutex map_mtx;
+    static unordered_map<string, std::span<const char>> mapped;
+    const auto lock = std::lock_guard<std::mutex>(map_mtx);
+    if (forget) {
+        mapped.erase(filename);
+        return {};
+    }
+    if (const auto it = mapped.find(filename); it != mapped.end())
+        return it->second;
+    const auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return {};
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return {};
+    }
+    const auto addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return {};
+    return mapped[filename] =
+               std::span<const char>((const char*)addr, (size_t)st.st_size);
+}
+
+// serialize(ostream&) で書いたものを filename として公開する
+// 他のプロセスが読んでいる途中でも壊れないように、別名で書いてから置き換える
+template <typename Serializer>
+inline bool PublishSharedFile(const string& filename,
+                              const Serializer& serialize) {
+    const auto tmp_filename = format("{}.tmp{}", filename, getpid());
+    auto ofs = ofstream(tmp_filename, ios::binary);
+    serialize(ofs);
+    ofs.close();
+    if (!ofs.good()) {
+        cerr << format("Cannot write file `{}`.", tmp_filename) << endl;
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    MapSharedFile(filename, true);
+    std::rename(tmp_filename.c_str(), filename.c_str());
+    cerr << format("Published `{}`.", filename) << endl;
+    return true;
+}
+
 template <int siz> struct RandomNumberTable {
   private:
     array<u64, siz> data;
@@ -176,6 +391,19 @@ struct Face {
         Fill(0);
     }
 
+    // チェックポイント用 (乱数表は保存しない)
+    inline void Serialize(ostream& os) const {
+        ::WriteBinary(os, facelets);
+        ::WriteBinary(os, orientation);
+        ::WriteBinary(os, hash_value);
+    }
+
+    inline void Deserialize(std::istream& is) {
+        ::ReadBinary(is, facelets);
+        ::ReadBinary(is, orientation);
+        ::ReadBinary(is, hash_value);
+    }
+
     // 1 色で埋める
     void Fill(const ColorType color) {
         if constexpr (use_hash)
@@ -368,7 +596,7 @@ struct Move {
     inline auto operator<=>(const Move&) const = default;
 
     inline Move RotateXOnce(const int order = 4) const {
-        assert(depth == 0 || depth == order - 1);
+        assert(0 <= depth && depth < order);
         switch (direction) {
         case Direction::F:
             return {Direction::D, depth};
@@ -389,7 +617,7 @@ struct Move {
     }
 
     inline Move RotateYOnce(const int order = 4) const {
-        assert(depth == 0 || depth == order - 1);
+        assert(0 <= depth && depth < order);
         switch (direction) {
         case Direction::F:
             return {Direction::R, depth};
@@ -424,6 +652,21 @@ struct Move {
             mov = mov.RotateYOnce(order);
         return mov;
     }
+
+    // R 軸に垂直な面で鏡映する
+    // R 軸の回転は位置が反対側になり、それ以外の軸の回転は向きが逆になる
+    inline Move Mirror(const int order = 4) const {
+        if (GetAxis() == Axis::R)
+            return {direction, i8(order - 1 - depth)};
+        return Inv();
+    }
+
+    // 手筋のバイナリ形式で使う 1 バイトの表現 (order は 42 まで)
+    inline u8 ToByte() const { return (u8)(depth * 6 + (int)direction); }
+
+    inline static Move FromByte(const u8 code) {
+        return {(Direction)(code % 6), (i8)(code / 6)};
+    }
 };
 
 // マスの座標
@@ -720,6 +963,62 @@ struct Formula {
     }
 };
 
+// 手筋の手順をまとめた木 (trie)
+// 共通の接頭辞を持つ手筋は、DFS で接頭辞を 1 回回して戻すだけで評価できる
+struct MoveTrie {
+    struct TrieNode {
+        Move mov;
+        vector<int> children;
+        vector<int> formula_ids; // このノードで終わる手筋の番号
+    };
+    vector<TrieNode> trie_nodes; // 0 番目が根
+
+    inline MoveTrie() : trie_nodes(1) {}
+
+    inline void Build(const vector<Formula>& formulas) {
+        trie_nodes.assign(1, TrieNode{});
+        for (auto i = 0; i < (int)formulas.size(); i++)
+            Add(formulas[i], i);
+    }
+
+    inline void Add(const Formula& formula, const int formula_id) {
+        auto node_id = 0;
+        for (const auto& mov : formula.moves) {
+            auto next_node_id = -1;
+            for (const auto child_id : trie_nodes[node_id].children)
+                if (trie_nodes[child_id].mov == mov) {
+                    next_node_id = child_id;
+                    break;
+                }
+            if (next_node_id == -1) {
+                next_node_id = (int)trie_nodes.size();
+                trie_nodes[node_id].children.emplace_back(next_node_id);
+                trie_nodes.push_back({mov, {}, {}});
+            }
+            node_id = next_node_id;
+        }
+        trie_nodes[node_id].formula_ids.emplace_back(formula_id);
+    }
+
+    // 回転の回数 (根以外のノード数)
+    inline int NRotations() const { return (int)trie_nodes.size() - 1; }
+
+    // cube を回しながら DFS し、手筋の終端で f(formula_id, cube) を呼ぶ
+    // 戻るときは逆回転するので、終了後の cube は元の状態
+    template <typename CubeType, typename Callback>
+    inline void Dfs(CubeType& cube, const Callback& f,
+                    const int node_id = 0) const {
+        for (const auto child_id : trie_nodes[node_id].children) {
+            const auto& child = trie_nodes[child_id];
+            cube.Rotate(child.mov);
+            for (const auto formula_id : child.formula_ids)
+                f(formula_id, static_cast<const CubeType&>(cube));
+            Dfs(cube, f, child_id);
+            cube.Rotate(child.mov.Inv());
+        }
+    }
+};
+
 // キューブ
 template <int order_, typename ColorType_ = ColorType6> struct Cube {
     static constexpr auto order = order_;
@@ -804,6 +1103,17 @@ template <int order_, typename ColorType_ = ColorType6> struct Cube {
         }
     }
 
+    // チェックポイント用
+    inline void Serialize(ostream& os) const {
+        for (const auto& face : faces)
+            face.Serialize(os);
+    }
+
+    inline void Deserialize(std::istream& is) {
+        for (auto& face : faces)
+            face.Deserialize(is);
+    }
+
     inline void Rotate(const Move& mov) {
 #define FROM_BOTTOM order - 1 - mov.depth, i
 #define FROM_LEFT i, mov.depth
@@ -1270,6 +1580,627 @@ template <int order_, typename ColorType_ = ColorType6> struct Cube {
     }
 };
 
+// 手筋の対称性
+// 全体の回転 24 通りと鏡映の 48 通りに、逆手順にするかどうかを合わせた 96 通り
+// 手筋の探索では対称なもののうち 1 つだけを書き出し、読み込むときに展開する
+template <int order> struct FormulaSymmetry {
+    struct Symmetry {
+        array<Move, 6 * order> move_map; // direction * order + depth -> Move
+        bool mirror;
+        bool inverse;
+    };
+    vector<Symmetry> symmetries;
+
+    inline FormulaSymmetry() : symmetries() {
+        auto move_maps = vector<pair<array<Move, 6 * order>, bool>>();
+        for (auto mirror = 0; mirror < 2; mirror++)
+            for (auto x_rot = 0; x_rot < 4; x_rot++)
+                for (auto y_rot = 0; y_rot < 4; y_rot++)
+                    for (auto x_rot2 = 0; x_rot2 < 4; x_rot2++) {
+                        auto move_map = array<Move, 6 * order>();
+                        for (auto i = 0; i < 6 * order; i++) {
+                            auto mov = Move{(Move::Direction)(i / order),
+                                            (i8)(i % order)};
+                            mov = mov.RotateX(order, x_rot);
+                            mov = mov.RotateY(order, y_rot);
+                            mov = mov.RotateX(order, x_rot2);
+                            if (mirror)
+                                mov = mov.Mirror(order);
+                            move_map[i] = mov;
+                        }
+                        move_maps.emplace_back(move_map, mirror);
+                    }
+        sort(move_maps.begin(), move_maps.end());
+        move_maps.erase(unique(move_maps.begin(), move_maps.end()),
+                        move_maps.end());
+        assert(move_maps.size() == 48);
+        for (const auto inverse : {false, true})
+            for (const auto& [move_map, mirror] : move_maps)
+                symmetries.push_back({move_map, mirror, inverse});
+    }
+
+    inline vector<Move> Apply(const vector<Move>& moves,
+                              const Symmetry& symmetry) const {
+        auto result = vector<Move>();
+        result.reserve(moves.size());
+        for (const auto& mov : moves)
+            result.emplace_back(
+                symmetry.move_map[(int)mov.direction * order + mov.depth]);
+        if (symmetry.inverse) {
+            reverse(result.begin(), result.end());
+            for (auto& mov : result)
+                mov = mov.Inv();
+        }
+        return result;
+    }
+
+    // 対称なもののうち辞書順最小の手順を 1 手 1 文字で表したもの
+    // 同じ値なら互いに対称
+    // 手順前後などで、対称なのに違う値になることはある
+    inline string ComputeKey(const vector<Move>& moves) const {
+        auto key = string();
+        for (const auto& symmetry : symmetries) {
+            auto candidate = string();
+            for (const auto& mov : Apply(moves, symmetry))
+                candidate += (char)((int)mov.direction * order + mov.depth);
+            if (key.empty() || candidate < key)
+                key = candidate;
+        }
+        return key;
+    }
+
+    // 手順を回したときに動くマスとその行き先を並べたもの
+    // 同じ値なら盤面に対する作用が同じ
+    // centers_only なら辺と角のマスは見ない
+    inline static string
+    ComputePermutationKey(const vector<Move>& moves,
+                          const bool centers_only = false) {
+        // 色の代わりにマスの番号を 7bit ずつ 2 つのキューブに分けて持つ
+        auto lower = Cube<order, ColorType24>();
+        auto upper = Cube<order, ColorType24>();
+        const auto for_each_facelet = [](const auto& f) {
+            for (auto face_id = 0; face_id < 6; face_id++)
+                for (auto y = 0; y < order; y++)
+                    for (auto x = 0; x < order; x++)
+                        f(face_id, y, x, (face_id * order + y) * order + x);
+        };
+        for_each_facelet([&](const int face_id, const int y, const int x,
+                             const int idx) {
+            lower.faces[face_id].Set(y, x, {(i8)(idx & 127)});
+            upper.faces[face_id].Set(y, x, {(i8)(idx >> 7)});
+        });
+        for (const auto& mov : moves) {
+            lower.Rotate(mov);
+            upper.Rotate(mov);
+        }
+        auto key = string();
+        for_each_facelet([&](const int face_id, const int y, const int x,
+                             const int idx) {
+            if (centers_only &&
+                (y == 0 || y == order - 1 || x == 0 || x == order - 1))
+                return;
+            const auto from = lower.faces[face_id].Get(y, x).data |
+                              upper.faces[face_id].Get(y, x).data << 7;
+            if (from == idx)
+                return;
+            for (const auto value : {idx, from}) {
+                key += (char)(value & 255);
+                key += (char)(value >> 8);
+            }
+        });
+        return key;
+    }
+
+    // 対称なものを全て返す
+    // is_valid を満たさないものと作用が seen に含まれるものは除き、
+    // 返すものの作用は seen に加える
+    // 作用ごとに最短のものを残すには、短い手筋から順に呼ぶこと
+    inline vector<Formula>
+    Expand(const Formula& formula, unordered_set<string>& seen,
+           bool (*is_valid)(const vector<Move>&) = nullptr) const {
+        auto result = vector<Formula>();
+        for (const auto& symmetry : symmetries) {
+            auto moves = Apply(formula.moves, symmetry);
+            if (is_valid && !is_valid(moves))
+                continue;
+            if (seen.insert(ComputePermutationKey(moves)).second)
+                result.emplace_back(moves);
+        }
+        return result;
+    }
+};
+
+// 面の手筋で、スライスを外側から順に使っているか
+// search_face_formula.cpp の slice_index_max と同じ条件
+// 対称なものを展開すると反対側のスライスから使うものもできるので、これで除く
+template <int order>
+[[maybe_unused]] static bool UsesSlicesFromOutside(const vector<Move>& moves) {
+    auto slice_index_max = 0;
+    for (const auto& mov : moves) {
+        const int i = mov.depth;
+        if (i == 0 || i == order - 1)
+            continue;
+        if (order % 2 == 1 && i == order / 2)
+            continue;
+        if (slice_index_max + 2 <= i && i <= order - slice_index_max - 2)
+            return false;
+        if (i < order / 2 && i == slice_index_max + 1)
+            slice_index_max++;
+    }
+    return true;
+}
+
+// 作用 (keys) が同じ手筋のうち、手数 (costs) が最小のもの
+// (同じなら先のもの) の番号を昇順に返す
+[[maybe_unused]] static vector<int>
+SelectCheapestPerKey(const vector<string>& keys, const vector<int>& costs) {
+    assert(keys.size() == costs.size());
+    auto best_indices = unordered_map<string, int>();
+    for (auto i = 0; i < (int)keys.size(); i++) {
+        const auto [it, inserted] = best_indices.try_emplace(keys[i], i);
+        if (!inserted && costs[i] < costs[it->second])
+            it->second = i;
+    }
+    auto indices = vector<int>();
+    indices.reserve(best_indices.size());
+    for (const auto& [key, i] : best_indices)
+        indices.push_back(i);
+    sort(indices.begin(), indices.end());
+    return indices;
+}
+
+// 手筋のファイルで、対称なものが省かれていることを示す行
+constexpr auto kSymmetryReducedHeader = "# Symmetry: reduced";
+
+// 手筋のバイナリ形式
+// 先頭に kFormulaBinaryMagic, フラグ (1 バイト), 各手筋の先頭の文字数
+// (1 バイト) があり、その後に手筋ごとに
+//   先頭の文字 (虹で使えるかどうかなど), 手数 (1 バイト), 手 (Move::ToByte())
+// が並ぶ
+// テキストより小さく、読むときに文字列を解析しなくて良い
+constexpr auto kFormulaBinaryMagic = "\x7f" "FML";
+constexpr auto kFormulaBinaryMagicSize = 4;
+constexpr auto kFormulaBinaryReduced = (u8)1; // kSymmetryReducedHeader と同じ
+
+// 手筋を FormulaWriter と同じ 1 手 1 バイトの形式で詰めて持つ
+// vector<Formula> より小さいので、探索で見つけた手筋を溜めておくのに使う
+struct PackedFormulas {
+    string data;         // 手数, 手, 手数, 手, ...
+    vector<u64> offsets; // 各手筋の data での位置
+
+    inline PackedFormulas() : data(), offsets() {}
+
+    inline int Size() const { return (int)offsets.size(); }
+
+    inline void Clear() {
+        data.clear();
+        offsets.clear();
+    }
+
+    inline void Add(const Move* const moves, const int n) {
+        assert(n < 256);
+        offsets.push_back(data.size());
+        data += (char)n;
+        for (auto i = 0; i < n; i++)
+            data += (char)moves[i].ToByte();
+    }
+
+    inline void Add(const vector<Move>& moves) {
+        Add(moves.data(), (int)moves.size());
+    }
+
+    inline void Append(const PackedFormulas& other) {
+        for (const auto offset : other.offsets)
+            offsets.push_back(data.size() + offset);
+        data += other.data;
+    }
+
+    // other の [begin, end) 番目の手筋を加える
+    inline void Append(const PackedFormulas& other, const int begin,
+                       const int end) {
+        if (begin == end)
+            return;
+        const auto data_begin = other.offsets[begin];
+        const auto data_end =
+            end == other.Size() ? other.data.size() : other.offsets[end];
+        for (auto i = begin; i < end; i++)
+            offsets.push_back(data.size() + other.offsets[i] - data_begin);
+        data.append(other.data, data_begin, data_end - data_begin);
+    }
+
+    inline int Cost(const int i) const { return (u8)data[offsets[i]]; }
+
+    inline vector<Move> Get(const int i) const {
+        auto moves = vector<Move>(Cost(i));
+        for (auto j = 0; j < (int)moves.size(); j++)
+            moves[j] = Move::FromByte((u8)data[offsets[i] + 1 + j]);
+        return moves;
+    }
+
+    // indices の手筋だけを、indices の順に残す
+    inline void Select(const vector<int>& indices) {
+        auto selected = PackedFormulas();
+        selected.offsets.reserve(indices.size());
+        for (const auto i : indices)
+            selected.Add(Get(i));
+        *this = std::move(selected);
+    }
+};
+
+// 手筋の探索 (search_face_formula.cpp などの Dfs()) で見つかる順番に
+// formulas を並べたときの番号を返す
+// 面の回転を先にした辞書順で、途中まで同じなら短い方が先
+template <int order>
+static vector<int> ComputeSearchOrder(const PackedFormulas& formulas) {
+    auto keys = vector<string>(formulas.Size());
+    for (auto i = 0; i < formulas.Size(); i++)
+        for (const auto& mov : formulas.Get(i)) {
+            const auto rank =
+                mov.depth == 0           ? (int)mov.direction
+                : mov.depth == order - 1 ? 6 + (int)mov.direction
+                                         : 6 * (mov.depth + 1) +
+                                               (int)mov.direction;
+            keys[i] += (char)rank;
+        }
+    auto indices = vector<int>(formulas.Size());
+    for (auto i = 0; i < formulas.Size(); i++)
+        indices[i] = i;
+    sort(indices.begin(), indices.end(),
+         [&keys](const int a, const int b) { return keys[a] < keys[b]; });
+    return indices;
+}
+
+// formulas の各手筋の作用のキー compute_key(手の列) を n_threads 個の
+// スレッドで計算する
+template <typename ComputeKey>
+static vector<string> ComputeFormulaKeys(const PackedFormulas& formulas,
+                                         int n_threads,
+                                         const ComputeKey& compute_key) {
+    n_threads = std::max(n_threads, 1);
+    auto keys = vector<string>(formulas.Size());
+    auto threads = vector<std::thread>();
+    for (auto i = 0; i < n_threads; i++)
+        threads.emplace_back([&, i] {
+            for (auto j = i; j < formulas.Size(); j += n_threads)
+                keys[j] = compute_key(formulas.Get(j));
+        });
+    for (auto& th : threads)
+        th.join();
+    return keys;
+}
+
+// 作用のキーが同じ手筋のうち、最も短いもの (同じ長さなら先のもの) の番号を
+// 昇順に返す
+// キーは n_threads 個のスレッドで計算する
+template <typename ComputeKey>
+static vector<int>
+SelectCheapestPerPermutation(const PackedFormulas& formulas,
+                             const int n_threads,
+                             const ComputeKey& compute_key) {
+    const auto keys = ComputeFormulaKeys(formulas, n_threads, compute_key);
+    auto costs = vector<int>();
+    costs.reserve(formulas.Size());
+    for (auto j = 0; j < formulas.Size(); j++)
+        costs.push_back(formulas.Cost(j));
+    const auto indices = SelectCheapestPerKey(keys, costs);
+    cout << format("Removed {} of {} formulas with the same permutation.",
+                   formulas.Size() - indices.size(), formulas.Size())
+         << endl;
+    return indices;
+}
+
+// 手筋の探索 (search_face_formula.cpp, search_edge_formula.cpp) の並列化
+// 先頭の split_depth 手で部分木に分け、空いたスレッドから順に次の部分木を
+// 取って探索する
+// 部分木の結果は元の Dfs() の順番に並べ直すので、1 スレッドのときと
+// 同じ結果になる
+// Searcher は max_depth, split_depth (Dfs() はこの深さに来たら subtrees に
+// 部分木を記録して戻る), subtrees と次のものを持つ
+//   Searcher(max_depth): スレッドごとの探索に使う
+//   Dfs(), ClearResults()
+//   LoadSubtree(subtree): 部分木の根から探索できるようにする
+//   StoreSubtree(subtree): 探索した結果を部分木に移す
+//   MergeSubtrees(): 部分木の結果を元の結果に差し込む
+//                    (SpliceSubtreeResults を使う)
+
+// 並列化するとき、部分木の数がスレッド数のこれ倍以上になるまで分ける
+constexpr auto kNSubtreesPerThread = 16;
+
+// searcher.subtrees を n_threads 個のスレッドで探索して、結果を差し込む
+template <typename Searcher>
+static void SearchSubtreesInParallel(Searcher& searcher, const int n_threads) {
+    auto next_idx = std::atomic<int>(0);
+    const auto work = [&] {
+        // 盤面と結果はスレッドごとに持つ
+        auto worker = Searcher(searcher.max_depth);
+        for (auto idx = next_idx++; idx < (int)searcher.subtrees.size();
+             idx = next_idx++) {
+            auto& subtree = searcher.subtrees[idx];
+            worker.LoadSubtree(subtree);
+            worker.ClearResults();
+            worker.Dfs();
+            worker.StoreSubtree(subtree);
+        }
+    };
+    auto threads = vector<std::thread>();
+    for (auto i = 0; i < std::max(n_threads, 1); i++)
+        threads.emplace_back(work);
+    for (auto& th : threads)
+        th.join();
+    searcher.MergeSubtrees();
+    searcher.subtrees.clear();
+}
+
+// 部分木の数が足りるまで split_depth を深くしてから、並列に探索する
+template <typename Searcher>
+static void ParallelDfs(Searcher& searcher, const int n_threads) {
+    searcher.split_depth = 0;
+    do {
+        searcher.split_depth++;
+        searcher.ClearResults();
+        searcher.subtrees.clear();
+        searcher.Dfs();
+    } while ((int)searcher.subtrees.size() < n_threads * kNSubtreesPerThread &&
+             searcher.split_depth + 1 < searcher.max_depth);
+    searcher.split_depth = -1;
+    SearchSubtreesInParallel(searcher, n_threads);
+}
+
+// 部分木ごとの結果 subtree.*part を、元の結果 base の subtree.*position 番目
+// の位置に差し込む
+// Sequence は PackedFormulas のように Size() と Append(other, begin, end) を
+// 持つか、vector
+template <typename Subtree, typename Sequence>
+static void SpliceSubtreeResults(Sequence& base, vector<Subtree>& subtrees,
+                                 int Subtree::*const position,
+                                 Sequence Subtree::*const part) {
+    const auto size = [](const Sequence& sequence) {
+        if constexpr (requires { sequence.Size(); })
+            return sequence.Size();
+        else
+            return (int)sequence.size();
+    };
+    const auto append = [](Sequence& dst, const Sequence& src,
+                           const int begin, const int end) {
+        if constexpr (requires { dst.Append(src, begin, end); })
+            dst.Append(src, begin, end);
+        else
+            dst.insert(dst.end(), src.begin() + begin, src.begin() + end);
+    };
+    auto merged = Sequence();
+    auto begin = 0;
+    for (auto& subtree : subtrees) {
+        append(merged, base, begin, subtree.*position);
+        begin = subtree.*position;
+        append(merged, subtree.*part, 0, size(subtree.*part));
+        subtree.*part = Sequence();
+    }
+    append(merged, base, begin, size(base));
+    base = std::move(merged);
+}
+
+// 手筋をバイナリ形式で書き出す
+// kBufferSize 溜まるごとに書き出すので、書き出す手筋を全て持たなくて良い
+// 途中で止まったファイルを ResolveFormulaFile が拾わないように、
+// <filename>.tmp に書いて Close() で置き換える
+struct FormulaWriter {
+    static constexpr auto kBufferSize = 1 << 20;
+
+    string filename;
+    ofstream ofs;
+    string buffer;
+    int prefix_size;
+    long long n_formulas;
+
+    inline FormulaWriter(const string& filename, const bool reduced,
+                         const int prefix_size = 0)
+        : filename(filename), ofs(TmpFilename(), ios::binary), buffer(),
+          prefix_size(prefix_size), n_formulas(0) {
+        if (!ofs.good()) {
+            cerr << format("Cannot open file `{}`.", TmpFilename()) << endl;
+            abort();
+        }
+        buffer.append(kFormulaBinaryMagic, kFormulaBinaryMagicSize);
+        buffer += (char)(reduced ? kFormulaBinaryReduced : 0);
+        buffer += (char)prefix_size;
+    }
+
+    inline ~FormulaWriter() {
+        if (ofs.is_open())
+            Close();
+    }
+
+    inline string TmpFilename() const { return filename + ".tmp"; }
+
+    inline void Write(const Move* const moves, const int n,
+                      const string& prefix = "") {
+        assert((int)prefix.size() == prefix_size);
+        assert(n < 256);
+        buffer += prefix;
+        buffer += (char)n;
+        for (auto i = 0; i < n; i++)
+            buffer += (char)moves[i].ToByte();
+        n_formulas++;
+        if ((int)buffer.size() >= kBufferSize)
+            Flush();
+    }
+
+    inline void Write(const vector<Move>& moves, const string& prefix = "") {
+        Write(moves.data(), (int)moves.size(), prefix);
+    }
+
+    inline void Flush() {
+        ofs.write(buffer.data(), buffer.size());
+        ofs.flush();
+        buffer.clear();
+        if (!ofs.good()) {
+            cerr << format("Cannot write file `{}`.", TmpFilename()) << endl;
+            abort();
+        }
+    }
+
+    // 残りを書き出し、書けていれば filename に置き換える
+    inline void Close() {
+        Flush();
+        ofs.close();
+        if (!ofs.good() ||
+            std::rename(TmpFilename().c_str(), filename.c_str()) != 0) {
+            cerr << format("Cannot write file `{}`.", filename) << endl;
+            abort();
+        }
+    }
+};
+
+// 手筋のファイルの名前
+// 同じ名前で拡張子が .bin のものがあれば、バイナリ形式のそちらを使う
+[[maybe_unused]] static string ResolveFormulaFile(const string& filename) {
+    const auto dot = filename.rfind('.');
+    if (dot == string::npos || filename.substr(dot) == ".bin")
+        return filename;
+    const auto binary_filename = filename.substr(0, dot) + ".bin";
+    if (ifstream(binary_filename).good())
+        return binary_filename;
+    return filename;
+}
+
+// バイナリ形式の手筋のファイルを読み取り、手筋ごとに
+// callback(先頭の文字, 手の列) を呼ぶ
+// 先頭のマジックが違えば false を返す
+// 途中で切れていれば止める
+template <typename Callback>
+static bool ReadFormulaBinaryFile(ifstream& ifs, const int prefix_size,
+                                  bool& reduced, const Callback& callback) {
+    auto header = string(kFormulaBinaryMagicSize + 2, '\0');
+    ifs.read(header.data(), header.size());
+    if (header.compare(0, kFormulaBinaryMagicSize, kFormulaBinaryMagic) != 0) {
+        ifs.clear();
+        ifs.seekg(0);
+        return false;
+    }
+    if (!ifs) {
+        cerr << "Formula file is truncated in the header." << endl;
+        abort();
+    }
+    reduced = (u8)header[kFormulaBinaryMagicSize] & kFormulaBinaryReduced;
+    const auto file_prefix_size = (int)(u8)header[kFormulaBinaryMagicSize + 1];
+    if (file_prefix_size != prefix_size) {
+        cerr << format("Expected prefix size {}, but the file has {}.",
+                       prefix_size, file_prefix_size)
+             << endl;
+        abort();
+    }
+    const auto data = string(istreambuf_iterator<char>(ifs), {});
+    auto moves = vector<Move>();
+    const auto check_size = [&data](const u64 p, const u64 size) {
+        if (size <= data.size() - p)
+            return;
+        cerr << format("Formula file is truncated at byte {}: needs {} more "
+                       "bytes, but {} remain.",
+                       kFormulaBinaryMagicSize + 2 + p, size, data.size() - p)
+             << endl;
+        abort();
+    };
+    for (auto p = 0ull; p < data.size();) {
+        check_size(p, prefix_size + 1);
+        const auto prefix = data.substr(p, prefix_size);
+        p += prefix_size;
+        moves.resize((u8)data[p++]);
+        check_size(p, moves.size());
+        for (auto& mov : moves)
+            mov = Move::FromByte((u8)data[p++]);
+        callback(prefix, moves);
+    }
+    return true;
+}
+
+// 手筋のファイルを読み取る
+// テキスト形式とバイナリ形式のどちらでも良い (ResolveFormulaFile)
+// 各行の先頭 prefix_size 文字 (虹で使えるかどうかなど) と手筋の組を返す
+// kSymmetryReducedHeader があれば対称なもののうち is_valid を満たすものに
+// 展開し、展開したものにも元の行と同じ先頭の文字を付ける
+template <int order>
+static vector<pair<string, Formula>>
+ReadFormulaFile(string filename, const int prefix_size = 0,
+                bool (*is_valid)(const vector<Move>&) = nullptr) {
+    filename = ResolveFormulaFile(filename);
+    auto ifs = ifstream(filename, ios::binary);
+    if (!ifs.good()) {
+        cerr << format("Cannot open file `{}`.", filename) << endl;
+        abort();
+    }
+    auto result = vector<pair<string, Formula>>();
+    auto reduced = false;
+    const auto add = [&result](const string& prefix,
+                               const vector<Move>& moves) {
+        result.emplace_back(prefix, Formula(moves));
+    };
+    if (!ReadFormulaBinaryFile(ifs, prefix_size, reduced, add)) {
+        string line;
+        while (getline(ifs, line)) {
+            if (line == kSymmetryReducedHeader)
+                reduced = true;
+            if (line.empty() || line[0] == '#')
+                continue;
+            result.emplace_back(line.substr(0, prefix_size),
+                                Formula(line.substr(prefix_size)));
+        }
+    }
+    if (!reduced)
+        return result;
+
+    const auto symmetry = FormulaSymmetry<order>();
+    // seen は作用ごとに最初のものを残すので、短いものから展開して、作用ごとに
+    // 最短の手筋が残るようにする (対称なものは手数が同じ)
+    stable_sort(result.begin(), result.end(),
+                [](const auto& lhs, const auto& rhs) {
+                    return lhs.second.Cost() < rhs.second.Cost();
+                });
+    auto seen = unordered_set<string>();
+    auto expanded = vector<pair<string, Formula>>();
+    for (const auto& [prefix, formula] : result)
+        for (auto& variant : symmetry.Expand(formula, seen, is_valid))
+            expanded.emplace_back(prefix, std::move(variant));
+    // 探索したときと同じ、面の回転を先にした辞書順に並べる
+    // 似た手筋が並ぶので、ソルバでのメモリアクセスの局所性が良くなる
+    const auto move_order = [](const Move& mov) {
+        const auto is_face_rotation = mov.depth == 0 || mov.depth == order - 1;
+        return tuple<bool, int, int>{!is_face_rotation, mov.depth,
+                                     (int)mov.direction};
+    };
+    sort(expanded.begin(), expanded.end(),
+         [&move_order](const auto& lhs, const auto& rhs) {
+             return lexicographical_compare(
+                 lhs.second.moves.begin(), lhs.second.moves.end(),
+                 rhs.second.moves.begin(), rhs.second.moves.end(),
+                 [&move_order](const Move& a, const Move& b) {
+                     return move_order(a) < move_order(b);
+                 });
+         });
+    cerr << format("Expanded {} formulas in `{}` into {}.", result.size(),
+                   filename, expanded.size())
+         << endl;
+    return expanded;
+}
+
+// "150-199" や "150,152,160-165" のような形式を読み取る
+[[maybe_unused]] static vector<int> ParseProblemIds(const string& s) {
+    auto ids = vector<int>();
+    auto iss = istringstream(s);
+    string token;
+    while (getline(iss, token, ',')) {
+        const auto hyphen = token.find('-');
+        if (hyphen == string::npos) {
+            ids.emplace_back(stoi(token));
+            continue;
+        }
+        const auto first = stoi(token.substr(0, hyphen));
+        const auto last = stoi(token.substr(hyphen + 1));
+        for (auto id = first; id <= last; id++)
+            ids.emplace_back(id);
+    }
+    return ids;
+}
+
 // kaggleの入力を読む
 tuple<int, bool, Formula> ReadKaggleInput(const string& filename_puzzles,
                                           const string& filename_sample,
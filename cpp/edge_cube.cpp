@@ -1,30 +1,66 @@
 #include "cube.cpp"
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <mutex>
+#include <optional>
+#include <span>
 #include <thread>
+#include <unordered_map>
 
+using std::atomic;
 using std::fill;
+using std::function;
 using std::lock_guard;
 using std::max;
+using std::memcmp;
+using std::memcpy;
 using std::min;
+using std::move;
 using std::mutex;
+using std::optional;
 using std::sort;
+using std::span;
 using std::swap;
 using std::thread;
-
-mutex mtx;
+using std::unordered_map;
 
 struct RawEdgeFacletPosition {
     i8 face_and_edge_id;
     i8 x;
 };
 
+// from, to は EdgeCube::faces を 1 次元に並べたときの添字
+// changes は storage か、mmap した手筋のデータベースを指す
+// (どちらも書き換えないので、コピーしても中身は共有する)
 struct EdgeFaceletChanges {
     struct Change {
-        RawEdgeFacletPosition from, to;
+        u16 from, to;
     };
-    vector<Change> changes;
+    span<const Change> changes;
     bool parity_change;
+    int touched_edges; // 動くマスを含む辺 (12 本) のビット集合
+    shared_ptr<const vector<Change>> storage;
+
+    inline EdgeFaceletChanges()
+        : changes(), parity_change(false), touched_edges(0), storage() {}
+
+    inline EdgeFaceletChanges(vector<Change>&& changes,
+                              const bool parity_change,
+                              const int touched_edges)
+        : changes(), parity_change(parity_change),
+          touched_edges(touched_edges),
+          storage(make_shared<const vector<Change>>(std::move(changes))) {
+        this->changes = *storage;
+    }
+
+    // changes の指す先はプロセスが終わるまで残っていること
+    inline EdgeFaceletChanges(const span<const Change> changes,
+                              const bool parity_change,
+                              const int touched_edges)
+        : changes(changes), parity_change(parity_change),
+          touched_edges(touched_edges), storage() {}
 };
 
 // 辺のための色
@@ -367,19 +403,25 @@ template <int order_, typename ColorType_ = ColorType48> struct EdgeCube {
                 Rotate(m);
     }
 
+    static constexpr auto kNFacelets = 6 * 4 * (order - 2);
+
+    // faces を 1 次元の配列として見る
+    inline ColorType* Data() { return &faces[0].facelets[0][0]; }
+    inline const ColorType* Data() const { return &faces[0].facelets[0][0]; }
+
+    inline static int FlatIndex(const RawEdgeFacletPosition& raw_pos) {
+        return raw_pos.face_and_edge_id * (order - 2) + raw_pos.x;
+    }
+
     inline void Rotate(const EdgeFaceletChanges& facelet_changes) {
-        static_assert(sizeof(faces) == 6 * 4 * (order - 2));
-        array<ColorType, 6 * 4 * (order - 2)> tmp;
-        for (auto i = 0; i < (int)facelet_changes.changes.size(); i++) {
-            const auto [face_and_edge_id, x] = facelet_changes.changes[i].from;
-            tmp[i] =
-                faces[face_and_edge_id / 4].facelets[face_and_edge_id % 4][x];
-        }
-        for (auto i = 0; i < (int)facelet_changes.changes.size(); i++) {
-            const auto [face_and_edge_id, x] = facelet_changes.changes[i].to;
-            faces[face_and_edge_id / 4].facelets[face_and_edge_id % 4][x] =
-                tmp[i];
-        }
+        static_assert(sizeof(faces) == kNFacelets * sizeof(ColorType));
+        array<ColorType, kNFacelets> tmp;
+        const auto data = Data();
+        const auto n_changes = (int)facelet_changes.changes.size();
+        for (auto i = 0; i < n_changes; i++)
+            tmp[i] = data[facelet_changes.changes[i].from];
+        for (auto i = 0; i < n_changes; i++)
+            data[facelet_changes.changes[i].to] = tmp[i];
         if constexpr (order % 2 == 0)
             corner_parity ^= facelet_changes.parity_change;
     }
@@ -505,30 +547,60 @@ template <int order_, typename ColorType_ = ColorType48> struct EdgeCube {
         return Formula(moves);
     }
 
-    inline auto ComputePLLParity() const requires(order % 2 == 0) {
+    // 12 本の辺それぞれについて、隣接する 2 つの面の辺
+    static constexpr auto kEdgeRows = array<array<array<i8, 2>, 2>, 12>{
+        array<array<i8, 2>, 2>{array<i8, 2>{D1, 0}, {F1, 0}},
+        {array<i8, 2>{D1, 1}, {R0, 0}},
+        {array<i8, 2>{D1, 2}, {F0, 0}},
+        {array<i8, 2>{D1, 3}, {R1, 0}},
+        {array<i8, 2>{D0, 0}, {F0, 2}},
+        {array<i8, 2>{D0, 1}, {R0, 2}},
+        {array<i8, 2>{D0, 2}, {F1, 2}},
+        {array<i8, 2>{D0, 3}, {R1, 2}},
+        {array<i8, 2>{F0, 1}, {R0, 3}},
+        {array<i8, 2>{F0, 3}, {R1, 1}},
+        {array<i8, 2>{F1, 1}, {R1, 3}},
+        {array<i8, 2>{F1, 3}, {R0, 1}},
+    };
+
+    // ComputeEdgeScore で各辺の評価に使う面の辺
+    static constexpr auto kScoreRows = array<array<i8, 2>, 12>{
+        array<i8, 2>{D1, 0}, {D1, 1}, {D1, 2}, {D1, 3}, {D0, 0}, {D0, 1},
+        {D0, 2},             {D0, 3}, {F0, 1}, {R1, 1}, {F1, 1}, {R0, 1},
+    };
+
+    // face_id * 4 + edge_id から、それが属する辺 (12 本のうちどれか) を引く
+    static constexpr auto kEdgeIndexOfRow = [] {
+        auto result = array<i8, 24>();
+        for (auto i = 0; i < 12; i++)
+            for (const auto& [face_id, edge_id] : kEdgeRows[i])
+                result[face_id * 4 + edge_id] = (i8)i;
+        return result;
+    }();
+
+    // 辺 edge の中央のマスと色が一致していないマスの数
+    inline int ComputeEdgeMismatch(const int edge) const {
+        const auto [face_id, edge_id] = kScoreRows[edge];
+        const auto& facelets = faces[face_id].facelets[edge_id];
+        const auto center = facelets[(order - 3) / 2].data / 2;
+        auto mismatch = 0;
+        for (auto x = 0; x < order - 2; x++)
+            mismatch += facelets[x].data / 2 != center;
+        return mismatch;
+    }
+
+    // 辺 edge で一番多い色から、その辺が揃ったときにあるべき位置を求める
+    inline int ComputeEdgePosition(const int edge) const
+        requires(order % 2 == 0)
+    {
         static constexpr auto kCL = (order - 4) / 2;
         static constexpr auto kCR = (order - 2) / 2;
-        static constexpr auto adjecent_edge_facelets =
-            array<array<array<i8, 2>, 2>, 12>{
-                array<array<i8, 2>, 2>{array<i8, 2>{D1, 0}, {F1, 0}},
-                {array<i8, 2>{D1, 1}, {R0, 0}},
-                {array<i8, 2>{D1, 2}, {F0, 0}},
-                {array<i8, 2>{D1, 3}, {R1, 0}},
-                {array<i8, 2>{D0, 0}, {F0, 2}},
-                {array<i8, 2>{D0, 1}, {R0, 2}},
-                {array<i8, 2>{D0, 2}, {F1, 2}},
-                {array<i8, 2>{D0, 3}, {R1, 2}},
-                {array<i8, 2>{F0, 1}, {R0, 3}},
-                {array<i8, 2>{F0, 3}, {R1, 1}},
-                {array<i8, 2>{F1, 1}, {R1, 3}},
-                {array<i8, 2>{F1, 3}, {R0, 1}},
-            };
         static const auto color_to_edge_position = [] {
             auto cube = EdgeCube();
             cube.Reset();
             auto result = array<int, 48>();
             for (auto i = 0; i < 12; i++) {
-                const auto [facelet0, facelet1] = adjecent_edge_facelets[i];
+                const auto [facelet0, facelet1] = kEdgeRows[i];
                 const auto [face_id_0, edge_id_0] = facelet0;
                 const auto [face_id_1, edge_id_1] = facelet1;
                 const auto color0l =
@@ -546,23 +618,24 @@ template <int order_, typename ColorType_ = ColorType48> struct EdgeCube {
             }
             return result;
         }();
-        // 置換を計算する
-        array<int, 12> positions;
-        for (auto i = 0; i < 12; i++) {
-            const auto [facelet, _] = adjecent_edge_facelets[i];
-            const auto [face_id, edge_id] = facelet;
-            auto counts = array<i8, 24>();
-            auto most_popular_color_count = 0;
-            auto most_popular_color = (i8)-1;
-            for (auto x = 0; x < order - 2; x++) {
-                const auto color = faces[face_id].facelets[edge_id][x].data;
-                if (counts[color]++ == most_popular_color_count) {
-                    most_popular_color_count++;
-                    most_popular_color = color;
-                }
+        const auto [facelet, _] = kEdgeRows[edge];
+        const auto [face_id, edge_id] = facelet;
+        auto counts = array<i8, 48>();
+        auto most_popular_color_count = 0;
+        auto most_popular_color = (i8)-1;
+        for (auto x = 0; x < order - 2; x++) {
+            const auto color = faces[face_id].facelets[edge_id][x].data;
+            if (counts[color]++ == most_popular_color_count) {
+                most_popular_color_count++;
+                most_popular_color = color;
             }
-            positions[i] = color_to_edge_position[most_popular_color];
         }
+        return color_to_edge_position[most_popular_color];
+    }
+
+    // 各辺のあるべき位置と角のパリティから PLL パリティを求める
+    inline static bool ComputePLLParity(array<int, 12> positions,
+                                        const bool corner_parity) {
         // パリティ以前に、同じ色がある場合は true を返す
         auto tmp_positions = positions;
         sort(tmp_positions.begin(), tmp_positions.end());
@@ -582,6 +655,14 @@ template <int order_, typename ColorType_ = ColorType48> struct EdgeCube {
         return parity;
     }
 
+    inline auto ComputePLLParity() const requires(order % 2 == 0) {
+        // 置換を計算する
+        array<int, 12> positions;
+        for (auto i = 0; i < 12; i++)
+            positions[i] = ComputeEdgePosition(i);
+        return ComputePLLParity(positions, corner_parity);
+    }
+
     // 各辺で中央のマスと一致していない数を数える
     inline auto ComputeEdgeScore() const {
         // あれ、1 面 4 色でよかったんじゃ……
@@ -817,10 +898,20 @@ template <int order_, typename ColorType_ = ColorType48> struct EdgeCube {
                     EdgeFace<order, ColorType>::GetRawPosition(original_pos.y,
                                                                original_pos.x);
                 raw_original_pos.face_and_edge_id += 4 * original_pos.face_id;
-                changes.push_back({raw_original_pos, raw_pos});
+                changes.push_back({(u16)FlatIndex(raw_original_pos),
+                                   (u16)FlatIndex(raw_pos)});
             }
         }
-        return EdgeFaceletChanges{changes, parity_change};
+        // 書き込み先が連続するように並べておく
+        sort(changes.begin(), changes.end(),
+             [](const auto& a, const auto& b) { return a.to < b.to; });
+        auto touched_edges = 0;
+        for (const auto& [from, to] : changes) {
+            touched_edges |= 1 << kEdgeIndexOfRow[from / (order - 2)];
+            touched_edges |= 1 << kEdgeIndexOfRow[to / (order - 2)];
+        }
+        return EdgeFaceletChanges(std::move(changes), parity_change,
+                                  touched_edges);
     }
 
     inline void Print() const {
@@ -854,19 +945,31 @@ template <int order_, typename ColorType_ = ColorType48> struct EdgeCube {
     }
 
     // unordered_set のためのハッシュ関数
+    // 8 マスずつまとめて混ぜる
     struct Hash {
         inline size_t operator()(const EdgeCube& cube) const {
+            const auto data = (const char*)cube.Data();
             auto result = (size_t)0xcbf29ce484222325ull;
-            for (const auto& face : cube.faces)
-                for (const auto& edge : face.facelets)
-                    for (const auto& facelet : edge)
-                        result = (result ^ facelet.data) * 0x100000001b3ull;
+            auto i = 0;
+            for (; i + 8 <= kNFacelets; i += 8) {
+                u64 word;
+                memcpy(&word, data + i, 8);
+                result = (result ^ word) * 0x100000001b3ull;
+                result ^= result >> 29;
+            }
+            for (; i < kNFacelets; i++)
+                result = (result ^ data[i]) * 0x100000001b3ull;
             return result;
         }
     };
 
     inline auto operator<=>(const EdgeCube&) const = default;
 
+    inline bool operator==(const EdgeCube& rhs) const {
+        return corner_parity == rhs.corner_parity &&
+               memcmp(Data(), rhs.Data(), sizeof(faces)) == 0;
+    }
+
     // TODO: Cube との相互変換
 };
 
@@ -874,17 +977,18 @@ template <int order> struct EdgeAction {
     using EdgeCube = ::EdgeCube<order>;
     Formula formula;
     EdgeFaceletChanges facelet_changes;
+    int id; // EdgeActionCandidateGenerator::actions での番号 (無ければ -1)
 
-    inline EdgeAction() : formula(), facelet_changes() {}
+    inline EdgeAction() : formula(), facelet_changes(), id(-1) {}
 
     inline EdgeAction(const Formula& formula)
         : formula(formula),
-          facelet_changes(EdgeCube::ComputeFaceletChanges(formula)) {
+          facelet_changes(EdgeCube::ComputeFaceletChanges(formula)), id(-1) {
         assert(!formula.use_facelet_changes);
     }
 
     inline EdgeAction(const Formula& formula, const EdgeFaceletChanges& changes)
-        : formula(formula), facelet_changes(changes) {
+        : formula(formula), facelet_changes(changes), id(-1) {
         assert(!formula.use_facelet_changes);
     }
 
@@ -977,18 +1081,52 @@ template <int order> struct EdgeState {
     EdgeCube cube;
     int score; // target との距離
     // int n_moves; // これまでに回した回数
+    // score を差分計算するための、辺ごとの不一致数とあるべき位置
+    array<i8, 12> edge_mismatches;
+    array<i8, 12> edge_positions; // 偶数のときだけ使う
 
     inline EdgeState(const EdgeCube& cube)
-        : cube(cube), score(cube.ComputeEdgeScore())
+        : cube(cube), score(), edge_mismatches(), edge_positions()
     // , n_moves()
-    {}
+    {
+        for (auto edge = 0; edge < 12; edge++)
+            UpdateEdge(edge);
+        UpdateScore();
+        assert(score == cube.ComputeEdgeScore());
+    }
 
     // inplace に変更する
+    // 手筋で動く辺だけ計算し直す
     inline void Apply(const EdgeAction& action) {
         cube.Rotate(action.facelet_changes);
-        score = cube.ComputeEdgeScore();
+        for (auto edges = action.facelet_changes.touched_edges; edges;
+             edges &= edges - 1)
+            UpdateEdge(__builtin_ctz(edges));
+        UpdateScore();
         // n_moves += action.Cost();
     }
+
+  private:
+    inline void UpdateEdge(const int edge) {
+        edge_mismatches[edge] = (i8)cube.ComputeEdgeMismatch(edge);
+        if constexpr (order % 2 == 0)
+            edge_positions[edge] = (i8)cube.ComputeEdgePosition(edge);
+    }
+
+    // EdgeCube::ComputeEdgeScore と同じ値になる
+    inline void UpdateScore() {
+        score = 0;
+        for (const auto mismatch : edge_mismatches)
+            score += mismatch;
+        score *= 2;
+        if constexpr (order % 2 == 0) {
+            auto positions = array<int, 12>();
+            for (auto edge = 0; edge < 12; edge++)
+                positions[edge] = edge_positions[edge];
+            score +=
+                EdgeCube::ComputePLLParity(positions, cube.corner_parity) * 100;
+        }
+    }
 };
 
 // yield を使って EdgeAction を生成する？
@@ -997,36 +1135,265 @@ template <int order> struct EdgeActionCandidateGenerator {
     using EdgeState = ::EdgeState<order>;
     using EdgeAction = ::EdgeAction<order>;
     vector<EdgeAction> actions;
+    // slice_variants[i]: actions[i] のスライスを別の深さにも回すようにしたもの
+    vector<vector<EdgeAction>> slice_variants;
 
     // ファイルから手筋を読み取る
     // ファイルには f1.d0.-r0.-f1 みたいなのが 1 行に 1 つ書かれている想定
-    inline void FromFile(const string& filename, const bool is_normal) {
-        actions.clear();
-
+    // (同じ名前の .bin があればバイナリ形式のそちらを読む)
+    // 展開した facelet_changes は {filename}.edge_actions_{order}_{mode}.bin
+    // に書き出しておき、次からはそれを mmap して他のプロセスと共有する
+    inline void FromFile(string filename, const bool is_normal) {
+        filename = ResolveFormulaFile(filename);
         // 面の回転 1 つだけからなる手筋を別途加える
+        auto formulas = vector<Formula>();
         for (auto i = 0; i < 6; i++) {
-            actions.emplace_back(
-                Formula(vector<Move>{Move{(Move::Direction)i, (i8)0}}));
-            actions.emplace_back(Formula(
-                vector<Move>{Move{(Move::Direction)i, (i8)(order - 1)}}));
+            formulas.emplace_back(vector<Move>{Move{(Move::Direction)i, (i8)0}});
+            formulas.emplace_back(
+                vector<Move>{Move{(Move::Direction)i, (i8)(order - 1)}});
         }
 
         // ファイルから読み取る
-        auto ifs = ifstream(filename);
-        if (!ifs.good()) {
-            cerr << format("Cannot open file `{}`.", filename) << endl;
-            abort();
-        }
-        string line;
-        while (getline(ifs, line)) {
-            if (line.empty() || line[0] == '#')
+        // 行の先頭は虹で使えるかどうか
+        for (const auto& [prefix, formula] :
+             ReadFormulaFile<order>(filename, 2)) {
+            if (!is_normal && prefix[0] == '0')
                 continue;
-            if (!is_normal && line[0] == '0')
+            formulas.emplace_back(formula);
+        }
+
+        // 盤面への作用が同じ手筋は、最も短いものだけ残す
+        {
+            auto keys = vector<string>();
+            auto costs = vector<int>();
+            for (const auto& formula : formulas) {
+                keys.push_back(FormulaSymmetry<order>::ComputePermutationKey(
+                    formula.moves));
+                costs.push_back(formula.Cost());
+            }
+            const auto indices = SelectCheapestPerKey(keys, costs);
+            cerr << format("Removed {} of {} formulas with the same "
+                           "permutation.",
+                           formulas.size() - indices.size(), formulas.size())
+                 << endl;
+            for (auto i = 0; i < (int)indices.size(); i++)
+                if (indices[i] != i)
+                    formulas[i] = move(formulas[indices[i]]);
+            formulas.resize(indices.size());
+        }
+
+        // スライスの置き換えは手筋だけで決まるので先に作っておく
+        auto variant_formulas = vector<vector<Formula>>();
+        for (const auto& formula : formulas)
+            variant_formulas.emplace_back(ComputeSliceVariantFormulas(formula));
+
+        const auto database_file =
+            format("{}.edge_actions_{}_{}.bin", filename, order,
+                   is_normal ? "normal" : "rainbow");
+        const auto content_hash =
+            ComputeContentHash(formulas, variant_formulas, is_normal);
+        if (AttachDatabase(database_file, content_hash, formulas,
+                           variant_formulas))
+            return;
+
+        actions.clear();
+        slice_variants.clear();
+        for (auto i = 0; i < (int)formulas.size(); i++) {
+            actions.emplace_back(formulas[i]);
+            actions.back().id = i;
+            slice_variants.emplace_back();
+            for (const auto& variant_formula : variant_formulas[i])
+                slice_variants.back().emplace_back(variant_formula);
+        }
+        PublishDatabase(database_file, content_hash);
+        // 書き出せたら、自分の分も捨ててファイルの方を使う
+        AttachDatabase(database_file, content_hash, formulas,
+                       variant_formulas);
+    }
+
+    // formula で depth1 のスライスを回すところで depth2 のスライスも回す
+    // (反対側も同様)
+    inline static vector<Formula>
+    ComputeSliceVariantFormulas(const Formula& formula) {
+        auto result = vector<Formula>();
+        array<bool, order> use_slice{};
+        for (const auto& mov : formula.moves) {
+            use_slice[mov.depth] = true;
+            use_slice[order - 1 - mov.depth] = true;
+        }
+        for (i8 depth1 = 1; depth1 < order / 2; depth1++) {
+            if (!use_slice[depth1])
                 continue;
-            actions.emplace_back(Formula(line.substr(2)));
+            for (i8 depth2 = 1; depth2 < order - 1; depth2++) {
+                if (use_slice[depth2] ||
+                    (order % 2 == 1 && depth2 == order / 2))
+                    continue;
+                auto moves = vector<Move>();
+                for (const auto& mov : formula.moves) {
+                    moves.emplace_back(mov);
+                    if (mov.depth == depth1)
+                        moves.push_back({mov.direction, depth2});
+                    else if (mov.depth == order - 1 - depth1)
+                        moves.push_back(
+                            {mov.direction, (i8)(order - 1 - depth2)});
+                }
+                result.emplace_back(moves);
+            }
+        }
+        return result;
+    }
+
+    inline static vector<EdgeAction>
+    ComputeSliceVariants(const Formula& formula) {
+        auto result = vector<EdgeAction>();
+        for (const auto& variant_formula : ComputeSliceVariantFormulas(formula))
+            result.emplace_back(variant_formula);
+        return result;
+    }
+
+    // 手筋のデータベースのファイルの中身
+    // Header, Entry (actions[i] の後に slice_variants[i] が続く), Change の順
+    // 形式を変えたら kVersion を上げる
+    // 手筋の中身や読み込み方が変わったら content_hash が変わるので作り直す
+    struct DatabaseHeader {
+        static constexpr auto kMagic = 0x4544'4745'4143'5431ull;
+        static constexpr auto kVersion = 2;
+        u64 magic;
+        int version;
+        int cube_order;
+        u64 content_hash;
+        int n_entries;
+        u64 n_changes;
+    };
+    struct DatabaseEntry {
+        u64 offset; // Change の配列の中での位置
+        int n_changes;
+        int parity_change;
+        int touched_edges;
+        int padding;
+    };
+
+    // 手筋とスライスの置き換え、虹かどうか、ファイルの中の構造体の大きさから
+    // 作るハッシュ値
+    inline static u64
+    ComputeContentHash(const vector<Formula>& formulas,
+                       const vector<vector<Formula>>& variant_formulas,
+                       const bool is_normal) {
+        auto hash = ContentHash();
+        const auto add_formula = [&hash](const Formula& formula) {
+            hash.Add(formula.moves.size());
+            for (const auto& mov : formula.moves)
+                hash.Add(mov.ToByte());
+        };
+        hash.Add(is_normal);
+        hash.Add(sizeof(DatabaseEntry));
+        hash.Add(sizeof(EdgeFaceletChanges::Change));
+        hash.Add(formulas.size());
+        for (auto i = 0; i < (int)formulas.size(); i++) {
+            add_formula(formulas[i]);
+            hash.Add(variant_formulas[i].size());
+            for (const auto& variant_formula : variant_formulas[i])
+                add_formula(variant_formula);
+        }
+        return hash.value;
+    }
+
+    inline bool AttachDatabase(const string& database_file,
+                               const u64 content_hash,
+                               const vector<Formula>& formulas,
+                               const vector<vector<Formula>>& variant_formulas) {
+        const auto data = MapSharedFile(database_file);
+        if (data.size() < sizeof(DatabaseHeader))
+            return false;
+        auto n_entries = 0;
+        for (const auto& variants : variant_formulas)
+            n_entries += 1 + (int)variants.size();
+        const auto header = (const DatabaseHeader*)data.data();
+        const auto entries =
+            (const DatabaseEntry*)(data.data() + sizeof(DatabaseHeader));
+        const auto changes =
+            (const EdgeFaceletChanges::Change*)(entries + header->n_entries);
+        if (header->magic != DatabaseHeader::kMagic ||
+            header->version != DatabaseHeader::kVersion ||
+            header->cube_order != order ||
+            header->content_hash != content_hash ||
+            header->n_entries != n_entries ||
+            data.size() !=
+                sizeof(DatabaseHeader) + n_entries * sizeof(DatabaseEntry) +
+                    header->n_changes * sizeof(EdgeFaceletChanges::Change)) {
+            cerr << format("`{}` is stale.", database_file) << endl;
+            MapSharedFile(database_file, true);
+            return false;
+        }
+        const auto make_action = [&](const Formula& formula,
+                                     const DatabaseEntry& entry) {
+            return EdgeAction(
+                formula,
+                EdgeFaceletChanges(
+                    span(changes + entry.offset, entry.n_changes),
+                    entry.parity_change, entry.touched_edges));
+        };
+        actions.clear();
+        slice_variants.clear();
+        auto idx_entry = 0;
+        for (auto i = 0; i < (int)formulas.size(); i++) {
+            actions.emplace_back(make_action(formulas[i], entries[idx_entry++]));
+            actions.back().id = i;
+            slice_variants.emplace_back();
+            for (const auto& variant_formula : variant_formulas[i])
+                slice_variants.back().emplace_back(
+                    make_action(variant_formula, entries[idx_entry++]));
         }
+        cerr << format("Attached `{}` ({} actions).", database_file, n_entries)
+             << endl;
+        return true;
+    }
+
+    inline void PublishDatabase(const string& database_file,
+                                const u64 content_hash) const {
+        auto entries = vector<DatabaseEntry>();
+        auto n_changes = (u64)0;
+        const auto add_entry = [&](const EdgeAction& action) {
+            const auto& facelet_changes = action.facelet_changes;
+            entries.push_back({n_changes, (int)facelet_changes.changes.size(),
+                               (int)facelet_changes.parity_change,
+                               facelet_changes.touched_edges, 0});
+            n_changes += facelet_changes.changes.size();
+        };
+        for (auto i = 0; i < (int)actions.size(); i++) {
+            add_entry(actions[i]);
+            for (const auto& variant : slice_variants[i])
+                add_entry(variant);
+        }
+        const auto header = DatabaseHeader{
+            DatabaseHeader::kMagic, DatabaseHeader::kVersion, order,
+            content_hash,           (int)entries.size(),      n_changes};
+
+        PublishSharedFile(database_file, [&](ostream& os) {
+            os.write((const char*)&header, sizeof(header));
+            os.write((const char*)entries.data(),
+                     entries.size() * sizeof(DatabaseEntry));
+            const auto write_changes = [&os](const EdgeAction& action) {
+                const auto& changes = action.facelet_changes.changes;
+                os.write((const char*)changes.data(),
+                         changes.size() * sizeof(EdgeFaceletChanges::Change));
+            };
+            for (auto i = 0; i < (int)actions.size(); i++) {
+                write_changes(actions[i]);
+                for (const auto& variant : slice_variants[i])
+                    write_changes(variant);
+            }
+        });
+    }
 
-        // TODO: 重複があるかもしれないので確認した方が良い
+    // 手筋のスライス置き換え
+    // 読み込んだ手筋以外 (置き換えた後のものなど) はその場で計算する
+    inline const vector<EdgeAction>&
+    SliceVariants(const EdgeAction& action, vector<EdgeAction>& buffer) const {
+        if (action.id != -1)
+            return slice_variants[action.id];
+        buffer = ComputeSliceVariants(action.formula);
+        return buffer;
     }
 
     inline const auto& Generate(const EdgeState&) const { return actions; }
@@ -1144,6 +1511,11 @@ template <int order> struct EdgeBeamSearchSolver {
     int beam_width;
     vector<vector<shared_ptr<EdgeNode>>> nodes;
     int n_threads;
+    TimeBudget time_budget; // 制限時間 (デフォルトは無制限)
+    BeamRoundStats round_stats; // 直前の Solve() の層の数と時間
+    CheckpointOptions checkpoint; // 途中経過の保存先と間隔
+    AsyncFileWriter checkpoint_writer;
+    mutex mtx; // 層へのノードの追加を守る
 
     inline EdgeBeamSearchSolver(const bool is_normal, const int beam_width,
                                 const string& formula_file,
@@ -1153,6 +1525,144 @@ template <int order> struct EdgeBeamSearchSolver {
         action_candidate_generator.FromFile(formula_file, is_normal);
     }
 
+    // current_cost 以降の層にあるノードとその祖先を保存する
+    // 親はポインタの代わりにレコードの番号で持つ (-1 は初期ノード)
+    // all_action は親の all_action から復元できるので保存しない
+    inline void SaveCheckpoint(const int current_cost,
+                               const EdgeCube& start_cube,
+                               const shared_ptr<EdgeNode>& start_node,
+                               const vector<RandomNumberGenerator>& rngs,
+                               const array<int, 16>& minimum_scores) {
+        auto records = vector<shared_ptr<EdgeNode>>();
+        auto parents = vector<int>();
+        auto record_ids = unordered_map<const EdgeNode*, int>();
+        const auto add_record = [&](const shared_ptr<EdgeNode>& node) {
+            // 祖先から順に番号を振る
+            auto chain = vector<shared_ptr<EdgeNode>>();
+            for (auto p = node; p && p != start_node; p = p->parent) {
+                if (record_ids.contains(p.get()))
+                    break;
+                chain.emplace_back(p);
+            }
+            for (auto it = chain.rbegin(); it != chain.rend(); it++) {
+                const auto& p = *it;
+                parents.emplace_back(p->parent == start_node
+                                         ? -1
+                                         : record_ids.at(p->parent.get()));
+                record_ids[p.get()] = (int)records.size();
+                records.emplace_back(p);
+            }
+            return node == start_node ? -1 : record_ids.at(node.get());
+        };
+        auto layers = vector<pair<int, vector<int>>>(); // cost, records
+        for (int cost = current_cost; cost < (int)nodes.size(); cost++) {
+            if (nodes[cost].empty())
+                continue;
+            layers.emplace_back(cost, vector<int>());
+            for (const auto& node : nodes[cost])
+                layers.back().second.emplace_back(add_record(node));
+        }
+
+        checkpoint_writer.Write(
+            checkpoint.filename,
+            [beam_width = beam_width, current_cost, start_cube, rngs,
+             minimum_scores, records = move(records),
+             parents = move(parents), layers = move(layers)](ostream& os) {
+                WriteBinary(os, order);
+                WriteBinary(os, beam_width);
+                WriteBinary(os, current_cost);
+                WriteBinary(os, start_cube);
+                WriteBinary(os, rngs);
+                WriteBinary(os, minimum_scores);
+                WriteBinary(os, (u64)records.size());
+                for (int i = 0; i < (int)records.size(); i++) {
+                    WriteBinary(os, parents[i]);
+                    WriteBinary(os, records[i]->state.cube);
+                    WriteBinary(os, records[i]->last_action.formula.moves);
+                }
+                WriteBinary(os, (u64)layers.size());
+                for (const auto& [cost, record_ids] : layers) {
+                    WriteBinary(os, cost);
+                    WriteBinary(os, record_ids);
+                }
+            });
+    }
+
+    // SaveCheckpoint で保存したものを読み込み、再開する層を返す
+    inline int LoadCheckpoint(const EdgeCube& start_cube,
+                              const shared_ptr<EdgeNode>& start_node,
+                              vector<RandomNumberGenerator>& rngs,
+                              array<int, 16>& minimum_scores) {
+        auto ifs = ifstream(checkpoint.filename, ios::binary);
+        int saved_order, current_cost;
+        auto saved_start_cube = start_cube;
+        ReadBinary(ifs, saved_order);
+        ReadBinary(ifs, beam_width);
+        ReadBinary(ifs, current_cost);
+        ReadBinary(ifs, saved_start_cube);
+        if (!ifs.good() || saved_order != order ||
+            !(saved_start_cube == start_cube)) {
+            cerr << format("Checkpoint `{}` does not match this problem.",
+                           checkpoint.filename)
+                 << endl;
+            abort();
+        }
+        auto n_rngs = (u64)0;
+        ReadBinary(ifs, n_rngs);
+        for (auto i = (u64)0; i < n_rngs; i++) {
+            auto rng = RandomNumberGenerator(0);
+            ReadBinary(ifs, rng);
+            if (i < rngs.size())
+                rngs[i] = rng;
+        }
+        ReadBinary(ifs, minimum_scores);
+
+        auto n_records = (u64)0;
+        ReadBinary(ifs, n_records);
+        auto records = vector<shared_ptr<EdgeNode>>();
+        records.reserve(n_records);
+        for (auto i = (u64)0; i < n_records; i++) {
+            int parent_id;
+            auto cube = start_node->state.cube;
+            auto moves = vector<Move>();
+            ReadBinary(ifs, parent_id);
+            ReadBinary(ifs, cube);
+            ReadBinary(ifs, moves);
+            const auto state = EdgeState(cube);
+            const auto& parent =
+                parent_id == -1 ? start_node : records[parent_id];
+            const auto last_action = EdgeAction(Formula(moves));
+            records.emplace_back(make_shared<EdgeNode>(
+                state, parent, last_action,
+                parent->all_action.Merge(last_action)));
+        }
+
+        auto n_layers = (u64)0;
+        ReadBinary(ifs, n_layers);
+        for (auto i = (u64)0; i < n_layers; i++) {
+            int cost;
+            auto record_ids = vector<int>();
+            ReadBinary(ifs, cost);
+            ReadBinary(ifs, record_ids);
+            nodes[cost].clear();
+            for (const auto record_id : record_ids)
+                nodes[cost].emplace_back(record_id == -1 ? start_node
+                                                         : records[record_id]);
+        }
+        if (!ifs.good()) {
+            cerr << format("Cannot read checkpoint `{}`.", checkpoint.filename)
+                 << endl;
+            abort();
+        }
+        checkpoint.resume = false;
+        cout << format("resumed from {}: current_cost={} beam_width={} "
+                       "records={}",
+                       checkpoint.filename, current_cost, beam_width,
+                       records.size())
+             << endl;
+        return current_cost;
+    }
+
     inline shared_ptr<EdgeNode> Solve(const EdgeCube& start_cube) {
         // auto rng = RandomNumberGenerator(42);
         vector<RandomNumberGenerator> rngs;
@@ -1166,27 +1676,69 @@ template <int order> struct EdgeBeamSearchSolver {
         nodes.resize(1);
         nodes[0].push_back(start_node);
         nodes.resize(9999);
+        round_stats = BeamRoundStats();
 
         auto minimum_scores = array<int, 16>();
         fill(minimum_scores.begin(), minimum_scores.end(), 9999);
-        for (auto current_cost = 0; current_cost < 100000; current_cost++) {
+        // スレッドごとに、ノードの展開に使った時間を記録する
+        auto busy_seconds = vector<double>(n_threads);
+        auto expansion_seconds = 0.0;
+        const auto report_busy_times = [&] {
+            for (auto ii = 0; ii < n_threads; ii++)
+                cerr << format("thread {}: busy {:.2f}s ({:.1f}%)", ii,
+                               busy_seconds[ii],
+                               100.0 * busy_seconds[ii] /
+                                   max(expansion_seconds, 1e-9))
+                     << endl;
+        };
+        // --resume なら保存した層から再開する
+        auto first_cost = 0;
+        if (checkpoint.CanResume()) {
+            nodes[0].clear();
+            first_cost =
+                LoadCheckpoint(start_cube, start_node, rngs, minimum_scores);
+        }
+        for (auto current_cost = first_cost; current_cost < 100000;
+             current_cost++) {
             auto current_minimum_score = 9999;
+            const auto layer_start = time_budget.Elapsed();
+            auto layer_telemetry = LayerTelemetry("edge_layer", current_cost,
+                                                  nodes[current_cost].size());
             for (const auto& node : nodes[current_cost]) {
                 current_minimum_score =
                     min(current_minimum_score, node->state.score);
+                layer_telemetry.AddNode(node->state.score);
                 if (node->state.score == 0) {
                     cerr << "Solved!" << endl;
+                    report_busy_times();
                     return node;
                 }
             }
+            if (time_budget.IsOver()) {
+                cerr << "Time over." << endl;
+                report_busy_times();
+                return nullptr;
+            }
+            if (checkpoint.Enabled() &&
+                checkpoint_writer.SinceLastWrite() >= checkpoint.interval)
+                SaveCheckpoint(current_cost, start_cube, start_node, rngs,
+                               minimum_scores);
 
             // multithread
+            // 層のノードを小さな塊に分け、空いたスレッドから順に取っていく
+            // ノードが少ない層でも全スレッドが働けるようにする
+            const int n_nodes = (int)nodes[current_cost].size();
+            const int chunk_size = max(1, n_nodes / (n_threads * 16));
+            auto next_idx_node = atomic<int>(0);
+            const auto expansion_start = std::chrono::steady_clock::now();
             vector<thread> threads;
             for (int ii = 0; ii < n_threads; ii++) {
-                int n_nodes = (int)nodes[current_cost].size();
                 thread th(
                     [&](int ii) {
+                        const auto thread_start =
+                            std::chrono::steady_clock::now();
                         auto& rng = rngs[ii];
+                        auto n_candidates = 0ull, n_accepted = 0ull;
                         /* for (const auto& node : nodes[current_cost]) { */
                         const auto check_unique = [&](const auto& n_moves,
                                                       const auto& state) {
@@ -1197,12 +1749,15 @@ template <int order> struct EdgeBeamSearchSolver {
                             return true;
                         };
 
-                        const int idx_node_low = ii * beam_width;
-                        const int idx_node_high = (ii + 1) * beam_width;
-                        for (int idx_node = idx_node_low;
-                             idx_node < idx_node_high; idx_node++) {
+                        for (int idx_node = 0, idx_node_high = 0;;
+                             idx_node++) {
+                            if (idx_node == idx_node_high) {
+                                idx_node = next_idx_node.fetch_add(chunk_size);
+                                idx_node_high =
+                                    min(idx_node + chunk_size, n_nodes);
+                            }
                             if (idx_node >= n_nodes)
-                                continue;
+                                break;
                             const auto& node = nodes[current_cost][idx_node];
 
                             for (const auto& action :
@@ -1210,6 +1765,7 @@ template <int order> struct EdgeBeamSearchSolver {
                                      node->state)) {
                                 auto new_state = node->state;
                                 new_state.Apply(action);
+                                n_candidates++;
                                 /*
                                 if (action.formula.Cost() == 1 &&
                                     (action.formula.moves[0].depth == 0 ||
@@ -1225,7 +1781,8 @@ template <int order> struct EdgeBeamSearchSolver {
                                 */
 
                                 const auto try_make_new_node = [this, &rng,
-                                                                check_unique](
+                                                                check_unique,
+                                                                &n_accepted](
                                                                    const auto&
                                                                        node,
                                                                    const auto&
@@ -1265,7 +1822,7 @@ template <int order> struct EdgeBeamSearchSolver {
                                             n_threads * beam_width) {
                                             if (check_unique(new_n_moves,
                                                              new_state)) {
-
+                                                n_accepted++;
                                                 nodes[new_n_moves].emplace_back(
                                                     new EdgeNode(
                                                         new_state, node, action,
@@ -1286,6 +1843,7 @@ template <int order> struct EdgeBeamSearchSolver {
                                                     ->state.score) {
                                                 if (check_unique(new_n_moves,
                                                                  new_state)) {
+                                                    n_accepted++;
                                                     nodes[new_n_moves][idx]
                                                         .reset(new EdgeNode(
                                                             new_state, node,
@@ -1305,69 +1863,58 @@ template <int order> struct EdgeBeamSearchSolver {
                             if (node->parent != nullptr) {
                                 EdgeNode node_parent = node->parent->CopyNode();
                                 /* if (false) { */
-                                array<bool, order> use_slice{};
-                                for (const auto& mov :
-                                     node->last_action.formula.moves) {
-                                    use_slice[mov.depth] = true;
-                                    use_slice[order - 1 - mov.depth] = true;
-                                }
-                                for (i8 depth1 = 1; depth1 < order / 2;
-                                     depth1++) {
-                                    if (!use_slice[depth1])
+                                auto variants_buffer = vector<EdgeAction>();
+                                for (const auto& action_new :
+                                     action_candidate_generator.SliceVariants(
+                                         node->last_action, variants_buffer)) {
+                                    auto new_state = node_parent.state;
+                                    new_state.Apply(action_new);
+                                    n_candidates++;
+                                    int new_n_moves =
+                                        node_parent.CostApplied(action_new);
+                                    if (new_n_moves <=
+                                        node->all_action.formula.Cost())
                                         continue;
-                                    for (i8 depth2 = 1; depth2 < order - 1;
-                                         depth2++) {
-                                        if (use_slice[depth2] ||
-                                            (order % 2 == 1 &&
-                                             depth2 == order / 2))
-                                            continue;
-                                        EdgeAction action_new;
-                                        for (const auto& mov :
-                                             node->last_action.formula.moves) {
-                                            action_new.formula.moves
-                                                .emplace_back(mov);
-                                            if (mov.depth == depth1) {
-                                                Move mov_tmp = mov;
-                                                mov_tmp.depth = depth2;
-                                                action_new.formula.moves
-                                                    .emplace_back(mov_tmp);
-                                            } else if (mov.depth ==
-                                                       order - 1 - depth1) {
-                                                Move mov_tmp = mov;
-                                                mov_tmp.depth =
-                                                    order - 1 - depth2;
-                                                action_new.formula.moves
-                                                    .emplace_back(mov_tmp);
-                                            }
-                                        }
-                                        /*
-                                        node->last_action.formula.Print(cerr);
-                                        cerr << endl;
-                                        action_new.formula.Print(cerr);
-                                        cerr << endl;
-                                        cerr << endl;
-                                        */
-
-                                        auto new_state = node_parent.state;
-                                        new_state.Apply(action_new);
-                                        int new_n_moves =
-                                            node_parent.CostApplied(action_new);
-                                        if (new_n_moves <=
-                                            node->all_action.formula.Cost())
-                                            continue;
-                                        /*
-                                        if (new_n_moves >= (int)nodes.size())
-                                            nodes.resize(new_n_moves + 1);
-                                        */
+                                    /*
+                                    if (new_n_moves >= (int)nodes.size())
+                                        nodes.resize(new_n_moves + 1);
+                                    */
+                                    if ((int)nodes[new_n_moves].size() <
+                                        n_threads * beam_width) {
+                                        lock_guard<mutex> lock(mtx);
                                         if ((int)nodes[new_n_moves].size() <
                                             n_threads * beam_width) {
+                                            if (check_unique(new_n_moves,
+                                                             new_state)) {
+                                                n_accepted++;
+                                                nodes[new_n_moves]
+                                                    .emplace_back(new EdgeNode(
+                                                        new_state,
+                                                        node->parent,
+                                                        action_new,
+                                                        node->parent
+                                                            ->all_action
+                                                            .Merge(
+                                                                action_new)));
+                                            }
+                                        }
+                                    } else {
+                                        const auto idx =
+                                            rng.Next() %
+                                            (n_threads * beam_width);
+                                        if (new_state.score <
+                                            nodes[new_n_moves][idx]
+                                                ->state.score) {
                                             lock_guard<mutex> lock(mtx);
-                                            if ((int)nodes[new_n_moves].size() <
-                                                n_threads * beam_width) {
-                                                if (check_unique(new_n_moves,
-                                                                 new_state)) {
-                                                    nodes[new_n_moves]
-                                                        .emplace_back(new EdgeNode(
+                                            if (new_state.score <
+                                                nodes[new_n_moves][idx]
+                                                    ->state.score) {
+                                                if (check_unique(
+                                                        new_n_moves,
+                                                        new_state)) {
+                                                    n_accepted++;
+                                                    nodes[new_n_moves][idx]
+                                                        .reset(new EdgeNode(
                                                             new_state,
                                                             node->parent,
                                                             action_new,
@@ -1377,37 +1924,16 @@ template <int order> struct EdgeBeamSearchSolver {
                                                                     action_new)));
                                                 }
                                             }
-                                        } else {
-                                            const auto idx =
-                                                rng.Next() %
-                                                (n_threads * beam_width);
-                                            if (new_state.score <
-                                                nodes[new_n_moves][idx]
-                                                    ->state.score) {
-                                                lock_guard<mutex> lock(mtx);
-                                                if (new_state.score <
-                                                    nodes[new_n_moves][idx]
-                                                        ->state.score) {
-                                                    if (check_unique(
-                                                            new_n_moves,
-                                                            new_state)) {
-                                                        nodes[new_n_moves][idx]
-                                                            .reset(new EdgeNode(
-                                                                new_state,
-                                                                node->parent,
-                                                                action_new,
-                                                                node->parent
-                                                                    ->all_action
-                                                                    .Merge(
-                                                                        action_new)));
-                                                    }
-                                                }
-                                            }
                                         }
                                     }
                                 }
                             }
                         }
+                        busy_seconds[ii] +=
+                            std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - thread_start)
+                                .count();
+                        layer_telemetry.AddCandidates(n_candidates, n_accepted);
                     },
                     ii);
                 threads.emplace_back(move(th));
@@ -1415,20 +1941,33 @@ template <int order> struct EdgeBeamSearchSolver {
             for (auto& th : threads)
                 th.join();
             threads.clear();
-
-            cout << format("current_cost={} current_minimum_score={}",
-                           current_cost, current_minimum_score)
-                 << endl;
+            expansion_seconds += std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() -
+                                     expansion_start)
+                                     .count();
+
+            layer_telemetry.Emit(n_threads * beam_width);
+            round_stats.AddLayer(time_budget.Elapsed() - layer_start);
+            // 各層に n_threads * beam_width 個のノードが入る
+            round_stats.bytes_per_beam_width =
+                (double)round_stats.n_layers * n_threads *
+                (sizeof(shared_ptr<EdgeNode>) + sizeof(EdgeNode));
+            if constexpr (kTelemetryLevel >= 1)
+                cout << format("current_cost={} current_minimum_score={}",
+                               current_cost, current_minimum_score)
+                     << endl;
             if (nodes[current_cost][0]->state.score ==
                 minimum_scores[current_cost % 16]) {
                 cerr << "Failed." << endl;
                 nodes[current_cost][0]->state.cube.Display();
+                report_busy_times();
                 return nullptr;
             }
             minimum_scores[current_cost % 16] = current_minimum_score;
             nodes[current_cost].clear();
         }
         cerr << "Failed." << endl;
+        report_busy_times();
         return nullptr;
     }
 };
@@ -1549,27 +2088,22 @@ template <int order> struct EdgeBeamSearchSolver {
     }
 }
 
-template <int order>
-static void SolveWithOrder(const int problem_id, const bool is_normal,
-                           const Formula& sample_formula, const int beam_width,
-                           const int n_threads) {
-    constexpr auto formula_depth =
-        order == 3 ? 1 : order <= 5 ? 9 : order <= 19 ? 8 : 7;
-    const auto formula_file =
-        format("out/edge_formula_{}_{}.txt", order, formula_depth);
+// 辺ソルバが使う手順の長さ
+template <int order> static constexpr int EdgeFormulaDepth() {
+    return order == 3 ? 1 : order <= 5 ? 9 : order <= 19 ? 8 : 7;
+}
 
-    // 面ソルバの出力を読み込む
-    const auto face_solution_file =
-        format("solution_face/{}_best.txt", problem_id);
-    auto face_solution_string = string();
-    auto ifs = ifstream(face_solution_file);
-    if (!ifs.good()) {
-        cerr << format("Cannot open file `{}`.", face_solution_file) << endl;
-        abort();
-    }
-    getline(ifs, face_solution_string);
-    ifs.close();
-    const auto face_solution = Formula(face_solution_string);
+// 用意した solver で、面を揃える解 face_solution の後に辺を揃える
+// 辺の解 (パリティの解消を含む) が見つかるたびに on_solution を呼ぶ
+// on_solution が false を返すか、制限時間内にビームを広げられなくなったら
+// 止めて、最後に見つかった解を返す
+// solver は手順を読み込み済みのものを使い回してよい
+template <int order>
+static optional<Formula>
+SolveEdgePhase(EdgeBeamSearchSolver<order>& solver, const bool is_normal,
+               const Formula& sample_formula, const Formula& face_solution,
+               const function<bool(const Formula&)>& on_solution) {
+    const auto& time_budget = solver.time_budget;
 
     // キューブを表示するラムダ式
     const auto display_cube = [&sample_formula, &face_solution, &is_normal](
@@ -1623,7 +2157,6 @@ static void SolveWithOrder(const int problem_id, const bool is_normal,
     const auto parity_resolving_formula =
         parity_resolved_edge_cube.ComputeParityResolvingFormula(parities);
     parity_resolved_edge_cube.Rotate(parity_resolving_formula);
-    auto result_moves = parity_resolving_formula.moves;
     cout << "parity: ";
     for (const auto p : parities)
         cout << p;
@@ -1635,79 +2168,158 @@ static void SolveWithOrder(const int problem_id, const bool is_normal,
     display_cube(parity_resolving_formula);
 
     // 解く
+    // 時間制限があれば、残り時間に収まるビーム幅で解き直し続ける
+    auto best_solution = optional<Formula>();
+    while (true) {
+        const auto run_start = time_budget.Elapsed();
+        const auto node = solver.Solve(parity_resolved_edge_cube);
+        if (node == nullptr) // 失敗
+            return best_solution;
+
+        // 結果を表示する
+        cout << node->all_action.formula.Cost() << endl;
+        auto result_moves = parity_resolving_formula.moves;
+        copy(node->all_action.formula.moves.begin(),
+             node->all_action.formula.moves.end(),
+             back_inserter(result_moves));
+        const auto solution = Formula(result_moves);
+        solution.Print();
+        cout << endl;
+        display_cube(solution);
+        best_solution = solution;
+
+        if (!on_solution(solution) || !time_budget.Enabled())
+            return best_solution;
+        const auto next_beam_width =
+            time_budget.FitBeamWidth(solver.beam_width,
+                                     time_budget.Elapsed() - run_start,
+                                     solver.round_stats);
+        if (next_beam_width <= solver.beam_width) {
+            cerr << "No time left for a wider beam." << endl;
+            return best_solution;
+        }
+        solver.beam_width = next_beam_width;
+        cout << format("beam_width={}", solver.beam_width) << endl;
+    }
+}
+
+// 面を揃える解 face_solution の後に辺を揃え、見つかった解を solution_edge に
+// 書き込む
+// 見つかった辺の解 (パリティの解消を含む) のうち最後のものを返す
+// 同じ問題を複数のスレッドで同時に解いてもよい
+template <int order>
+static optional<Formula>
+SolveEdgePhase(const int problem_id, const bool is_normal,
+               const Formula& sample_formula, const Formula& face_solution,
+               const int beam_width, const int n_threads,
+               const TimeBudget& time_budget = TimeBudget(),
+               CheckpointOptions checkpoint = CheckpointOptions()) {
+    constexpr auto formula_depth = EdgeFormulaDepth<order>();
+    const auto formula_file =
+        format("out/edge_formula_{}_{}.txt", order, formula_depth);
+
+    // 結果を保存するラムダ式
+    const auto save_solution = [&](const Formula& solution,
+                                   const int run_beam_width) {
+        static mutex save_mtx;
+        const auto lock = lock_guard<mutex>(save_mtx);
+        const auto all_solutions_file =
+            format("solution_edge/{}_all.txt", problem_id);
+        const auto best_solution_file =
+            format("solution_edge/{}_best.txt", problem_id);
+        auto ofs_all = ofstream(all_solutions_file, ios::app);
+        if (ofs_all.good()) {
+            face_solution.Print(ofs_all);
+            ofs_all << endl;
+            solution.Print(ofs_all);
+            ofs_all << endl
+                    << format("face_solution_score={} edge_solution_score={} "
+                              "beam_width={} formula_depth={}",
+                              face_solution.Cost(), solution.Cost(),
+                              run_beam_width, formula_depth)
+                    << endl;
+            ofs_all.close();
+        } else {
+            cerr << format("Cannot open file `{}`.", all_solutions_file)
+                 << endl;
+        }
+        auto ifs_best = ifstream(best_solution_file);
+        auto best_score = 99999;
+        if (ifs_best.good()) {
+            string line;
+            getline(ifs_best, line); // 面の解を読み飛ばす
+            getline(ifs_best, line); // 面のスコアを読む
+            best_score = stoi(line);
+            getline(ifs_best, line); // 辺の解を読み飛ばす
+            getline(ifs_best, line); // 辺のスコアの行を読む
+            best_score += stoi(line);
+            ifs_best.close();
+        }
+        if (face_solution.Cost() + solution.Cost() < best_score) {
+            auto ofs_best = ofstream(best_solution_file);
+            if (ofs_best.good()) {
+                // 面の解とスコアを書き込む
+                face_solution.Print(ofs_best);
+                ofs_best << endl << face_solution.Cost() << endl;
+                // 辺の解とスコアを書き込む
+                solution.Print(ofs_best);
+                ofs_best << endl << solution.Cost() << endl;
+                // 3x3x3 に帰着したキューブの状態を書き込む
+                auto cube = Cube<order, ColorType6>();
+                cube.Reset();
+                cube.RotateInv(sample_formula);
+                cube.Rotate(face_solution);
+                cube.Rotate(solution);
+                cube.PrintSingmaster(ofs_best);
+                ofs_best << endl;
+                ofs_best.close();
+            } else
+                cerr << format("Cannot open file `{}`.", best_solution_file)
+                     << endl;
+        }
+    };
+
     auto solver = EdgeBeamSearchSolver<order>(is_normal, beam_width,
                                               formula_file, n_threads);
-    const auto node = solver.Solve(parity_resolved_edge_cube);
-    if (node == nullptr) // 失敗
-        return;
-
-    // 結果を表示する
-    cout << node->all_action.formula.Cost() << endl;
-    copy(node->all_action.formula.moves.begin(),
-         node->all_action.formula.moves.end(), back_inserter(result_moves));
-    const auto solution = Formula(result_moves);
-    solution.Print();
-    cout << endl;
-    display_cube(solution);
-
-    // 結果を保存する
-    const auto all_solutions_file =
-        format("solution_edge/{}_all.txt", problem_id);
-    const auto best_solution_file =
-        format("solution_edge/{}_best.txt", problem_id);
-    auto ofs_all = ofstream(all_solutions_file, ios::app);
-    if (ofs_all.good()) {
-        face_solution.Print(ofs_all);
-        ofs_all << endl;
-        solution.Print(ofs_all);
-        ofs_all << endl
-                << format("face_solution_score={} edge_solution_score={} "
-                          "beam_width={} formula_depth={}",
-                          face_solution.Cost(), solution.Cost(), beam_width,
-                          formula_depth)
-                << endl;
-        ofs_all.close();
-    } else {
-        cerr << format("Cannot open file `{}`.", all_solutions_file) << endl;
-    }
-    auto ifs_best = ifstream(best_solution_file);
-    auto best_score = 99999;
-    if (ifs_best.good()) {
-        string line;
-        getline(ifs_best, line); // 面の解を読み飛ばす
-        getline(ifs_best, line); // 面のスコアを読む
-        best_score = stoi(line);
-        getline(ifs_best, line); // 辺の解を読み飛ばす
-        getline(ifs_best, line); // 辺のスコアの行を読む
-        best_score += stoi(line);
-        ifs_best.close();
-    }
-    if (face_solution.Cost() + solution.Cost() < best_score) {
-        auto ofs_best = ofstream(best_solution_file);
-        if (ofs_best.good()) {
-            // 面の解とスコアを書き込む
-            face_solution.Print(ofs_best);
-            ofs_best << endl << face_solution.Cost() << endl;
-            // 辺の解とスコアを書き込む
-            solution.Print(ofs_best);
-            ofs_best << endl << solution.Cost() << endl;
-            // 3x3x3 に帰着したキューブの状態を書き込む
-            auto cube = Cube<order, ColorType6>();
-            cube.Reset();
-            cube.RotateInv(sample_formula);
-            cube.Rotate(face_solution);
-            cube.Rotate(solution);
-            cube.PrintSingmaster(ofs_best);
-            ofs_best << endl;
-            ofs_best.close();
-        } else
-            cerr << format("Cannot open file `{}`.", best_solution_file)
-                 << endl;
+    solver.time_budget = time_budget;
+    checkpoint.filename = format("checkpoint/edge_{}.bin", problem_id);
+    solver.checkpoint = checkpoint;
+    return SolveEdgePhase<order>(
+        solver, is_normal, sample_formula, face_solution,
+        [&](const Formula& solution) {
+            save_solution(solution, solver.beam_width);
+            return true;
+        });
+}
+
+template <int order>
+static void SolveWithOrder(const int problem_id, const bool is_normal,
+                           const Formula& sample_formula, const int beam_width,
+                           const int n_threads,
+                           const TimeBudget& time_budget = TimeBudget(),
+                           const CheckpointOptions& checkpoint =
+                               CheckpointOptions()) {
+    // 面ソルバの出力を読み込む
+    const auto face_solution_file =
+        format("solution_face/{}_best.txt", problem_id);
+    auto face_solution_string = string();
+    auto ifs = ifstream(face_solution_file);
+    if (!ifs.good()) {
+        cerr << format("Cannot open file `{}`.", face_solution_file) << endl;
+        abort();
     }
+    getline(ifs, face_solution_string);
+    ifs.close();
+    const auto face_solution = Formula(face_solution_string);
+
+    SolveEdgePhase<order>(problem_id, is_normal, sample_formula, face_solution,
+                          beam_width, n_threads, time_budget, checkpoint);
 }
 
-[[maybe_unused]] static void Solve(const int problem_id, const int beam_width,
-                                   const int n_threads) {
+[[maybe_unused]] static void
+Solve(const int problem_id, const int beam_width, const int n_threads,
+      const TimeBudget& time_budget = TimeBudget(),
+      const CheckpointOptions& checkpoint = CheckpointOptions()) {
     const auto filename_puzzles = "../input/puzzles.csv";
     const auto filename_sample = "../input/sample_submission.csv";
     const auto [order, is_normal, sample_formula] =
@@ -1715,43 +2327,43 @@ static void SolveWithOrder(const int problem_id, const bool is_normal,
     switch (order) {
     case 3:
         SolveWithOrder<3>(problem_id, is_normal, sample_formula, beam_width,
-                          n_threads);
+                          n_threads, time_budget, checkpoint);
         break;
     case 4:
         SolveWithOrder<4>(problem_id, is_normal, sample_formula, beam_width,
-                          n_threads);
+                          n_threads, time_budget, checkpoint);
         break;
     case 5:
         SolveWithOrder<5>(problem_id, is_normal, sample_formula, beam_width,
-                          n_threads);
+                          n_threads, time_budget, checkpoint);
         break;
     case 6:
         SolveWithOrder<6>(problem_id, is_normal, sample_formula, beam_width,
-                          n_threads);
+                          n_threads, time_budget, checkpoint);
         break;
     case 7:
         SolveWithOrder<7>(problem_id, is_normal, sample_formula, beam_width,
-                          n_threads);
+                          n_threads, time_budget, checkpoint);
         break;
     case 8:
         SolveWithOrder<8>(problem_id, is_normal, sample_formula, beam_width,
-                          n_threads);
+                          n_threads, time_budget, checkpoint);
         break;
     case 9:
         SolveWithOrder<9>(problem_id, is_normal, sample_formula, beam_width,
-                          n_threads);
+                          n_threads, time_budget, checkpoint);
         break;
     case 10:
         SolveWithOrder<10>(problem_id, is_normal, sample_formula, beam_width,
-                           n_threads);
+                           n_threads, time_budget, checkpoint);
         break;
     case 19:
         SolveWithOrder<19>(problem_id, is_normal, sample_formula, beam_width,
-                           n_threads);
+                           n_threads, time_budget, checkpoint);
         break;
     case 33:
         SolveWithOrder<33>(problem_id, is_normal, sample_formula, beam_width,
-                           n_threads);
+                           n_threads, time_budget, checkpoint);
         break;
     default:
         assert(false);
@@ -1788,19 +2400,28 @@ int main() { TestEdgeBeamSearch(); }
 // clang++ -std=c++20 -Wall -Wextra -O3 edge_cube.cpp -DSOLVE
 #ifdef SOLVE
 int main(const int argc, const char* const* const argv) {
+    // --time-budget <秒> を付けると、時間いっぱいビーム幅を広げて解き直す
+    // --checkpoint <秒> を付けると checkpoint/edge_{problem_id}.bin に
+    // 途中経過を定期的に保存し、--resume でそこから再開する
+    auto args = vector<const char*>(argv, argv + argc);
+    const auto time_budget = TimeBudget::FromArgs(args);
+    const auto checkpoint = CheckpointOptions::FromArgs(args);
     int problem_id;
     int beam_width = 32;
     int n_threads = 1;
-    if (argc >= 2)
-        problem_id = atoi(argv[1]);
-    if (argc >= 3)
-        beam_width = atoi(argv[2]);
-    if (argc >= 4)
-        n_threads = atoi(argv[3]);
-    if (argc == 1 || argc >= 5) {
-        cerr << format("Usage: {} <problem_id>", argv[0]) << endl;
+    if (args.size() >= 2)
+        problem_id = atoi(args[1]);
+    if (args.size() >= 3)
+        beam_width = atoi(args[2]);
+    if (args.size() >= 4)
+        n_threads = atoi(args[3]);
+    if (args.size() == 1 || args.size() >= 5) {
+        cerr << format("Usage: {} <problem_id> [beam_width] [n_threads] "
+                       "[--time-budget <sec>] [--checkpoint <sec>] [--resume]",
+                       argv[0])
+             << endl;
         return 1;
     }
-    Solve(problem_id, beam_width, n_threads);
+    Solve(problem_id, beam_width, n_threads, time_budget, checkpoint);
 }
 #endif
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <ctime>
 #include <functional>
@@ -6,12 +7,15 @@
 #include <numeric>
 #include <thread>
 #include <tuple>
+#include <unordered_map>
 
 #include "cube.cpp"
 
+using std::atomic;
 using std::cin;
 using std::fill;
 using std::flush;
+using std::function;
 using std::iota;
 using std::lock_guard;
 using std::max;
@@ -26,6 +30,16 @@ using std::thread;
 using std::time;
 using std::time_t;
 using std::tuple;
+using std::unordered_map;
+
+// 1 つのバイナリに複数の ORDER を入れるときは、読み込むたびに FACE_NAMESPACE
+// を変えて名前空間を分ける (face_dispatch.cpp)
+#ifdef FACE_NAMESPACE
+#define FACE_SCOPE FACE_NAMESPACE
+namespace FACE_NAMESPACE {
+#else
+#define FACE_SCOPE
+#endif
 
 std::mutex mtx;
 
@@ -61,6 +75,12 @@ constexpr int OrderFormula = 9;
 const auto formula_file =
     format("out/face_formula_{}_{}.txt", OrderFormula, DEPTH);
 constexpr bool flag_parallel = true;
+// ビーム幅を倍にして解き直すとき、前回展開したノードは展開し直さない
+#ifdef WARM_START
+constexpr bool flag_warm_start = true;
+#else
+constexpr bool flag_warm_start = false;
+#endif
 // メモリ削減のため面の情報は落とす
 using SliceMap = array<int, Order - 2>;
 using SliceMapInv = array<vector<int>, OrderFormula - 2>;
@@ -346,7 +366,7 @@ FaceAction ConvertFaceActionFaceletChangeWithSliceMap(
 }
 
 template <int order> struct FaceState {
-    using FaceCube = ::FaceCube<order, ColorTypeChameleon>;
+    using FaceCube = FACE_SCOPE::FaceCube<order, ColorTypeChameleon>;
     FaceCube cube;
     int score;   // target との距離
     int n_moves; // これまでに回した回数
@@ -659,11 +679,95 @@ template <int order> struct FaceState {
     }
 };
 
+#ifdef SOA_LAYER
+#ifdef RAINBOW
+#error "SOA_LAYER does not support RAINBOW"
+#endif
+// 1 つの層のノードの内側のマスを position-major (SoA) で持つ
+// マス p の色がノード 0..K-1 について連続するので、
+// 1 つの action を K ノードに対してまとめて評価できる
+// 内側のループは -O3 -march=native で AVX2 のバイト比較にベクトル化される
+template <int order> struct FaceLayerSoA {
+    using FaceCube = FACE_SCOPE::FaceCube<order, ColorTypeChameleon>;
+    using FaceState = FACE_SCOPE::FaceState<order>;
+    static constexpr int kBatch = 64;
+    static constexpr int kInner = order - 2;
+    int n_nodes;
+    int stride;        // n_nodes を kBatch の倍数に切り上げたもの
+    vector<i8> colors; // [face_id][y - 1][x - 1][node]
+    vector<int> scores;
+
+    inline FaceLayerSoA() : n_nodes(), stride(), colors(), scores() {}
+
+    inline static int Position(const FaceletPosition& p) {
+        return (p.face_id * kInner + p.y - 1) * kInner + p.x - 1;
+    }
+
+    inline void Build(const vector<const FaceState*>& states) {
+        n_nodes = (int)states.size();
+        stride = (n_nodes + kBatch - 1) / kBatch * kBatch;
+        // 端数のノードは色 -1 で埋めておく (結果は使わない)
+        colors.assign((size_t)6 * kInner * kInner * stride, -1);
+        scores.assign(stride, 0);
+        for (int k = 0; k < n_nodes; k++) {
+            const auto& cube = states[k]->cube;
+            for (int face_id = 0; face_id < 6; face_id++)
+                for (int y = 1; y < order - 1; y++)
+                    for (int x = 1; x < order - 1; x++)
+                        colors[(size_t)((face_id * kInner + y - 1) * kInner +
+                                        x - 1) *
+                                   stride +
+                               k] = cube.Get(face_id, y, x).data;
+            scores[k] = states[k]->score;
+        }
+    }
+
+    // FaceState::ScoreWhenApplied を層の全ノードについて計算する
+    inline void ScoreWhenApplied(const FaceAction& action,
+                                 const FaceCube& target_cube,
+                                 vector<int>& new_scores) const {
+        assert(action.use_facelet_changes);
+        new_scores = scores;
+        int* const out = new_scores.data();
+        for (const auto& facelet_change : action.facelet_changes) {
+            const auto& from = facelet_change.from;
+            const auto& to = facelet_change.to;
+
+            const i8 color_from_target = target_cube.Get(from).data;
+            const i8 color_to_target = target_cube.Get(to).data;
+            if (color_from_target == color_to_target)
+                continue;
+            // GetFaceDistance(c, t) = (c != t) + (c == opposite(t))
+            const i8 opposite_from_target =
+                FaceCube::GetOppositeFaceId(color_from_target);
+            const i8 opposite_to_target =
+                FaceCube::GetOppositeFaceId(color_to_target);
+
+            int coef = 1;
+            if (((order & 1) == 1) && (from.x * 2 + 1 == order) &&
+                (from.y * 2 + 1 == order))
+                coef = 100;
+
+            const i8* const colors_from =
+                &colors[(size_t)Position(from) * stride];
+            for (int k = 0; k < stride; k++) {
+                const i8 c = colors_from[k];
+                out[k] += ((int)(c != color_to_target) +
+                           (int)(c == opposite_to_target) -
+                           (int)(c != color_from_target) -
+                           (int)(c == opposite_from_target)) *
+                          coef;
+            }
+        }
+    }
+};
+#endif
+
 // yield を使って EdgeAction を生成する？
 template <int order> struct FaceActionCandidateGenerator {
     static_assert(order == Order);
-    using FaceCube = ::FaceCube<order, ColorTypeChameleon>;
-    using FaceState = ::FaceState<order>;
+    using FaceCube = FACE_SCOPE::FaceCube<order, ColorTypeChameleon>;
+    using FaceState = FACE_SCOPE::FaceState<order>;
     vector<SliceMap> slice_maps;        // array?
     vector<SliceMapInv> slice_maps_inv; // array?
     // vector<tuple<FaceAction, SliceMap&, SliceMapInv&>> actions;
@@ -789,25 +893,34 @@ template <int order> struct FaceActionCandidateGenerator {
 
     // ファイルから手筋を読み取る
     // ファイルには f1.d0.-r0.-f1 みたいなのが 1 行に 1 つ書かれている想定
-    inline void FromFile(const string& filename) {
+    // 展開した actions は {filename}.face_actions_{Order}_{mode}.bin に
+    // 書き出しておき、次からはそれを mmap して読む (edge_cube.cpp と同じ)
+    inline void FromFile(string filename) {
+        filename = ResolveFormulaFile(filename);
         actions.clear();
+#ifdef RAINBOW
+        actions_parity.clear();
+        const auto database_file =
+            format("{}.face_actions_{}_rainbow.bin", filename, Order);
+#else
+        const auto database_file =
+            format("{}.face_actions_{}_normal.bin", filename, Order);
+#endif
+
+        // ファイルから読み取る
+        const auto formulas = ReadFormulaFile<OrderFormula>(
+            filename, 0, UsesSlicesFromOutside<OrderFormula>);
+        const auto content_hash = ComputeContentHash(formulas);
+        if (AttachDatabase(database_file, content_hash))
+            return;
 
         vector<FaceAction> actions_tmp1;
 
-        // ファイルから読み取る
-        auto ifs = ifstream(filename);
-        if (!ifs.good()) {
-            cerr << format("Cannot open file `{}`.", filename) << endl;
-            abort();
-        }
-        string line;
         int cnt = 0;
-        while (getline(ifs, line)) {
-            if (line.empty() || line[0] == '#')
-                continue;
+        for (const auto& [prefix, formula] : formulas) {
             cnt++;
             cerr << "read lines = " << cnt << "\r" << flush;
-            FaceAction faceaction_formula(line);
+            FaceAction faceaction_formula(formula.moves);
             // faceaction_formula
             //     .EnableFaceletChangesAll<Cube<OrderFormula, ColorType24>>();
             faceaction_formula.EnableFaceletChangesWithNoSameRaw<
@@ -1139,8 +1252,8 @@ template <int order> struct FaceActionCandidateGenerator {
             actions_parity.clear();
             actions_parity.reserve(actions.size());
             // FaceCube<Order, ColorType24> cube();
-            auto cube = ::FaceCube<Order, ColorType24>();
-            auto target = ::FaceCube<Order, ColorType24>();
+            auto cube = FACE_SCOPE::FaceCube<Order, ColorType24>();
+            auto target = FACE_SCOPE::FaceCube<Order, ColorType24>();
             target.Reset();
             int cnt = 0;
             for (const auto& action : actions) {
@@ -1154,8 +1267,8 @@ template <int order> struct FaceActionCandidateGenerator {
                 cube.Rotate(faceaction);
                 // cube.Display();
                 actions_parity.emplace_back(
-                    ::FaceCube<Order, ColorType24>::GetParityVector(cube,
-                                                                    target));
+                    FACE_SCOPE::FaceCube<Order, ColorType24>::GetParityVector(
+                        cube, target));
             }
             cerr << endl;
         }
@@ -1178,14 +1291,247 @@ template <int order> struct FaceActionCandidateGenerator {
         //     }
         // }
 
-        // TODO: 重複があるかもしれないので確認した方が良い
+        RemoveDuplicateActions();
+        PublishDatabase(database_file, content_hash);
+    }
+
+    // 手筋のデータベースのファイルの中身
+    // Header, Entry (actions[i]), parity, FaceletChange, 手 (Move::ToByte())
+    // の順
+    // 形式や展開の仕方を変えたら kVersion を上げる
+    // 読み込んだ手筋が変わったら content_hash が変わるので作り直す
+    // 各プロセスは読んだものを actions にコピーして持つ
+    // (FaceNode が FaceAction を値で持つので、mmap した先を直接は指せない)
+    struct DatabaseHeader {
+        static constexpr auto kMagic = 0x4641'4345'4143'5431ull;
+        static constexpr auto kVersion = 1;
+        u64 magic;
+        int version;
+        int cube_order;
+        u64 content_hash;
+        u64 n_entries;
+        u64 n_parities;
+        u64 n_changes;
+        u64 n_moves;
+    };
+    // action の facelet_changes と手の後に action_formula のものが続く
+    struct DatabaseEntry {
+        u64 parity_offset;
+        u64 change_offset;
+        u64 move_offset;
+        int n_parities;
+        int n_changes, n_formula_changes;
+        int n_moves, n_formula_moves;
+        int flag_last_action_scale;
+        SliceMap slice_map;
+        // slice_map_inv の各要素の大きさと、中身を順に並べたもの
+        array<int, OrderFormula - 2> n_slices;
+        array<int, Order - 2> slices;
+    };
+
+    // 読み込んだ手筋と Order、ファイルの中の構造体の大きさから作るハッシュ値
+    inline static u64
+    ComputeContentHash(const vector<pair<string, Formula>>& formulas) {
+        auto hash = ContentHash();
+        hash.Add(Order);
+        hash.Add(OrderFormula);
+        hash.Add(sizeof(DatabaseEntry));
+        hash.Add(sizeof(FaceAction::FaceletChange));
+        hash.Add(formulas.size());
+        for (const auto& [prefix, formula] : formulas) {
+            hash.Add(formula.moves.size());
+            for (const auto& mov : formula.moves)
+                hash.Add(mov.ToByte());
+        }
+        return hash.value;
+    }
+
+    inline bool AttachDatabase(const string& database_file,
+                               const u64 content_hash) {
+        const auto data = MapSharedFile(database_file);
+        if (data.size() < sizeof(DatabaseHeader))
+            return false;
+        const auto header = (const DatabaseHeader*)data.data();
+        if (header->magic != DatabaseHeader::kMagic ||
+            header->version != DatabaseHeader::kVersion ||
+            header->cube_order != Order ||
+            header->content_hash != content_hash ||
+            data.size() !=
+                sizeof(DatabaseHeader) +
+                    header->n_entries * sizeof(DatabaseEntry) +
+                    header->n_parities * sizeof(int) +
+                    header->n_changes * sizeof(FaceAction::FaceletChange) +
+                    header->n_moves) {
+            cerr << format("`{}` is stale.", database_file) << endl;
+            MapSharedFile(database_file, true);
+            return false;
+        }
+        const auto entries =
+            (const DatabaseEntry*)(data.data() + sizeof(DatabaseHeader));
+        const auto parities = (const int*)(entries + header->n_entries);
+        const auto changes =
+            (const FaceAction::FaceletChange*)(parities + header->n_parities);
+        const auto moves = (const u8*)(changes + header->n_changes);
+        const auto make_action = [&](const u64 change_offset,
+                                     const int n_changes,
+                                     const u64 move_offset, const int n_moves) {
+            auto action = FaceAction();
+            for (auto j = 0; j < n_moves; j++)
+                action.moves.push_back(Move::FromByte(moves[move_offset + j]));
+            action.use_facelet_changes = true;
+            action.facelet_changes.assign(changes + change_offset,
+                                          changes + change_offset + n_changes);
+            return action;
+        };
+        actions.reserve(header->n_entries);
+        for (auto i = (u64)0; i < header->n_entries; i++) {
+            const auto& entry = entries[i];
+            auto slice_map_inv = SliceMapInv();
+            for (auto j = 0, k = 0; j < OrderFormula - 2; j++)
+                for (auto l = 0; l < entry.n_slices[j]; l++)
+                    slice_map_inv[j].push_back(entry.slices[k++]);
+            actions.emplace_back(
+                make_action(entry.change_offset, entry.n_changes,
+                            entry.move_offset, entry.n_moves),
+                make_action(entry.change_offset + entry.n_changes,
+                            entry.n_formula_changes,
+                            entry.move_offset + entry.n_moves,
+                            entry.n_formula_moves),
+                entry.slice_map, slice_map_inv,
+                (bool)entry.flag_last_action_scale);
+#ifdef RAINBOW
+            actions_parity.emplace_back(parities + entry.parity_offset,
+                                        parities + entry.parity_offset +
+                                            entry.n_parities);
+#endif
+        }
+        cerr << format("Attached `{}` ({} actions).", database_file,
+                       actions.size())
+             << endl;
+        return true;
+    }
+
+    inline void PublishDatabase(const string& database_file,
+                                const u64 content_hash) const {
+        auto entries = vector<DatabaseEntry>();
+        auto parities = vector<int>();
+        auto changes = vector<FaceAction::FaceletChange>();
+        auto moves = string();
+        for (int i = 0; i < (int)actions.size(); i++) {
+            const auto& [action, action_formula, slice_map, slice_map_inv,
+                         flag_last_action_scale] = actions[i];
+            // 読むときは facelet_changes を使うものとして作る
+            assert(action.use_facelet_changes &&
+                   action_formula.use_facelet_changes);
+            auto entry = DatabaseEntry();
+            entry.parity_offset = parities.size();
+            entry.change_offset = changes.size();
+            entry.move_offset = moves.size();
+#ifdef RAINBOW
+            entry.n_parities = (int)actions_parity[i].size();
+            parities.insert(parities.end(), actions_parity[i].begin(),
+                            actions_parity[i].end());
+#endif
+            entry.n_changes = (int)action.facelet_changes.size();
+            entry.n_formula_changes =
+                (int)action_formula.facelet_changes.size();
+            entry.n_moves = action.Cost();
+            entry.n_formula_moves = action_formula.Cost();
+            for (const auto& formula : {&action, &action_formula}) {
+                changes.insert(changes.end(), formula->facelet_changes.begin(),
+                               formula->facelet_changes.end());
+                for (const auto& mov : formula->moves)
+                    moves += (char)mov.ToByte();
+            }
+            entry.flag_last_action_scale = flag_last_action_scale;
+            entry.slice_map = slice_map;
+            // 内側のスライスはそれぞれ高々 1 つの要素に入る
+            for (auto j = 0, k = 0; j < OrderFormula - 2; j++) {
+                entry.n_slices[j] = (int)slice_map_inv[j].size();
+                for (const auto slice : slice_map_inv[j]) {
+                    assert(k < Order - 2);
+                    entry.slices[k++] = slice;
+                }
+            }
+            entries.push_back(entry);
+        }
+        const auto header = DatabaseHeader{
+            DatabaseHeader::kMagic, DatabaseHeader::kVersion,
+            Order,                  content_hash,
+            entries.size(),         parities.size(),
+            changes.size(),         moves.size()};
+        PublishSharedFile(database_file, [&](ostream& os) {
+            os.write((const char*)&header, sizeof(header));
+            os.write((const char*)entries.data(),
+                     entries.size() * sizeof(DatabaseEntry));
+            os.write((const char*)parities.data(),
+                     parities.size() * sizeof(int));
+            os.write((const char*)changes.data(),
+                     changes.size() * sizeof(FaceAction::FaceletChange));
+            os.write(moves.data(), moves.size());
+        });
+    }
+
+    // 盤面への作用が同じ action は、最も短いもの (同じ長さなら先のもの)
+    // だけ残す
+    // 作用は facelet_changes で、虹なら面の向きと parity も含める
+    inline void RemoveDuplicateActions() {
+        auto keys = vector<string>();
+        auto costs = vector<int>();
+        keys.reserve(actions.size());
+        costs.reserve(actions.size());
+        for (int i = 0; i < (int)actions.size(); i++) {
+            const auto& faceaction = get<0>(actions[i]);
+            auto key = string();
+#ifdef RAINBOW
+            Cube<2, ColorType6> cube_for_orientation;
+            for (const auto& mov : faceaction.moves) {
+                if (mov.depth == 0)
+                    cube_for_orientation.Rotate(mov);
+                else if (mov.depth == Order - 1)
+                    cube_for_orientation.RotateOrientation(
+                        Move{mov.direction, 1});
+            }
+            for (int face_id = 0; face_id < 6; face_id++)
+                key += (char)cube_for_orientation.faces[face_id]
+                           .GetOrientation();
+            key += (char)actions_parity[i].size();
+            for (const auto idx : actions_parity[i])
+                key += (char)idx;
+#endif
+            auto changes = vector<array<i8, 6>>();
+            for (const auto& [from, to] : faceaction.facelet_changes)
+                changes.push_back(
+                    {from.face_id, from.y, from.x, to.face_id, to.y, to.x});
+            sort(changes.begin(), changes.end());
+            for (const auto& change : changes)
+                key.append((const char*)change.data(), change.size());
+            keys.push_back(move(key));
+            costs.push_back(faceaction.Cost());
+        }
+        const auto indices = SelectCheapestPerKey(keys, costs);
+        cerr << format("Removed {} of {} actions with the same permutation.",
+                       actions.size() - indices.size(), actions.size())
+             << endl;
+        for (int i = 0; i < (int)indices.size(); i++) {
+            if (indices[i] == i)
+                continue;
+            actions[i] = move(actions[indices[i]]);
+#ifdef RAINBOW
+            actions_parity[i] = move(actions_parity[indices[i]]);
+#endif
+        }
+        actions.resize(indices.size());
+#ifdef RAINBOW
+        actions_parity.resize(indices.size());
+#endif
     }
 
     inline const auto& Generate(const FaceState&) const { return actions; }
 };
 
 template <int order> struct FaceNode {
-    using FaceState = ::FaceState<order>;
+    using FaceState = FACE_SCOPE::FaceState<order>;
     FaceState state;
     shared_ptr<FaceNode> parent;
     FaceAction last_action, last_action_formula;
@@ -1193,12 +1539,14 @@ template <int order> struct FaceNode {
     SliceMapInv slice_map_inv;
     bool flag_last_action_scale;
     FaceAction all_action;
+    bool children_expanded;
     inline FaceNode(const FaceState& state, const shared_ptr<FaceNode>& parent,
                     const FaceAction& last_action,
                     const FaceAction& last_action_formula)
         : state(state), parent(parent), last_action(last_action),
           last_action_formula(last_action_formula), slice_map(),
-          slice_map_inv(), flag_last_action_scale(false), all_action() {}
+          slice_map_inv(), flag_last_action_scale(false), all_action(),
+          children_expanded() {}
     inline FaceNode(const FaceState& state, const shared_ptr<FaceNode>& parent,
                     const FaceAction& last_action,
                     const FaceAction& last_action_formula,
@@ -1208,7 +1556,7 @@ template <int order> struct FaceNode {
           last_action_formula(last_action_formula), slice_map(slice_map),
           slice_map_inv(slice_map_inv),
           flag_last_action_scale(flag_last_action_scale),
-          all_action(all_action) {}
+          all_action(all_action), children_expanded() {}
     FaceState CopyState() const { return state; }
     int CostCorrection(const FaceAction& action) const {
         // 愚直
@@ -1345,16 +1693,32 @@ template <int order> struct FaceNode {
 
 template <int order> struct FaceBeamSearchSolver {
     static_assert(order == Order);
-    using FaceCube = ::FaceCube<order, ColorTypeChameleon>;
-    using FaceState = ::FaceState<order>;
-    using FaceNode = ::FaceNode<order>;
-    using FaceActionCandidateGenerator = ::FaceActionCandidateGenerator<order>;
+    using FaceCube = FACE_SCOPE::FaceCube<order, ColorTypeChameleon>;
+    using FaceState = FACE_SCOPE::FaceState<order>;
+    using FaceNode = FACE_SCOPE::FaceNode<order>;
+    using FaceActionCandidateGenerator =
+        FACE_SCOPE::FaceActionCandidateGenerator<order>;
 
     FaceCube target_cube;
     FaceActionCandidateGenerator action_candidate_generator;
     int beam_width;
     int n_threads;
     vector<vector<shared_ptr<FaceNode>>> nodes;
+    TimeBudget time_budget; // 制限時間 (デフォルトは無制限)
+    BeamRoundStats round_stats; // 直前の 1 周の層の数と時間
+    CheckpointOptions checkpoint; // 途中経過の保存先と間隔
+    AsyncFileWriter checkpoint_writer;
+    // flag_warm_start のとき、ビームから溢れた候補を層ごとに取っておく
+    vector<vector<shared_ptr<FaceNode>>> reserve_nodes;
+    // 解が見つかるたびに呼ばれる (false を返すとそこで探索を打ち切る)
+    function<bool(const Formula&)> on_solution;
+    // 複数の問題で共有する、スレッドごとに分割済みの手筋
+    // これがあれば action_candidate_generator は使わない
+    shared_ptr<const vector<FaceActionCandidateGenerator>>
+        shared_action_candidate_generators;
+#ifdef SOA_LAYER
+    FaceLayerSoA<order> layer_soa;
+#endif
 
     inline FaceBeamSearchSolver(const FaceCube& target_cube,
                                 const int beam_width,
@@ -1365,6 +1729,440 @@ template <int order> struct FaceBeamSearchSolver {
         action_candidate_generator.FromFile(formula_file);
     }
 
+    // SplitActionCandidateGenerators で作ったものを使い、ファイルは読まない
+    // スレッド数は分割数 + 1 になる
+    inline FaceBeamSearchSolver(
+        const FaceCube& target_cube, const int beam_width,
+        const shared_ptr<const vector<FaceActionCandidateGenerator>>&
+            shared_action_candidate_generators)
+        : target_cube(target_cube), action_candidate_generator(),
+          beam_width(beam_width),
+          n_threads((int)shared_action_candidate_generators->size() + 1),
+          nodes(), shared_action_candidate_generators(
+                       shared_action_candidate_generators) {}
+
+    // formula_file を 1 度だけ読み、n_threads 用に分割する
+    inline static shared_ptr<const vector<FaceActionCandidateGenerator>>
+    SplitActionCandidateGenerators(const string& formula_file,
+                                   const int n_threads) {
+        assert(n_threads >= 2);
+        auto action_candidate_generator = FaceActionCandidateGenerator();
+        action_candidate_generator.FromFile(formula_file);
+        return make_shared<const vector<FaceActionCandidateGenerator>>(
+            action_candidate_generator.Split(n_threads - 1));
+    }
+
+    // node の最後の手筋のスライスの割り当てを変えたものを memo に入れる
+    // 評価した候補の数を返す
+    inline unsigned long long
+    ExpandWithSliceSubstitution(const shared_ptr<FaceNode>& node,
+                                const int current_cost,
+                                RandomNumberGenerator& rng,
+                                vector<vector<shared_ptr<FaceNode>>>& memo) {
+        SliceMap slice_map_new = node->slice_map;
+        SliceMapInv slice_map_inv_new = node->slice_map_inv;
+        auto n_candidates = 0ull;
+
+        // list up used slices in formula
+        vector<int> vec_use_slices(OrderFormula - 2, 0);
+        for (const Move& mv : node->last_action_formula.moves) {
+            if (1 <= mv.depth && mv.depth <= OrderFormula - 2) {
+                vec_use_slices[mv.depth - 1] = 1;
+                vec_use_slices[OrderFormula - 2 - mv.depth] = 1;
+            }
+        }
+        for (int slice_idx = 0; slice_idx < Order - 2; slice_idx++) {
+            if (slice_map_new[slice_idx] != -1) {
+                continue;
+            }
+            if constexpr (Order % 2 == 1) {
+                if (slice_idx == Order / 2 - 1) {
+                    continue;
+                }
+            }
+            for (int slice_idx_formula = 0;
+                 slice_idx_formula < OrderFormula - 2; slice_idx_formula++) {
+                if constexpr (OrderFormula % 2 == 1) {
+                    if (slice_idx_formula == OrderFormula / 2 - 1) {
+                        continue;
+                    }
+                }
+                if (!vec_use_slices[slice_idx_formula]) {
+                    continue;
+                }
+
+                // try new slice
+                slice_map_new[slice_idx] = slice_idx_formula;
+                slice_map_inv_new[slice_idx_formula].emplace_back(slice_idx);
+                slice_map_new[Order - 3 - slice_idx] =
+                    OrderFormula - 3 - slice_idx_formula;
+                slice_map_inv_new[OrderFormula - 3 - slice_idx_formula]
+                    .emplace_back(Order - 3 - slice_idx);
+                FaceAction action_new =
+                    ConvertFaceActionMoveWithSliceMap<OrderFormula, Order>(
+                        node->last_action_formula, slice_map_new,
+                        slice_map_inv_new);
+
+                int cost_correction =
+                    node->parent->CostCorrection(action_new);
+                if (node->parent->state.n_moves + cost_correction +
+                        action_new.Cost() <=
+                    current_cost)
+                    continue;
+                int new_n_moves = node->parent->state.n_moves +
+                                  cost_correction + action_new.Cost();
+
+                auto new_state = node->parent->state;
+                new_state.Apply(action_new, target_cube);
+                new_state.n_moves += cost_correction;
+
+                n_candidates++;
+                const auto idx = rng.Next() % beam_width;
+                auto& node_nxt = memo[idx][new_n_moves - current_cost];
+                if (!node_nxt || new_state.score < node_nxt->state.score) {
+                    node_nxt.reset(new FaceNode(
+                        new_state, node->parent, action_new,
+                        node->last_action_formula, slice_map_new,
+                        slice_map_inv_new, node->flag_last_action_scale,
+                        node->parent->ConcatAction(action_new)));
+                }
+                slice_map_new[slice_idx] = -1;
+                slice_map_inv_new[slice_idx_formula].pop_back();
+                slice_map_new[Order - 3 - slice_idx] = -1;
+                slice_map_inv_new[OrderFormula - 3 - slice_idx_formula]
+                    .pop_back();
+            }
+        }
+        return n_candidates;
+    }
+
+    // スレッドごとの memo を nodes に反映する
+    // nodes に入った新しいノードの数を返す (後で置き換えられたものも数える)
+    inline unsigned long long MergeNodesMemo(
+        vector<vector<vector<shared_ptr<FaceNode>>>>& nodes_memo,
+        const int current_cost, const int max_action_cost) {
+        auto n_accepted = 0ull;
+        for (int i = 0; i < n_threads; i++) {
+            for (int j = 0; j < beam_width; j++) {
+                for (int action_cost = 1; action_cost <= max_action_cost;
+                     action_cost++) {
+                    auto& node_nxt = nodes_memo[i][j][action_cost];
+                    if (!node_nxt)
+                        continue;
+                    auto& node = nodes[current_cost + action_cost][j];
+                    // 埋め草の初期ノードは数えない
+                    const auto is_new = node_nxt->parent != nullptr;
+                    if (!node) {
+                        n_accepted += is_new;
+                        node = move(node_nxt);
+                    } else if (node_nxt->state.score < node->state.score) {
+                        n_accepted += is_new;
+                        if constexpr (flag_warm_start)
+                            Reserve(current_cost + action_cost, node);
+                        node = node_nxt;
+                    } else if constexpr (flag_warm_start) {
+                        Reserve(current_cost + action_cost, node_nxt);
+                    }
+                }
+            }
+        }
+        return n_accepted;
+    }
+
+    // 溢れた候補を取っておく (展開済みのものと初期ノードの埋め草は捨てる)
+    // 各層で次に増える枠の数 (beam_width) だけ良いものを残す
+    inline void Reserve(const int cost, const shared_ptr<FaceNode>& node) {
+        if (!node->parent || node->children_expanded)
+            return;
+        auto& reserve = reserve_nodes[cost];
+        reserve.emplace_back(node);
+        if ((int)reserve.size() >= beam_width * 2) {
+            nth_element(reserve.begin(), reserve.begin() + beam_width,
+                        reserve.end(), [](const auto& a, const auto& b) {
+                            return a->state.score < b->state.score;
+                        });
+            reserve.resize(beam_width);
+        }
+    }
+
+    // ビーム幅を倍にした後、増えた枠に取っておいた候補を入れる
+    inline void AdmitReservedNodes(const int old_beam_width) {
+        for (int cost = 0; cost < (int)reserve_nodes.size(); cost++) {
+            auto& reserve = reserve_nodes[cost];
+            if (reserve.empty())
+                continue;
+            sort(reserve.begin(), reserve.end(),
+                 [](const auto& a, const auto& b) {
+                     return a->state.score < b->state.score;
+                 });
+            const int n_admitted =
+                min((int)reserve.size(), beam_width - old_beam_width);
+            for (int i = 0; i < n_admitted; i++)
+                nodes[cost][old_beam_width + i] = reserve[i];
+            reserve.clear();
+        }
+    }
+
+    // nodes (と reserve_nodes) にあるノードとその祖先を保存する
+    // 親はポインタの代わりにレコードの番号で持つ (-1 は初期ノード)
+    // all_action は親の all_action から復元できるので保存しない
+    inline void SaveCheckpoint(const int current_cost,
+                               const FaceCube& start_cube,
+                               const shared_ptr<FaceNode>& start_node,
+                               const vector<RandomNumberGenerator>& rngs) {
+        // ノードの列挙と children_expanded の読み出しは探索スレッドで済ませ、
+        // 書き出しスレッドは作成後に変更されないメンバだけを読む
+        auto records = vector<shared_ptr<FaceNode>>();
+        auto parents = vector<int>();
+        auto expanded = vector<i8>();
+        auto record_ids = unordered_map<const FaceNode*, int>();
+        auto positions = vector<array<int, 3>>(); // cost, slot, record
+        const auto add_record = [&](const shared_ptr<FaceNode>& node) {
+            // 祖先から順に番号を振る
+            auto chain = vector<shared_ptr<FaceNode>>();
+            for (auto p = node; p && p != start_node; p = p->parent) {
+                if (record_ids.contains(p.get()))
+                    break;
+                chain.emplace_back(p);
+            }
+            for (auto it = chain.rbegin(); it != chain.rend(); it++) {
+                const auto& p = *it;
+                parents.emplace_back(p->parent == start_node
+                                         ? -1
+                                         : record_ids.at(p->parent.get()));
+                expanded.emplace_back(p->children_expanded);
+                record_ids[p.get()] = (int)records.size();
+                records.emplace_back(p);
+            }
+            return record_ids.at(node.get());
+        };
+        for (int cost = 0; cost < (int)nodes.size(); cost++) {
+            for (int slot = 0; slot < (int)nodes[cost].size(); slot++) {
+                const auto& node = nodes[cost][slot];
+                if (node && node->parent)
+                    positions.push_back({cost, slot, add_record(node)});
+            }
+        }
+        if constexpr (flag_warm_start) {
+            // 取っておいた候補は slot = -1 とする
+            for (int cost = 0; cost < (int)reserve_nodes.size(); cost++)
+                for (const auto& node : reserve_nodes[cost])
+                    positions.push_back({cost, -1, add_record(node)});
+        }
+
+        checkpoint_writer.Write(
+            checkpoint.filename,
+            [beam_width = beam_width, current_cost, start_cube, rngs,
+             records = move(records), parents = move(parents),
+             expanded = move(expanded),
+             positions = move(positions)](ostream& os) {
+                WriteBinary(os, order);
+                WriteBinary(os, beam_width);
+                WriteBinary(os, current_cost);
+                WriteBinary(os, start_cube);
+                WriteBinary(os, rngs);
+                WriteBinary(os, (u64)records.size());
+                for (int i = 0; i < (int)records.size(); i++) {
+                    const auto& node = *records[i];
+                    WriteBinary(os, parents[i]);
+                    WriteBinary(os, expanded[i]);
+                    WriteBinary(os, node.state.cube);
+                    WriteBinary(os, node.state.score);
+                    WriteBinary(os, node.state.n_moves);
+                    WriteBinary(os, node.last_action.moves);
+                    WriteBinary(os, node.last_action_formula.moves);
+                    WriteBinary(os, node.slice_map);
+                    for (const auto& slices : node.slice_map_inv)
+                        WriteBinary(os, slices);
+                    WriteBinary(os, node.flag_last_action_scale);
+                }
+                WriteBinary(os, positions);
+            });
+    }
+
+    // SaveCheckpoint で保存したものを読み込み、再開する層を返す
+    inline int LoadCheckpoint(const FaceCube& start_cube,
+                              const shared_ptr<FaceNode>& start_node,
+                              vector<RandomNumberGenerator>& rngs) {
+        auto ifs = ifstream(checkpoint.filename, ios::binary);
+        int saved_order, current_cost;
+        auto saved_start_cube = start_cube;
+        ReadBinary(ifs, saved_order);
+        ReadBinary(ifs, beam_width);
+        ReadBinary(ifs, current_cost);
+        ReadBinary(ifs, saved_start_cube);
+        auto matched = saved_order == order;
+        for (const auto& pos : FaceCube::AllFaceletPositions())
+            matched = matched && saved_start_cube.Get(pos) == start_cube.Get(pos);
+        if (!ifs.good() || !matched) {
+            cerr << format("Checkpoint `{}` does not match this problem.",
+                           checkpoint.filename)
+                 << endl;
+            abort();
+        }
+        auto n_rngs = (u64)0;
+        ReadBinary(ifs, n_rngs);
+        for (auto i = (u64)0; i < n_rngs; i++) {
+            auto rng = RandomNumberGenerator(0);
+            ReadBinary(ifs, rng);
+            if (i < rngs.size())
+                rngs[i] = rng;
+        }
+
+        auto n_records = (u64)0;
+        ReadBinary(ifs, n_records);
+        auto records = vector<shared_ptr<FaceNode>>();
+        records.reserve(n_records);
+        for (auto i = (u64)0; i < n_records; i++) {
+            int parent_id;
+            i8 expanded;
+            auto state = start_node->state;
+            auto last_action = FaceAction();
+            auto last_action_formula = FaceAction();
+            auto slice_map = SliceMap();
+            auto slice_map_inv = SliceMapInv();
+            bool flag_last_action_scale;
+            ReadBinary(ifs, parent_id);
+            ReadBinary(ifs, expanded);
+            ReadBinary(ifs, state.cube);
+            ReadBinary(ifs, state.score);
+            ReadBinary(ifs, state.n_moves);
+            ReadBinary(ifs, last_action.moves);
+            ReadBinary(ifs, last_action_formula.moves);
+            ReadBinary(ifs, slice_map);
+            for (auto& slices : slice_map_inv)
+                ReadBinary(ifs, slices);
+            ReadBinary(ifs, flag_last_action_scale);
+            const auto& parent =
+                parent_id == -1 ? start_node : records[parent_id];
+            records.emplace_back(make_shared<FaceNode>(
+                state, parent, last_action, last_action_formula, slice_map,
+                slice_map_inv, flag_last_action_scale,
+                parent->ConcatAction(last_action)));
+            records.back()->children_expanded = expanded;
+        }
+
+        for (auto& layer : nodes)
+            layer.assign(beam_width, start_node);
+        auto positions = vector<array<int, 3>>();
+        ReadBinary(ifs, positions);
+        for (const auto& [cost, slot, record_id] : positions) {
+            if (cost < 0 || cost >= (int)nodes.size() || slot < -1 ||
+                slot >= beam_width || record_id < 0 ||
+                record_id >= (int)records.size()) {
+                cerr << format("Broken checkpoint `{}`.", checkpoint.filename)
+                     << endl;
+                abort();
+            }
+            // 取っておいた候補 (slot = -1) は WARM_START のときだけ使う
+            // WARM_START 無しのビルドでは reserve_nodes が空なので捨てる
+            if (slot != -1)
+                nodes[cost][slot] = records[record_id];
+            else if constexpr (flag_warm_start)
+                reserve_nodes[cost].emplace_back(records[record_id]);
+        }
+        if (!ifs.good()) {
+            cerr << format("Cannot read checkpoint `{}`.", checkpoint.filename)
+                 << endl;
+            abort();
+        }
+        checkpoint.resume = false;
+        cout << format("resumed from {}: current_cost={} beam_width={} "
+                       "records={}",
+                       checkpoint.filename, current_cost, beam_width,
+                       records.size())
+             << endl;
+        return current_cost;
+    }
+
+#ifdef SOA_LAYER
+    // 層のノードをまとめて展開する
+    // 各スレッドは担当の action を層の全ノードに対して SoA でまとめて評価する
+    inline void ExpandLayerSoA(
+        const vector<shared_ptr<FaceNode>>& layer_nodes, const int current_cost,
+        const shared_ptr<FaceNode>& start_node, const int max_action_cost,
+        const vector<FaceActionCandidateGenerator>&
+            multi_action_candidate_generator,
+        vector<RandomNumberGenerator>& rngs, LayerTelemetry& layer_telemetry) {
+        auto layer_states = vector<const FaceState*>();
+        layer_states.reserve(layer_nodes.size());
+        for (const auto& node : layer_nodes)
+            layer_states.emplace_back(&node->state);
+        layer_soa.Build(layer_states);
+
+        vector<vector<vector<shared_ptr<FaceNode>>>> nodes_memo(
+            n_threads, vector(beam_width, vector<shared_ptr<FaceNode>>(
+                                              max_action_cost + 10, start_node)));
+        vector<thread> threads;
+        for (int i = 0; i < n_threads - 1; i++) {
+            threads.emplace_back(
+                [&](const int ii) {
+                    auto& rng = rngs[ii];
+                    auto new_scores = vector<int>();
+                    auto n_candidates = 0ull;
+                    for (const auto& [action, action_formula, slice_map,
+                                      slice_map_inv, flag_last_action_scale] :
+                         multi_action_candidate_generator[ii].actions) {
+                        layer_soa.ScoreWhenApplied(action, target_cube,
+                                                   new_scores);
+                        for (int k = 0; k < (int)layer_nodes.size(); k++) {
+                            const auto& node = layer_nodes[k];
+                            const int cost_correction =
+                                node->CostCorrection(action);
+                            if (cost_correction + action.Cost() <= 0)
+                                continue;
+                            const int new_n_moves = node->state.n_moves +
+                                                    action.Cost() +
+                                                    cost_correction;
+                            const int new_score = new_scores[k];
+
+                            n_candidates++;
+                            const auto idx = rng.Next() % beam_width;
+                            auto& node_nxt =
+                                nodes_memo[ii][idx]
+                                          [action.Cost() + cost_correction];
+                            if ((!node_nxt) ||
+                                new_score < node_nxt->state.score) {
+                                auto new_state = node->CopyState();
+                                new_state.Apply(action, target_cube);
+                                new_state.n_moves = new_n_moves;
+                                if (new_state.score != new_score) {
+                                    cerr << "score did not match" << endl;
+                                    cerr << new_state.score << " " << new_score
+                                         << endl;
+                                    exit(1);
+                                }
+                                node_nxt.reset(new FaceNode(
+                                    new_state, node, action, action_formula,
+                                    slice_map, slice_map_inv,
+                                    flag_last_action_scale,
+                                    node->ConcatAction(action)));
+                            }
+                        }
+                    }
+                    layer_telemetry.AddCandidates(n_candidates);
+                },
+                i);
+        }
+        if constexpr (flag_parallel) {
+            threads.emplace_back([&]() {
+                auto n_candidates = 0ull;
+                for (const auto& node : layer_nodes)
+                    if (node->parent)
+                        n_candidates += ExpandWithSliceSubstitution(
+                            node, current_cost, rngs[n_threads - 1],
+                            nodes_memo[n_threads - 1]);
+                layer_telemetry.AddCandidates(n_candidates);
+            });
+        }
+        for (auto& th : threads)
+            th.join();
+
+        layer_telemetry.AddAccepted(
+            MergeNodesMemo(nodes_memo, current_cost, max_action_cost));
+    }
+#endif
+
     inline shared_ptr<FaceNode> Solve(const FaceCube& start_cube,
                                       const int id = -1) {
         // auto rng = RandomNumberGenerator(42);
@@ -1387,27 +2185,36 @@ template <int order> struct FaceBeamSearchSolver {
             nodes.resize(100000,
                          vector<shared_ptr<FaceNode>>(beam_width, start_node));
             nodes[0][0] = start_node;
+            if constexpr (flag_warm_start)
+                reserve_nodes.resize(nodes.size());
         }
-
-        cout << format("total actions={}",
-                       action_candidate_generator.actions.size())
-             << endl;
+        // --resume なら保存した層から再開する (最初の 1 周だけ)
+        auto resumed_cost = 0;
+        if (n_threads >= 2 && checkpoint.CanResume())
+            resumed_cost = LoadCheckpoint(start_cube, start_node, rngs);
 
         assert(n_threads >= 1);
         vector<thread> threads;
 
+        vector<FaceActionCandidateGenerator> own_action_candidate_generators;
+        if (n_threads >= 2 && !shared_action_candidate_generators) {
+            own_action_candidate_generators =
+                action_candidate_generator.Split(n_threads - 1);
+        }
+        const auto& multi_action_candidate_generator =
+            shared_action_candidate_generators
+                ? *shared_action_candidate_generators
+                : own_action_candidate_generators;
+
         int max_action_cost = 0;
-        if (n_threads >= 2) {
-            for (const auto& action : action_candidate_generator.actions) {
+        size_t n_actions = action_candidate_generator.actions.size();
+        for (const auto& generator : multi_action_candidate_generator) {
+            n_actions += generator.actions.size();
+            for (const auto& action : generator.actions) {
                 max_action_cost = max(max_action_cost, get<0>(action).Cost());
             }
         }
-
-        vector<FaceActionCandidateGenerator> multi_action_candidate_generator;
-        if (n_threads >= 2) {
-            multi_action_candidate_generator =
-                action_candidate_generator.Split(n_threads - 1);
-        }
+        cout << format("total actions={}", n_actions) << endl;
 
         shared_ptr<FaceNode> node_solved;
 
@@ -1415,19 +2222,41 @@ template <int order> struct FaceBeamSearchSolver {
             // start time
 
             time_t start_time = time(nullptr);
+            const auto round_start = time_budget.Elapsed();
+            round_stats = BeamRoundStats();
 
-            for (auto current_cost = 0; current_cost < 100000; current_cost++) {
+            const auto first_cost = resumed_cost;
+            resumed_cost = 0;
+            for (auto current_cost = first_cost; current_cost < 100000;
+                 current_cost++) {
                 auto current_minimum_score = 9999;
                 if (nodes[current_cost].empty()) {
                     continue;
                 }
-                nodes[current_cost][0]->state.cube.Display(cerr);
-                time_t now_time = time(nullptr);
-                int elapsed_time = now_time - start_time;
-                cout << format("time={}, current_cost={} nodes={}",
-                               elapsed_time, current_cost,
-                               nodes[current_cost].size())
-                     << endl;
+                if (time_budget.IsOver()) {
+                    // 解はその都度保存しているので、ここで打ち切る
+                    cerr << "Time over." << endl;
+                    return node_solved;
+                }
+                if (checkpoint.Enabled() &&
+                    checkpoint_writer.SinceLastWrite() >= checkpoint.interval)
+                    SaveCheckpoint(current_cost, start_cube, start_node, rngs);
+                if constexpr (kTelemetryLevel >= 3)
+                    nodes[current_cost][0]->state.cube.Display(cerr);
+                if constexpr (kTelemetryLevel >= 1) {
+                    time_t now_time = time(nullptr);
+                    int elapsed_time = now_time - start_time;
+                    cout << format("time={}, current_cost={} nodes={}",
+                                   elapsed_time, current_cost,
+                                   nodes[current_cost].size())
+                         << endl;
+                }
+                const auto layer_start = time_budget.Elapsed();
+                auto layer_telemetry = LayerTelemetry(
+                    "face_layer", current_cost, nodes[current_cost].size());
+#ifdef SOA_LAYER
+                vector<shared_ptr<FaceNode>> layer_nodes;
+#endif
                 // for (const auto& node : nodes[current_cost]) {
                 for (int idx_node = (int)nodes[current_cost].size() - 1;
                      idx_node >= 0; idx_node--) {
@@ -1460,16 +2289,27 @@ template <int order> struct FaceBeamSearchSolver {
                         node_solved = node;
                         goto BEAM_END;
                     }
+                    if constexpr (flag_warm_start) {
+                        if (node->children_expanded)
+                            continue;
+                        node->children_expanded = true;
+                    }
 
-                    cout << format("score={}, last_action_cost={} "
-                                   "facelet_changes_len={} "
-                                   "facelet_changes_len_formula={}",
-                                   node->state.score, node->last_action.Cost(),
-                                   node->last_action.facelet_changes.size(),
-                                   node->last_action_formula.facelet_changes
-                                       .size())
-                         << endl;
+                    layer_telemetry.AddNode(node->state.score);
+                    if constexpr (kTelemetryLevel >= 3)
+                        cout << format(
+                                    "score={}, last_action_cost={} "
+                                    "facelet_changes_len={} "
+                                    "facelet_changes_len_formula={}",
+                                    node->state.score, node->last_action.Cost(),
+                                    node->last_action.facelet_changes.size(),
+                                    node->last_action_formula.facelet_changes
+                                        .size())
+                             << endl;
 
+#ifdef SOA_LAYER
+                    layer_nodes.emplace_back(node);
+#else
 #ifdef RAINBOW
                     auto parity_cube = FaceCube::GetParityVectorFlag(
                         node->state.cube, target_cube);
@@ -1497,6 +2337,7 @@ template <int order> struct FaceBeamSearchSolver {
                                     auto& action_candidate_generator =
                                         multi_action_candidate_generator[ii];
                                     auto& rng = rngs[ii];
+                                    auto n_candidates = 0ull;
                                     for (int idx_action = 0;
                                          idx_action <
                                          (int)action_candidate_generator.actions
@@ -1532,6 +2373,7 @@ template <int order> struct FaceBeamSearchSolver {
                                                 action, target_cube);
 #endif
 
+                                        n_candidates++;
                                         const auto idx =
                                             rng.Next() % beam_width;
                                         auto& node_nxt =
@@ -1560,6 +2402,8 @@ template <int order> struct FaceBeamSearchSolver {
                                                 node->ConcatAction(action)));
                                         }
                                     }
+                                    layer_telemetry.AddCandidates(
+                                        n_candidates);
                                 },
                                 i);
                             threads.emplace_back(move(th));
@@ -1569,118 +2413,11 @@ template <int order> struct FaceBeamSearchSolver {
                         if constexpr (flag_parallel) {
                             if (node->parent) {
                                 thread th([&]() {
-                                    auto& rng = rngs[n_threads - 1];
-                                    SliceMap slice_map_new = node->slice_map;
-                                    SliceMapInv slice_map_inv_new =
-                                        node->slice_map_inv;
-
-                                    // list up used slices in formula
-                                    vector<int> vec_use_slices(OrderFormula - 2,
-                                                               0);
-                                    for (Move& mv :
-                                         node->last_action_formula.moves) {
-                                        if (1 <= mv.depth &&
-                                            mv.depth <= OrderFormula - 2) {
-                                            vec_use_slices[mv.depth - 1] = 1;
-                                            vec_use_slices[OrderFormula - 2 -
-                                                           mv.depth] = 1;
-                                        }
-                                    }
-                                    for (int slice_idx = 0;
-                                         slice_idx < Order - 2; slice_idx++) {
-                                        if (slice_map_new[slice_idx] != -1) {
-                                            continue;
-                                        }
-                                        if constexpr (Order % 2 == 1) {
-                                            if (slice_idx == Order / 2 - 1) {
-                                                continue;
-                                            }
-                                        }
-                                        for (int slice_idx_formula = 0;
-                                             slice_idx_formula <
-                                             OrderFormula - 2;
-                                             slice_idx_formula++) {
-                                            if constexpr (OrderFormula % 2 ==
-                                                          1) {
-                                                if (slice_idx_formula ==
-                                                    OrderFormula / 2 - 1) {
-                                                    continue;
-                                                }
-                                            }
-                                            if (!vec_use_slices
-                                                    [slice_idx_formula]) {
-                                                continue;
-                                            }
-
-                                            // try new slice
-                                            slice_map_new[slice_idx] =
-                                                slice_idx_formula;
-                                            slice_map_inv_new[slice_idx_formula]
-                                                .emplace_back(slice_idx);
-                                            slice_map_new[Order - 3 -
-                                                          slice_idx] =
-                                                OrderFormula - 3 -
-                                                slice_idx_formula;
-                                            slice_map_inv_new[OrderFormula - 3 -
-                                                              slice_idx_formula]
-                                                .emplace_back(Order - 3 -
-                                                              slice_idx);
-                                            FaceAction action_new =
-                                                ConvertFaceActionMoveWithSliceMap<
-                                                    OrderFormula, Order>(
-                                                    node->last_action_formula,
-                                                    slice_map_new,
-                                                    slice_map_inv_new);
-
-                                            int cost_correction =
-                                                node->parent->CostCorrection(
-                                                    action_new);
-                                            if (node->parent->state.n_moves +
-                                                    cost_correction +
-                                                    action_new.Cost() <=
-                                                current_cost)
-                                                continue;
-                                            int new_n_moves =
-                                                node->parent->state.n_moves +
-                                                cost_correction +
-                                                action_new.Cost();
-
-                                            auto new_state =
-                                                node->parent->state;
-                                            new_state.Apply(action_new,
-                                                            target_cube);
-                                            new_state.n_moves +=
-                                                cost_correction;
-
-                                            const auto idx =
-                                                rng.Next() % beam_width;
-                                            auto& node_nxt =
-                                                nodes_memo[n_threads - 1][idx]
-                                                          [new_n_moves -
-                                                           current_cost];
-                                            if (!node_nxt ||
-                                                new_state.score <
-                                                    node_nxt->state.score) {
-                                                node_nxt.reset(new FaceNode(
-                                                    new_state, node->parent,
-                                                    action_new,
-                                                    node->last_action_formula,
-                                                    slice_map_new,
-                                                    slice_map_inv_new,
-                                                    node->flag_last_action_scale,
-                                                    node->parent->ConcatAction(
-                                                        action_new)));
-                                            }
-                                            slice_map_new[slice_idx] = -1;
-                                            slice_map_inv_new[slice_idx_formula]
-                                                .pop_back();
-                                            slice_map_new[Order - 3 -
-                                                          slice_idx] = -1;
-                                            slice_map_inv_new[OrderFormula - 3 -
-                                                              slice_idx_formula]
-                                                .pop_back();
-                                        }
-                                    }
+                                    layer_telemetry.AddCandidates(
+                                        ExpandWithSliceSubstitution(
+                                            node, current_cost,
+                                            rngs[n_threads - 1],
+                                            nodes_memo[n_threads - 1]));
                                 });
                                 threads.emplace_back(move(th));
                             }
@@ -1692,65 +2429,20 @@ template <int order> struct FaceBeamSearchSolver {
                         threads.clear();
 
                         // update nodes
-                        for (int i = 0; i < n_threads; i++) {
-                            for (int j = 0; j < beam_width; j++) {
-                                for (int action_cost = 1;
-                                     action_cost <= max_action_cost;
-                                     action_cost++) {
-                                    // cerr << nodes_memo[i][j][action_cost]
-                                    //             ->state.score
-                                    //      << endl;
-
-                                    // if (!nodes_memo[i][j][action_cost])
-                                    //     continue;
-
-                                    // auto& node_sub =
-                                    // nodes_memo[i][j][action_cost];
-
-                                    // auto& node_new =
-                                    //     nodes[current_cost + action_cost][j];
-
-                                    // node_sub->state.cube.Display(cerr);
-                                    // cerr << endl;
-                                    // cerr << node_sub->state.score << " "
-                                    //      << node_sub->state.n_moves << endl;
-
-                                    // cerr << current_cost + action_cost <<
-                                    // endl; swap(node_new, node_sub);
-                                    // nodes[current_cost +
-                                    // action_cost][j].reset(
-                                    //     new FaceNode(
-                                    //         // node->state,
-                                    //         node_sub->state, node,
-                                    //         node_sub->last_action,
-                                    //         node_sub->last_action_formula,
-                                    //         node_sub->slice_map,
-                                    //         node_sub->slice_map_inv,
-                                    //         node_sub->flag_last_action_scale));
-
-                                    // nodes[current_cost + action_cost][j] =
-                                    //     move(nodes_memo[i][j][action_cost]);
-
-                                    auto& node_nxt =
-                                        nodes_memo[i][j][action_cost];
-                                    if (!node_nxt)
-                                        continue;
-                                    auto& node =
-                                        nodes[current_cost + action_cost][j];
-                                    if (!node) {
-                                        node = move(node_nxt);
-                                        // cerr << node->state.score << " "
-                                        //      << node_nxt->state.score <<
-                                        //      endl;
-                                    } else if (node_nxt->state.score <
-                                               node->state.score) {
-                                        node = node_nxt;
-                                    }
-                                }
-                            }
-                        }
+                        layer_telemetry.AddAccepted(MergeNodesMemo(
+                            nodes_memo, current_cost, max_action_cost));
                     }
+#endif
                 }
+#ifdef SOA_LAYER
+                if (!layer_nodes.empty())
+                    ExpandLayerSoA(layer_nodes, current_cost, start_node,
+                                   max_action_cost,
+                                   multi_action_candidate_generator, rngs,
+                                   layer_telemetry);
+#endif
+                layer_telemetry.Emit(beam_width);
+                round_stats.AddLayer(time_budget.Elapsed() - layer_start);
 
                 // cout << format("current_cost={} current_minimum_score={}",
                 //                current_cost, current_minimum_score)
@@ -1838,17 +2530,38 @@ template <int order> struct FaceBeamSearchSolver {
                         fout_best.close();
                     }
                 }
-
-                beam_width *= 2;
+                if (on_solution && !on_solution(solution))
+                    return node_solved;
+
+                const auto old_beam_width = beam_width;
+                if (time_budget.Enabled()) {
+                    // 層ごとのノードの配列と、各層に入るノード
+                    round_stats.bytes_per_beam_width =
+                        (double)nodes.size() * sizeof(shared_ptr<FaceNode>) +
+                        (double)round_stats.n_layers * sizeof(FaceNode);
+                    beam_width = time_budget.FitBeamWidth(
+                        beam_width, time_budget.Elapsed() - round_start,
+                        round_stats);
+                    if (beam_width <= old_beam_width) {
+                        cerr << "No time left for a wider beam." << endl;
+                        return node_solved;
+                    }
+                } else {
+                    beam_width *= 2;
+                }
+                cout << format("beam_width={}", beam_width) << endl;
                 if (n_threads >= 2) {
                     for (auto& nodess : nodes) {
                         // nodess.clear();
                         nodess.resize(beam_width, start_node);
                     }
+                    if constexpr (flag_warm_start)
+                        AdmitReservedNodes(old_beam_width);
                 }
 
-                if(order==3 && beam_width >= 1000)
-                    exit(0);
+                // 一括で解くときにプロセスごと終わらないよう、exit しない
+                if (order == 3 && beam_width >= 1000)
+                    return node_solved;
 
             } else {
                 break;
@@ -1972,6 +2685,13 @@ template <int order> struct FaceBeamSearchSolver {
 
     int id = -1;
 
+    // --time-budget <秒>, --checkpoint <秒>, --resume を取り除いた残りを
+    // 位置引数として読む
+    auto args = vector<const char*>(argv, argv + argc);
+    const auto time_budget = TimeBudget::FromArgs(args);
+    auto checkpoint = CheckpointOptions::FromArgs(args);
+    argc = (int)args.size();
+
     auto initial_cube = FaceCube();
     if (0) {
         // ランダムな initial_cube を用意する
@@ -1985,17 +2705,17 @@ template <int order> struct FaceBeamSearchSolver {
         }
     } else {
         if (argc >= 2) {
-            cerr << "argv[1] = " << argv[1] << endl;
-            id = atoi(argv[1]);
+            cerr << "args[1] = " << args[1] << endl;
+            id = atoi(args[1]);
         } else
             cin >> id;
         if (argc >= 3) {
-            cerr << "argv[2] = " << argv[2] << endl;
-            beam_width = atoi(argv[2]);
+            cerr << "args[2] = " << args[2] << endl;
+            beam_width = atoi(args[2]);
         }
         if (argc >= 4) {
-            cerr << "argv[3] = " << argv[3] << endl;
-            n_threads = atoi(argv[3]);
+            cerr << "args[3] = " << args[3] << endl;
+            n_threads = atoi(args[3]);
         }
         string filename_puzzles = "../../../input/santa-2023/puzzles.csv";
         string filename_sample =
@@ -2044,6 +2764,12 @@ template <int order> struct FaceBeamSearchSolver {
     target_cube.Reset();
 
     auto solver = Solver(target_cube, beam_width, formula_file, n_threads);
+    solver.time_budget = time_budget;
+    if (time_budget.Enabled())
+        cout << format("time_budget={}s", time_budget.seconds) << endl;
+    if (id >= 0)
+        checkpoint.filename = format("checkpoint/face_{}.bin", id);
+    solver.checkpoint = checkpoint;
 
     const auto node = solver.Solve(initial_cube, id);
     // if (node != nullptr) {
@@ -2061,6 +2787,120 @@ template <int order> struct FaceBeamSearchSolver {
     // }
 }
 
+// SolveFaceBatch と face_dispatch.cpp から 1 問ずつ呼ばれる
+// 手筋のファイルは最初の呼び出しで 1 度だけ読み、以降の問題で共有する
+// (n_threads_per_problem は毎回同じ値を渡すこと)
+[[maybe_unused]] static bool
+SolveFaceProblem(const int id, const Formula& sample_formula,
+                 const int beam_width, const int n_threads_per_problem,
+                 const TimeBudget& time_budget) {
+    using Solver = FaceBeamSearchSolver<Order>;
+    using FaceCube = typename Solver::FaceCube;
+    static const auto action_candidate_generators =
+        Solver::SplitActionCandidateGenerators(formula_file,
+                                               n_threads_per_problem);
+    static const auto target_cube = [] {
+        auto cube = FaceCube();
+        cube.Reset();
+        return cube;
+    }();
+
+    auto initial_cube = FaceCube();
+    initial_cube.Reset();
+    initial_cube.RotateInv(sample_formula);
+
+    auto solver = Solver(target_cube, beam_width, action_candidate_generators);
+    // 制限時間は問題を解き始めてから数える
+    solver.time_budget = TimeBudget(time_budget.seconds);
+    // 制限時間が無ければビーム幅を倍にして解き直し続けるので、最初の解で
+    // 止めて次の問題に移る
+    if (!time_budget.Enabled())
+        solver.on_solution = [](const Formula&) { return false; };
+    const auto t0 = TimeBudget();
+    const auto node = solver.Solve(initial_cube, id);
+    cout << format("problem id = {} order={} {} ({:.1f}s)", id, Order,
+                   node ? format("solved in {} moves", node->state.n_moves)
+                        : string("failed"),
+                   t0.Elapsed())
+         << endl;
+    return node != nullptr;
+}
+
+// 複数の問題をまとめて解く
+// n_threads を n_threads_per_problem ずつに分け、空いたところから次の問題を
+// 解く (--time-budget は 1 問あたりの制限時間)
+// --time-budget が無ければ、各問題は beam_width で最初に見つかった解で終わる
+[[maybe_unused]] static void SolveFaceBatch(int argc, char** argv) {
+    auto args = vector<const char*>(argv, argv + argc);
+    const auto time_budget = TimeBudget::FromArgs(args);
+    if (args.size() < 3 || args.size() > 5) {
+        cerr << format("Usage: {} <problem_ids> <beam_width> [n_threads] "
+                       "[n_threads_per_problem] [--time-budget <sec>]",
+                       argv[0])
+             << endl;
+        exit(1);
+    }
+    const auto problem_ids = ParseProblemIds(args[1]);
+    const auto beam_width = atoi(args[2]);
+    const auto n_threads = args.size() >= 4 ? atoi(args[3]) : N_THREADS;
+    const auto n_threads_per_problem =
+        args.size() >= 5 ? atoi(args[4]) : min(n_threads, 8);
+    if (n_threads_per_problem < 2 || n_threads < n_threads_per_problem) {
+        cerr << "2 <= n_threads_per_problem <= n_threads is required." << endl;
+        exit(1);
+    }
+    const auto n_workers = n_threads / n_threads_per_problem;
+
+    const auto filename_puzzles = "../../../input/santa-2023/puzzles.csv";
+    const auto filename_sample =
+        "../../../input/santa-2023/sample_submission.csv";
+
+    cout << format("kOrder={} formula_file={} n_problems={} beam_width={} "
+                   "n_workers={} n_threads_per_problem={}",
+                   Order, formula_file, problem_ids.size(), beam_width,
+                   n_workers, n_threads_per_problem)
+         << endl;
+
+    auto next_idx = atomic<int>(0);
+    auto n_solved = atomic<int>(0);
+    const auto work = [&] {
+        for (auto idx = next_idx++; idx < (int)problem_ids.size();
+             idx = next_idx++) {
+            const auto id = problem_ids[idx];
+            const auto [puzzle_size, is_normal, sample_formula] =
+                ReadKaggleInput(filename_puzzles, filename_sample, id);
+#ifdef RAINBOW
+            const auto mode_ok = !is_normal;
+#else
+            const auto mode_ok = is_normal;
+#endif
+            if (puzzle_size != Order || !mode_ok) {
+                cerr << format("Skipped problem {} (puzzle_size={} "
+                               "is_normal={}).",
+                               id, puzzle_size, is_normal)
+                     << endl;
+                continue;
+            }
+            if (SolveFaceProblem(id, sample_formula, beam_width,
+                                 n_threads_per_problem, time_budget))
+                n_solved++;
+        }
+    };
+    auto workers = vector<thread>();
+    for (auto i = 0; i < n_workers; i++)
+        workers.emplace_back(work);
+    for (auto& worker : workers)
+        worker.join();
+    cout << format("solved {}/{} problems", n_solved.load(),
+                   problem_ids.size())
+         << endl;
+}
+
+#ifdef FACE_NAMESPACE
+} // namespace FACE_NAMESPACE
+#endif
+#undef FACE_SCOPE
+
 // clang++ -std=c++20 -Wall -Wextra -O3 face_cube.cpp -DTEST_FACE_CUBE
 #ifdef TEST_FACE_CUBE
 int main() { TestFaceCube(); }
@@ -2090,10 +2930,24 @@ int main() { TestFaceActionCandidateGenerator(); }
 // clang-format on
 
 // clang++ -std=c++20 -Wall -Wextra -O3 face_cube.cpp -DTEST_FACE_BEAM_SEARCH
+// 層単位で SoA にまとめて評価する場合 (RAINBOW 以外):
+// clang++ -std=c++20 -Wall -Wextra -O3 -march=native face_cube.cpp -DTEST_FACE_BEAM_SEARCH -DSOA_LAYER
+// ビーム幅を倍にするときに前回の探索を引き継ぐ場合:
+// clang++ -std=c++20 -Wall -Wextra -O3 face_cube.cpp -DTEST_FACE_BEAM_SEARCH -DWARM_START
+// 実行: ./a.out problem_id beam_width n_threads [--time-budget 秒]
+//       [--checkpoint 秒] [--resume]
+// --checkpoint を付けると checkpoint/face_{problem_id}.bin に定期的に保存する
 #ifdef TEST_FACE_BEAM_SEARCH
 int main(int argc, char** argv) { TestFaceBeamSearch(argc, argv); }
 #endif
 
+// clang++ -std=c++20 -Wall -Wextra -O3 face_cube.cpp -DSOLVE_FACE_BATCH -DORDER=4 -DDEPTH=8
+// 実行: ./a.out 150-199 beam_width n_threads n_threads_per_problem
+//       [--time-budget 1 問あたりの秒数]
+#ifdef SOLVE_FACE_BATCH
+int main(int argc, char** argv) { SolveFaceBatch(argc, argv); }
+#endif
+
 /*
 Rainbow では面の回転を加えない方が良い？
 */
@@ -0,0 +1,190 @@
+// ORDER と RAINBOW を実行時に選ぶ面ソルバ
+// face_cube.cpp を組み合わせごとに別の名前空間に読み込むので、各 ORDER の
+// コードはこれまで通りコンパイル時に特殊化される
+// DEPTH (手筋の深さ) は全ての ORDER で共通
+
+#ifndef DEPTH
+#define DEPTH 8
+#endif
+
+#define ORDER 4
+#define FACE_NAMESPACE face_4_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#define RAINBOW
+#define FACE_NAMESPACE face_4_rainbow
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef RAINBOW
+#undef ORDER
+
+#define ORDER 5
+#define FACE_NAMESPACE face_5_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#define RAINBOW
+#define FACE_NAMESPACE face_5_rainbow
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef RAINBOW
+#undef ORDER
+
+#define ORDER 6
+#define FACE_NAMESPACE face_6_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#define RAINBOW
+#define FACE_NAMESPACE face_6_rainbow
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef RAINBOW
+#undef ORDER
+
+#define ORDER 7
+#define FACE_NAMESPACE face_7_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef ORDER
+
+#define ORDER 8
+#define FACE_NAMESPACE face_8_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef ORDER
+
+#define ORDER 9
+#define FACE_NAMESPACE face_9_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef ORDER
+
+#define ORDER 10
+#define FACE_NAMESPACE face_10_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef ORDER
+
+#define ORDER 19
+#define FACE_NAMESPACE face_19_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef ORDER
+
+#define ORDER 33
+#define FACE_NAMESPACE face_33_normal
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#define RAINBOW
+#define FACE_NAMESPACE face_33_rainbow
+#include "face_cube.cpp"
+#undef FACE_NAMESPACE
+#undef RAINBOW
+#undef ORDER
+
+using SolveFaceProblemFunction = bool (*)(const int, const Formula&, const int,
+                                          const int, const TimeBudget&);
+
+// 対応していない組み合わせなら nullptr
+static SolveFaceProblemFunction FindSolveFaceProblem(const int order,
+                                                     const bool is_normal) {
+    switch (order) {
+    case 4:
+        return is_normal ? face_4_normal::SolveFaceProblem
+                         : face_4_rainbow::SolveFaceProblem;
+    case 5:
+        return is_normal ? face_5_normal::SolveFaceProblem
+                         : face_5_rainbow::SolveFaceProblem;
+    case 6:
+        return is_normal ? face_6_normal::SolveFaceProblem
+                         : face_6_rainbow::SolveFaceProblem;
+    case 7:
+        return is_normal ? face_7_normal::SolveFaceProblem : nullptr;
+    case 8:
+        return is_normal ? face_8_normal::SolveFaceProblem : nullptr;
+    case 9:
+        return is_normal ? face_9_normal::SolveFaceProblem : nullptr;
+    case 10:
+        return is_normal ? face_10_normal::SolveFaceProblem : nullptr;
+    case 19:
+        return is_normal ? face_19_normal::SolveFaceProblem : nullptr;
+    case 33:
+        return is_normal ? face_33_normal::SolveFaceProblem
+                         : face_33_rainbow::SolveFaceProblem;
+    default:
+        return nullptr;
+    }
+}
+
+// face_cube.cpp の SolveFaceBatch と同じだが、問題ごとに ORDER と
+// normal/rainbow を puzzles.csv から決めるので、違う ORDER の問題を混ぜられる
+// 手筋のファイルは、その組み合わせの問題を最初に解くときに読む
+// --time-budget が無ければ、各問題は beam_width で最初に見つかった解で終わる
+[[maybe_unused]] static void SolveFaceDispatch(int argc, char** argv) {
+    auto args = vector<const char*>(argv, argv + argc);
+    const auto time_budget = TimeBudget::FromArgs(args);
+    if (args.size() < 3 || args.size() > 5) {
+        cerr << format("Usage: {} <problem_ids> <beam_width> [n_threads] "
+                       "[n_threads_per_problem] [--time-budget <sec>]",
+                       argv[0])
+             << endl;
+        exit(1);
+    }
+    const auto problem_ids = ParseProblemIds(args[1]);
+    const auto beam_width = atoi(args[2]);
+    const auto n_threads = args.size() >= 4 ? atoi(args[3]) : N_THREADS;
+    const auto n_threads_per_problem =
+        args.size() >= 5 ? atoi(args[4]) : min(n_threads, 8);
+    if (n_threads_per_problem < 2 || n_threads < n_threads_per_problem) {
+        cerr << "2 <= n_threads_per_problem <= n_threads is required." << endl;
+        exit(1);
+    }
+    const auto n_workers = n_threads / n_threads_per_problem;
+
+    const auto filename_puzzles = "../../../input/santa-2023/puzzles.csv";
+    const auto filename_sample =
+        "../../../input/santa-2023/sample_submission.csv";
+
+    cout << format("depth={} n_problems={} beam_width={} n_workers={} "
+                   "n_threads_per_problem={}",
+                   DEPTH, problem_ids.size(), beam_width, n_workers,
+                   n_threads_per_problem)
+         << endl;
+
+    auto next_idx = atomic<int>(0);
+    auto n_solved = atomic<int>(0);
+    const auto work = [&] {
+        for (auto idx = next_idx++; idx < (int)problem_ids.size();
+             idx = next_idx++) {
+            const auto id = problem_ids[idx];
+            const auto [puzzle_size, is_normal, sample_formula] =
+                ReadKaggleInput(filename_puzzles, filename_sample, id);
+            const auto solve_face_problem =
+                FindSolveFaceProblem(puzzle_size, is_normal);
+            if (!solve_face_problem) {
+                cerr << format("Skipped problem {} (puzzle_size={} "
+                               "is_normal={}).",
+                               id, puzzle_size, is_normal)
+                     << endl;
+                continue;
+            }
+            if (solve_face_problem(id, sample_formula, beam_width,
+                                   n_threads_per_problem, time_budget))
+                n_solved++;
+        }
+    };
+    auto workers = vector<thread>();
+    for (auto i = 0; i < n_workers; i++)
+        workers.emplace_back(work);
+    for (auto& worker : workers)
+        worker.join();
+    cout << format("solved {}/{} problems", n_solved.load(),
+                   problem_ids.size())
+         << endl;
+}
+
+// clang++ -std=c++20 -Wall -Wextra -O3 face_dispatch.cpp -DSOLVE_FACE_DISPATCH
+// 実行: ./a.out 150-283 beam_width n_threads n_threads_per_problem
+//       [--time-budget 1 問あたりの秒数]
+#ifdef SOLVE_FACE_DISPATCH
+int main(int argc, char** argv) { SolveFaceDispatch(argc, argv); }
+#endif
@@ -0,0 +1,189 @@
+#include "face_cube.cpp"
+
+#include "edge_cube.cpp"
+
+#include "three_order_cube.cpp"
+
+using std::upper_bound;
+
+// 面ソルバと辺ソルバを 1 つのプロセスで繋げる
+// 面ソルバはビーム幅を倍にしながら解き直すので、解が何度か見つかる
+// そのうち短い方から top_k 個に入るものを、見つかり次第辺ソルバに通し、
+// 面と辺の合計が一番短いものを残す
+// 辺ソルバは面ソルバの 1 周の合間に同じ n_threads 個のスレッドで動かすので、
+// 2 つが同時にスレッドを取り合うことはない
+// 辺ソルバと手順は 1 回だけ用意して、全ての面の解で使い回す
+// 最後に、面と辺が一番短いものの続きの 3x3x3 を同じプロセスで解く
+template <int order> struct FaceEdgePipeline {
+    bool is_normal;
+    Formula sample_formula;
+    int edge_beam_width;
+    int top_k;
+    EdgeBeamSearchSolver<order> edge_solver;
+
+    vector<int> accepted_costs; // これまでに通した面の解の長さ (昇順)
+    vector<Formula> accepted_solutions;
+    optional<pair<Formula, Formula>> best; // 面の解と辺の解
+
+    inline FaceEdgePipeline(const bool is_normal,
+                            const Formula& sample_formula,
+                            const int edge_beam_width, const int top_k,
+                            const int n_threads, const TimeBudget& time_budget)
+        : is_normal(is_normal), sample_formula(sample_formula),
+          edge_beam_width(edge_beam_width), top_k(top_k),
+          edge_solver(is_normal, edge_beam_width,
+                      format("out/edge_formula_{}_{}.txt", order,
+                             EdgeFormulaDepth<order>()),
+                      n_threads),
+          accepted_costs(), accepted_solutions(), best() {
+        edge_solver.time_budget = time_budget;
+    }
+
+    inline int BestCost() const {
+        return best ? best->first.Cost() + best->second.Cost() : 99999;
+    }
+
+    // 面ソルバから呼ばれる
+    // 既に通したものと同じ解や、上位 top_k 個に入らない解は捨てる
+    inline void Push(const Formula& face_solution) {
+        const auto cost = face_solution.Cost();
+        for (const auto& accepted : accepted_solutions)
+            if (accepted.moves == face_solution.moves)
+                return;
+        if ((int)accepted_costs.size() >= top_k &&
+            cost >= accepted_costs.back())
+            return;
+        // 辺を揃える手数は 0 以上なので、これで改善することはない
+        if (cost >= BestCost())
+            return;
+        if (edge_solver.time_budget.IsOver())
+            return;
+        accepted_costs.insert(
+            upper_bound(accepted_costs.begin(), accepted_costs.end(), cost),
+            cost);
+        if ((int)accepted_costs.size() > top_k)
+            accepted_costs.pop_back();
+        accepted_solutions.emplace_back(face_solution);
+        cerr << format("Solving edges after a face solution of length {}.",
+                       cost)
+             << endl;
+
+        // 時間制限で広げると面ソルバの時間がなくなるので、ビーム幅は固定
+        edge_solver.beam_width = edge_beam_width;
+        const auto edge_solution = SolveEdgePhase<order>(
+            edge_solver, is_normal, sample_formula, face_solution,
+            [](const Formula&) { return false; });
+        if (!edge_solution)
+            return;
+        const auto total_cost = cost + edge_solution->Cost();
+        cerr << format("face={} edge={} total={}", cost,
+                       edge_solution->Cost(), total_cost)
+             << endl;
+        if (total_cost < BestCost())
+            best = {face_solution, *edge_solution};
+    }
+};
+
+[[maybe_unused]] static void SolveFaceEdgePipeline(int argc, char** argv) {
+    constexpr auto kOrder = Order;
+    using Solver = FaceBeamSearchSolver<kOrder>;
+    using FaceCube = typename Solver::FaceCube;
+
+    auto args = vector<const char*>(argv, argv + argc);
+    const auto time_budget = TimeBudget::FromArgs(args);
+    if (args.size() < 3 || args.size() > 7) {
+        cerr << format("Usage: {} <problem_id> <face_beam_width> "
+                       "[edge_beam_width] [n_threads] [top_k] [face_rounds] "
+                       "[--time-budget <sec>]",
+                       argv[0])
+             << endl;
+        exit(1);
+    }
+    const auto problem_id = atoi(args[1]);
+    const auto face_beam_width = atoi(args[2]);
+    const auto edge_beam_width = args.size() >= 4 ? atoi(args[3]) : 32;
+    const auto n_threads = args.size() >= 5 ? atoi(args[4]) : N_THREADS;
+    const auto top_k = args.size() >= 6 ? atoi(args[5]) : 3;
+    // 面ソルバはこの回数だけ解が見つかったら止める
+    const auto face_rounds = args.size() >= 7 ? atoi(args[6]) : 2 * top_k;
+
+    const auto filename_puzzles = "../../../input/santa-2023/puzzles.csv";
+    const auto filename_sample =
+        "../../../input/santa-2023/sample_submission.csv";
+    const auto [puzzle_size, is_normal, sample_formula] =
+        ReadKaggleInput(filename_puzzles, filename_sample, problem_id);
+    if (puzzle_size != kOrder) {
+        cerr << "puzzle_size != kOrder" << endl;
+        exit(1);
+    }
+#ifdef RAINBOW
+    if (is_normal) {
+        cerr << "is_normal" << endl;
+        exit(1);
+    }
+#else
+    if (!is_normal) {
+        cerr << "!is_normal" << endl;
+        exit(1);
+    }
+#endif
+
+    cout << format("problem_id={} face_beam_width={} edge_beam_width={} "
+                   "n_threads={} top_k={} face_rounds={}",
+                   problem_id, face_beam_width, edge_beam_width, n_threads,
+                   top_k, face_rounds)
+         << endl;
+
+    auto initial_cube = FaceCube();
+    initial_cube.Reset();
+    initial_cube.RotateInv(sample_formula);
+    auto target_cube = FaceCube();
+    target_cube.Reset();
+
+    auto pipeline =
+        FaceEdgePipeline<kOrder>(is_normal, sample_formula, edge_beam_width,
+                                 top_k, n_threads, time_budget);
+    auto solver = Solver(target_cube, face_beam_width, formula_file, n_threads);
+    solver.time_budget = time_budget;
+    auto n_face_solutions = 0;
+    solver.on_solution = [&](const Formula& face_solution) {
+        pipeline.Push(face_solution);
+        return ++n_face_solutions < face_rounds;
+    };
+    // id を渡さないので solution_face には書き込まない
+    solver.Solve(initial_cube, -1);
+
+    if (!pipeline.best) {
+        cerr << "Failed." << endl;
+        exit(1);
+    }
+    const auto& [face_solution, edge_solution] = *pipeline.best;
+    cout << format("best: face={} edge={} total={}", face_solution.Cost(),
+                   edge_solution.Cost(), pipeline.BestCost())
+         << endl;
+    face_solution.Print();
+    cout << endl;
+    edge_solution.Print();
+    cout << endl;
+
+    // 3x3x3 の解き方は normal でしか使えない
+    if (!is_normal)
+        return;
+    const auto three_order_solver = ThreeOrderSolver();
+    const auto solution = SolveThreeOrderPhase<kOrder>(
+        three_order_solver, sample_formula, face_solution, edge_solution);
+    if (!solution) {
+        cerr << "Failed to solve the 3x3x3." << endl;
+        exit(1);
+    }
+    cout << format("three_order={} total={}",
+                   solution->Cost() - pipeline.BestCost(), solution->Cost())
+         << endl;
+    solution->Print();
+    cout << endl;
+}
+
+// clang++ -std=c++20 -Wall -Wextra -O3 face_edge_pipeline.cpp -DSOLVE_FACE_EDGE -DORDER=5
+#ifdef SOLVE_FACE_EDGE
+int main(int argc, char** argv) { SolveFaceEdgePipeline(argc, argv); }
+#endif
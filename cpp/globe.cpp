@@ -2,6 +2,7 @@
 #include <array>
 #include <cassert>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <format>
 #include <fstream>
@@ -14,18 +15,28 @@
 #include <unordered_set>
 #include <vector>
 
+#include "telemetry.cpp"
+#include "time_budget.cpp"
+
 using std::array;
+using std::binary_search;
+using std::copy;
 using std::cout;
 using std::endl;
 using std::fill;
 using std::format;
 using std::ifstream;
+using std::inplace_merge;
+using std::istreambuf_iterator;
 using std::istringstream;
+using std::lexicographical_compare;
 using std::make_shared;
+using std::max;
 using std::min;
 using std::move;
 using std::ofstream;
 using std::ostream;
+using std::pair;
 using std::shared_ptr;
 using std::string;
 using std::swap;
@@ -118,6 +129,13 @@ struct UnitMove {
             array<const char*, 3>{"r", "-r", "f"};
         os << direction_strings[int(direction)] << int(depth);
     }
+
+    // 1 バイトにする (depth は 66 未満なので 198 未満に収まる)
+    inline u8 ToByte() const { return (u8)(depth * 3 + (int)direction); }
+
+    inline static UnitMove FromByte(const u8 code) {
+        return {(Direction)(code % 3), (i8)(code / 3)};
+    }
 };
 
 struct Move {
@@ -209,6 +227,112 @@ struct UnitFormula {
     }
 };
 
+// 手筋のバイナリ形式
+// 先頭に kUnitFormulaBinaryMagic、続けて手筋ごとに
+//   手数 (1 バイト), 手 (UnitMove::ToByte())
+constexpr auto kUnitFormulaBinaryMagic = "\x7f" "GLB";
+constexpr auto kUnitFormulaBinaryMagicSize = 4;
+
+// 手筋をバイナリ形式で書き出す
+// kBufferSize 溜まるごとに書き出す
+// 途中で止まったファイルを読まないように、<filename>.tmp に書いて Close() で
+// 置き換える
+struct UnitFormulaWriter {
+    static constexpr auto kBufferSize = 1 << 20;
+
+    string filename;
+    ofstream ofs;
+    string buffer;
+
+    inline UnitFormulaWriter(const string& filename)
+        : filename(filename), ofs(TmpFilename(), ios::binary), buffer() {
+        if (!ofs.good()) {
+            cout << "Failed to open " << TmpFilename() << endl;
+            abort();
+        }
+        buffer.append(kUnitFormulaBinaryMagic, kUnitFormulaBinaryMagicSize);
+    }
+
+    inline ~UnitFormulaWriter() {
+        if (ofs.is_open())
+            Close();
+    }
+
+    inline string TmpFilename() const { return filename + ".tmp"; }
+
+    inline void Write(const UnitFormula& formula) {
+        assert(formula.unit_moves.size() < 256);
+        buffer += (char)formula.unit_moves.size();
+        for (const auto& unit_move : formula.unit_moves)
+            buffer += (char)unit_move.ToByte();
+        if ((int)buffer.size() >= kBufferSize)
+            Flush();
+    }
+
+    inline void Flush() {
+        ofs.write(buffer.data(), buffer.size());
+        ofs.flush();
+        buffer.clear();
+        if (!ofs.good()) {
+            cout << "Failed to write " << TmpFilename() << endl;
+            abort();
+        }
+    }
+
+    inline void Close() {
+        Flush();
+        ofs.close();
+        if (!ofs.good() ||
+            std::rename(TmpFilename().c_str(), filename.c_str()) != 0) {
+            cout << "Failed to write " << filename << endl;
+            abort();
+        }
+    }
+};
+
+// 手筋のファイルを読み取る
+// 同じ名前で拡張子が .bin のものがあれば、バイナリ形式のそちらを読む
+// テキスト形式では f1.r1.-r0.f1 みたいなのが 1 行に 1 つ書かれている
+[[maybe_unused]] static vector<UnitFormula>
+ReadUnitFormulaFile(string filename) {
+    const auto dot = filename.rfind('.');
+    if (dot != string::npos) {
+        const auto binary_filename = filename.substr(0, dot) + ".bin";
+        if (ifstream(binary_filename).good())
+            filename = binary_filename;
+    }
+    auto ifs = ifstream(filename, ios::binary);
+    if (!ifs.good()) {
+        cout << "Failed to open " << filename << endl;
+        abort();
+    }
+    auto formulas = vector<UnitFormula>();
+    const auto data = string(istreambuf_iterator<char>(ifs), {});
+    if (data.compare(0, kUnitFormulaBinaryMagicSize,
+                     kUnitFormulaBinaryMagic) == 0) {
+        for (auto p = (size_t)kUnitFormulaBinaryMagicSize; p < data.size();) {
+            const auto n = (size_t)(u8)data[p++];
+            if (n > data.size() - p) {
+                cout << "Formula file is truncated: " << filename << endl;
+                abort();
+            }
+            auto& formula = formulas.emplace_back();
+            for (auto i = 0u; i < n; i++)
+                formula.unit_moves.push_back(
+                    UnitMove::FromByte((u8)data[p++]));
+        }
+        return formulas;
+    }
+    auto iss = istringstream(data);
+    string line;
+    while (getline(iss, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        formulas.emplace_back(line);
+    }
+    return formulas;
+}
+
 struct FaceletChanges {
     struct Change {
         u8 from, to;
@@ -391,6 +515,25 @@ template <int width> struct UnitGlobe {
             return hash;
         }
     };
+    // 重複判定用の 128 bit ハッシュ
+    using Fingerprint = array<u64, 2>;
+    inline Fingerprint ComputeFingerprint() const {
+        static constexpr auto mix = [](u64 x) {
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        };
+        const auto data = (const u8*)&facelets;
+        auto fingerprint =
+            Fingerprint{0x9e3779b97f4a7c15ull, 0x2545f4914f6cdd1dull};
+        for (auto i = 0; i < width * 2; i += 8) {
+            auto x = (u64)0;
+            memcpy(&x, data + i, min(8, width * 2 - i));
+            fingerprint[0] = mix(fingerprint[0] ^ x);
+            fingerprint[1] = mix(fingerprint[1] + x);
+        }
+        return fingerprint;
+    }
     inline void Display(ostream& os = cout) const {
         for (int y = 0; y < 2; y++) {
             for (int x = 0; x < width; x++) {
@@ -451,14 +594,25 @@ template <int height, int width> struct Globe {
 template <int width> struct GlobeFormulaSearcher {
     static constexpr auto kMaxFlipDepth = 5;
 
+    // 重複削除で一度に持つハッシュの上限
+    // 超える場合はハッシュの範囲で分割して複数回に分けて処理する
+    static constexpr auto kMaxFingerprintBytes = (u64)1 << 32;
+    // 水増しの途中で作る手筋の長さの上限
+    static constexpr auto kMaxFormulaLength = 32;
+
     using UnitGlobe = ::UnitGlobe<width>;
+    using Fingerprint = typename UnitGlobe::Fingerprint;
+    using FixedFormula = array<UnitMove, kMaxFormulaLength>;
     int max_cost;
     int max_depth;
+    int n_threads;
     UnitGlobe unit_globe;
 
-    inline GlobeFormulaSearcher()
-        : max_cost(), max_depth(), unit_globe(width * 2), results(), depth(),
-          move_history(), flips(), flip_depth(), n_total_flips() {
+    inline GlobeFormulaSearcher(const int n_threads = 1)
+        : max_cost(), max_depth(), n_threads(n_threads),
+          unit_globe(width * 2), results(), depth(), move_history(), flips(),
+          flip_depth(), n_total_flips() {
+        assert(n_threads >= 1);
         assert(max_depth <= (int)move_history.size());
     }
 
@@ -466,6 +620,11 @@ template <int width> struct GlobeFormulaSearcher {
                 const int max_conjugate_depth = 4) {
         max_cost = max_cost_;
         max_depth = max_depth_;
+        if (max_depth > (int)move_history.size() ||
+            max_depth + max_conjugate_depth * 2 > kMaxFormulaLength) {
+            cout << "max_depth or max_conjugate_depth is too large" << endl;
+            abort();
+        }
         results.clear();
         Timer timer;
 
@@ -481,32 +640,19 @@ template <int width> struct GlobeFormulaSearcher {
         cout << format("Done. {} formulas left. {}", results.size(), timer())
              << endl;
 
-        // 最初の Flip を全通りにする
+        // 最初の Flip を全通りにして、重複を削除する
         cout << "Augmenting (flip / slide)..." << endl;
         AugmentFirstFlipRotation();
-        cout << format("Done. {} formulas found. {}", results.size(), timer())
-             << endl;
-
-        // 重複を削除する
-        cout << "Removing duplicates..." << endl;
-        RemoveDuplicates(true);
         cout << format("Done. {} formulas left. {}", results.size(), timer())
              << endl;
 
         auto n_results = results.size();
         for (auto i = 0; i < max_conjugate_depth; i++) {
-            // A と A' で挟んで水増しする
+            // A と A' で挟んで水増しして、重複を削除する
             cout << format("Augmenting (conjugate {}/{})...", i + 1,
                            max_conjugate_depth)
                  << endl;
             AugmentConjugate();
-            cout << format("Done. {} formulas found. {}", results.size(),
-                           timer())
-                 << endl;
-
-            // 重複を削除する
-            cout << "Removing duplicates..." << endl;
-            RemoveDuplicates(true);
             cout << format("Done. {} formulas left. {}", results.size(),
                            timer())
                  << endl;
@@ -619,51 +765,195 @@ template <int width> struct GlobeFormulaSearcher {
             }
     }
 
-    // 同じ変化の手筋は短いほうだけを残す
-    // また、変化の多すぎる手筋も削除する
-    inline void
-    RemoveDuplicates(const bool do_sanity_check_after_augment = false) {
+    // [0, n) を n_threads 個に分けて f(thread_id, begin, end) を並列に呼ぶ
+    template <typename Func>
+    inline void ParallelFor(const u64 n, const Func& f) const {
+        auto threads = vector<thread>();
+        for (auto i = 0; i < n_threads; i++)
+            threads.emplace_back(f, i, n * i / n_threads,
+                                 n * (i + 1) / n_threads);
+        for (auto& th : threads)
+            th.join();
+    }
+
+    // 短い順、同じ長さなら辞書順にソートする
+    inline void SortResults() {
+        static constexpr auto compare = [](const UnitFormula& a,
+                                           const UnitFormula& b) {
+            if (a.unit_moves.size() != b.unit_moves.size())
+                return a.unit_moves.size() < b.unit_moves.size();
+            return a.unit_moves < b.unit_moves;
+        };
+        const auto n = (u64)results.size();
+        ParallelFor(n, [&](const int, const u64 begin, const u64 end) {
+            sort(results.begin() + begin, results.begin() + end, compare);
+        });
+        // 隣り合う区間を併合していく
+        const auto bound = [&](const int i) {
+            return results.begin() + n * min(i, n_threads) / n_threads;
+        };
+        for (auto step = 1; step < n_threads; step *= 2) {
+            auto threads = vector<thread>();
+            for (auto i = 0; i + step < n_threads; i += step * 2)
+                threads.emplace_back([&, i, step] {
+                    inplace_merge(bound(i), bound(i + step),
+                                  bound(i + step * 2), compare);
+                });
+            for (auto& th : threads)
+                th.join();
+        }
+    }
+
+    // results の各手筋を n_variants 通りに変形したものを候補とし、
+    // 同じ変化の候補は短いほうだけを残して results を置き換える
+    // また、変化の多すぎる候補も削除する
+    // transform(formula, variant, moves) は変形した手筋を moves に書き込み、
+    // その長さを返す
+    // 候補は固定長の配列上でだけ作り、残ったものだけを UnitFormula にする
+    template <typename Transform>
+    inline void AugmentAndRemoveDuplicates(const int n_variants,
+                                           const Transform& transform) {
         assert(unit_globe == UnitGlobe(width * 2));
-        sort(results.begin(), results.end(),
-             [](const UnitFormula& a, const UnitFormula& b) {
-                 if (a.unit_moves.size() != b.unit_moves.size())
-                     return a.unit_moves.size() < b.unit_moves.size();
-                 return a.unit_moves < b.unit_moves;
-             });
-
-        u64 top = 0; // 33 80 10 6 hits 2.79 * 10^9
-        auto found_permutations =
-            unordered_set<UnitGlobe, typename UnitGlobe::Hash>();
-        for (u64 idx_results = 0; idx_results < (u64)results.size();
-             idx_results++) {
-            const auto formula = results[idx_results];
-            // 実際に手筋を使って回転させる
-            auto tmp_globe = unit_globe;
-            tmp_globe.Rotate(formula);
-            // 変化が無いか多すぎるなら削除する
-            auto n_changes = 0;
-            for (auto i = 0; i < width * 2; i++)
-                if (tmp_globe.facelets[i / width][i % width].data != i)
-                    n_changes++;
-            if (n_changes == 0 ||
-                n_changes * (int)formula.unit_moves.size() > max_cost)
-                continue;
-            // 重複があるなら削除する
-            const auto [it, inserted] = found_permutations.insert(tmp_globe);
-            if (inserted)
-                results[top++] = formula;
+        const auto make_candidate = [&](const u64 candidate,
+                                        FixedFormula& moves) {
+            return transform(results[candidate / n_variants],
+                             (int)(candidate % n_variants), moves);
+        };
+        // 候補 a が b より短いか、同じ長さで辞書順で前か
+        const auto is_preferred = [&](const u64 a, const u64 b) {
+            auto moves_a = FixedFormula();
+            auto moves_b = FixedFormula();
+            const auto n_a = make_candidate(a, moves_a);
+            const auto n_b = make_candidate(b, moves_b);
+            if (n_a != n_b)
+                return n_a < n_b;
+            return lexicographical_compare(moves_a.begin(),
+                                           moves_a.begin() + n_a,
+                                           moves_b.begin(),
+                                           moves_b.begin() + n_b);
+        };
+
+        // 33 80 10 6 hits 2.79 * 10^9
+        // ハッシュが kMaxFingerprintBytes に収まらない場合は、
+        // ハッシュの値で n_passes 回に分けて処理する
+        using Entry = pair<Fingerprint, u64>;
+        const auto n_candidates = (u64)results.size() * n_variants;
+        const auto n_passes = (int)max<u64>(
+            1, (n_candidates * sizeof(Entry) + kMaxFingerprintBytes - 1) /
+                   kMaxFingerprintBytes);
+        const auto n_shards = (u64)n_passes * n_threads;
+        auto kept_candidates = vector<vector<u64>>(n_threads);
+        for (auto pass = 0; pass < n_passes; pass++) {
+            // 各スレッドが担当範囲のハッシュを計算し、シャードに振り分ける
+            auto entries = vector<vector<vector<Entry>>>(
+                n_threads, vector<vector<Entry>>(n_threads));
+            ParallelFor(n_candidates, [&](const int thread_id,
+                                          const u64 begin, const u64 end) {
+                auto moves = FixedFormula();
+                for (auto candidate = begin; candidate < end; candidate++) {
+                    // 実際に手筋を使って回転させる
+                    const auto n_moves = make_candidate(candidate, moves);
+                    auto tmp_globe = unit_globe;
+                    for (auto i = 0; i < n_moves; i++)
+                        tmp_globe.Rotate(moves[i]);
+                    // 変化が無いか多すぎるなら削除する
+                    auto n_changes = 0;
+                    for (auto i = 0; i < width * 2; i++)
+                        if (tmp_globe.facelets[i / width][i % width].data != i)
+                            n_changes++;
+                    if (n_changes == 0 || n_changes * n_moves > max_cost)
+                        continue;
+                    const auto fingerprint = tmp_globe.ComputeFingerprint();
+                    const auto shard = fingerprint[1] % n_shards;
+                    if (shard / n_threads != (u64)pass)
+                        continue;
+                    entries[thread_id][shard % n_threads].emplace_back(
+                        fingerprint, candidate);
+                }
+            });
+            // シャードごとにソートして、ハッシュごとに最良の候補だけを残す
+            ParallelFor(n_threads, [&](const int thread_id, const u64 begin,
+                                       const u64 end) {
+                for (auto shard = begin; shard < end; shard++) {
+                    auto shard_entries = vector<Entry>();
+                    for (auto&& thread_entries : entries) {
+                        shard_entries.insert(shard_entries.end(),
+                                             thread_entries[shard].begin(),
+                                             thread_entries[shard].end());
+                        vector<Entry>().swap(thread_entries[shard]);
+                    }
+                    sort(shard_entries.begin(), shard_entries.end());
+                    for (auto i = 0ull; i < shard_entries.size();) {
+                        auto best = shard_entries[i].second;
+                        auto j = i + 1;
+                        for (; j < shard_entries.size() &&
+                               shard_entries[j].first == shard_entries[i].first;
+                             j++)
+                            if (is_preferred(shard_entries[j].second, best))
+                                best = shard_entries[j].second;
+                        kept_candidates[thread_id].push_back(best);
+                        i = j;
+                    }
+                }
+            });
         }
-        results.resize(top);
 
-        if (do_sanity_check_after_augment)
-            for (const auto& formula : results) {
+        // 残った候補を UnitFormula にする
+        auto offsets = vector<u64>(n_threads + 1);
+        for (auto i = 0; i < n_threads; i++)
+            offsets[i + 1] = offsets[i] + kept_candidates[i].size();
+        auto new_results = vector<UnitFormula>(offsets[n_threads]);
+        ParallelFor(n_threads, [&](const int thread_id, const u64,
+                                   const u64) {
+            auto moves = FixedFormula();
+            for (auto i = 0ull; i < kept_candidates[thread_id].size(); i++) {
+                const auto n_moves =
+                    make_candidate(kept_candidates[thread_id][i], moves);
+                new_results[offsets[thread_id] + i] = UnitFormula(
+                    vector<UnitMove>(moves.begin(), moves.begin() + n_moves));
+            }
+        });
+        results = move(new_results);
+        SortResults();
+    }
+
+    // 同じ変化の手筋は短いほうだけを残す
+    // また、変化の多すぎる手筋も削除する
+    inline void RemoveDuplicates() {
+        AugmentAndRemoveDuplicates(
+            1, [](const UnitFormula& formula, const int, FixedFormula& moves) {
+                copy(formula.unit_moves.begin(), formula.unit_moves.end(),
+                     moves.begin());
+                return (int)formula.unit_moves.size();
+            });
+    }
+
+    // 水増し後の手筋を回転で挟んだものも残っているか確かめる
+    inline void CheckSanityAfterAugment() const {
+        auto found_permutations = vector<Fingerprint>(results.size());
+        ParallelFor(results.size(),
+                    [&](const int, const u64 begin, const u64 end) {
+                        for (auto i = begin; i < end; i++) {
+                            auto tmp_globe = unit_globe;
+                            tmp_globe.Rotate(results[i]);
+                            found_permutations[i] =
+                                tmp_globe.ComputeFingerprint();
+                        }
+                    });
+        sort(found_permutations.begin(), found_permutations.end());
+        ParallelFor(results.size(), [&](const int, const u64 begin,
+                                        const u64 end) {
+            for (auto i = begin; i < end; i++) {
+                const auto& formula = results[i];
                 auto tmp_globe = unit_globe;
                 tmp_globe.Rotate(UnitMove(UnitMove::Direction::R, 0));
                 tmp_globe.Rotate(UnitMove(UnitMove::Direction::R, 1));
                 tmp_globe.Rotate(formula);
                 tmp_globe.Rotate(UnitMove(UnitMove::Direction::Rp, 0));
                 tmp_globe.Rotate(UnitMove(UnitMove::Direction::Rp, 1));
-                if (!found_permutations.contains(tmp_globe)) {
+                if (!binary_search(found_permutations.begin(),
+                                   found_permutations.end(),
+                                   tmp_globe.ComputeFingerprint())) {
                     cout << "Sanity check failed." << endl;
                     cout << "formula: ";
                     formula.Print();
@@ -672,173 +962,76 @@ template <int width> struct GlobeFormulaSearcher {
                     abort();
                 }
             }
+        });
     }
 
+    // 左右反転、上下反転、Flip 箇所のずらしを全通り加えて重複を削除する
     inline void AugmentFirstFlipRotation() {
-        auto original_results_size = (int)results.size();
-        results.reserve(original_results_size * (4 * width));
-
-        // 左右の Augmentation
-        for (auto idx_results = 0; idx_results < original_results_size;
-             idx_results++) {
-            auto formula = results[idx_results];
-            for (auto&& unit_move : formula.unit_moves)
-                switch (unit_move.direction) {
-                case UnitMove::Direction::F:
-                    unit_move.depth = width - 1 - unit_move.depth;
-                    break;
-                case UnitMove::Direction::R:
-                    unit_move.direction = UnitMove::Direction::Rp;
-                    break;
-                case UnitMove::Direction::Rp:
-                    unit_move.direction = UnitMove::Direction::R;
-                    break;
-                }
-            results.push_back(formula);
-        }
-
-        // 上下の Augmentation
-        original_results_size = (int)results.size();
-        for (auto idx_results = 0; idx_results < original_results_size;
-             idx_results++) {
-            auto formula = results[idx_results];
-            for (auto&& unit_move : formula.unit_moves)
-                if (unit_move.direction != UnitMove::Direction::F)
-                    unit_move.depth = 1 - unit_move.depth;
-            results.push_back(formula);
-        }
-
-        // Flip 箇所の Augmentation
-        original_results_size = (int)results.size();
-        for (auto i = 1; i < width; i++) {
-            for (auto idx_results = 0; idx_results < original_results_size;
-                 idx_results++) {
-                auto formula = results[idx_results];
-                for (auto&& unit_move : formula.unit_moves)
+        AugmentAndRemoveDuplicates(
+            4 * width, [](const UnitFormula& formula, const int variant,
+                          FixedFormula& moves) {
+                const auto flip_lr = (variant & 1) != 0;
+                const auto flip_ud = (variant & 2) != 0;
+                const auto slide = variant >> 2;
+                const auto n_moves = (int)formula.unit_moves.size();
+                for (auto i = 0; i < n_moves; i++) {
+                    auto unit_move = formula.unit_moves[i];
+                    // 左右の Augmentation
+                    if (flip_lr)
+                        switch (unit_move.direction) {
+                        case UnitMove::Direction::F:
+                            unit_move.depth = width - 1 - unit_move.depth;
+                            break;
+                        case UnitMove::Direction::R:
+                            unit_move.direction = UnitMove::Direction::Rp;
+                            break;
+                        case UnitMove::Direction::Rp:
+                            unit_move.direction = UnitMove::Direction::R;
+                            break;
+                        }
+                    // 上下の Augmentation
+                    if (flip_ud &&
+                        unit_move.direction != UnitMove::Direction::F)
+                        unit_move.depth = 1 - unit_move.depth;
+                    // Flip 箇所の Augmentation
                     if (unit_move.direction == UnitMove::Direction::F)
-                        unit_move.depth = (unit_move.depth + i) % width;
-                results.push_back(formula);
-            }
-        }
+                        unit_move.depth = (unit_move.depth + slide) % width;
+                    moves[i] = unit_move;
+                }
+                return n_moves;
+            });
+        CheckSanityAfterAugment();
     }
 
+    // A と A' で挟んだものを加えて重複を削除する
     inline void AugmentConjugate() {
-        const auto original_results_size = (u64)results.size();
-        results.reserve(original_results_size * (width / 2 + 5));
-
-        constexpr bool removing_duplicates = false;
-        if constexpr (removing_duplicates) {
-            assert(unit_globe == UnitGlobe(width * 2));
-            vector<UnitMove> unit_moves_aug;
-            for (auto i = 0; i < width ; i++) {
-                unit_moves_aug.push_back(UnitMove(UnitMove::Direction::F, i));
-            }
-            unit_moves_aug.push_back(UnitMove(UnitMove::Direction::R, 0));
-            unit_moves_aug.push_back(UnitMove(UnitMove::Direction::R, 1));
-            unit_moves_aug.push_back(UnitMove(UnitMove::Direction::Rp, 0));
-            unit_moves_aug.push_back(UnitMove(UnitMove::Direction::Rp, 1));
-
-            auto found_permutations =
-                unordered_set<UnitGlobe, typename UnitGlobe::Hash>();
-            for (auto idx_results = 0; idx_results < original_results_size;
-                 idx_results++) {
-                const auto formula = results[idx_results];
-                // 実際に手筋を使って回転させる
-                auto tmp_globe_beforeaug = unit_globe;
-                tmp_globe_beforeaug.Rotate(formula);
-                found_permutations.insert(tmp_globe_beforeaug);
-
-                // A と A' で挟んで水増しする
-                // for (auto i = 0; i < width / 2; i++) {
-                for (auto const& move_aug : unit_moves_aug) {
-                    auto tmp_formula = results[idx_results];
-                    tmp_formula.unit_moves.insert(
-                        tmp_formula.unit_moves.begin(), move_aug);
-                    tmp_formula.unit_moves.push_back(move_aug.Inv());
-
-                    auto tmp_globe = unit_globe;
-                    tmp_globe.Rotate(tmp_formula);
-                    auto n_changes = 0;
-                    for (auto i = 0; i < width * 2; i++)
-                        if (tmp_globe.facelets[i / width][i % width].data != i)
-                            n_changes++;
-                    if (n_changes == 0 ||
-                        n_changes * (int)tmp_formula.unit_moves.size() >
-                            max_cost)
-                        continue;
-
-                    // auto tmp_globe_before = unit_globe;
-                    // auto tmp_globe = tmp_globe_beforeaug;
-                    // tmp_globe_before.Rotate(move_aug.Inv());
-                    // tmp_globe.Rotate(move_aug.Inv());
-
-                    // // 変化がないか多すぎるなら削除する
-                    // auto n_changes = 0;
-                    // for (auto i = 0; i < width * 2; i++)
-                    //     if (tmp_globe_before.facelets[i / width][i % width]
-                    //             .data !=
-                    //         tmp_globe.facelets[i / width][i % width].data)
-                    //         n_changes++;
-                    // if (n_changes == 0 ||
-                    //     n_changes * (2 + (int)tmp_formula.unit_moves.size())
-                    //     >
-                    //         max_cost)
-                    //     continue;
-                    // // 重複があるなら削除する
-                    // unordered_map<u8, u8> facelet_changes;
-                    // for (auto i = 0; i < width * 2; i++)
-                    //     if (tmp_globe_before.facelets[i / width][i % width]
-                    //             .data != i)
-                    //         facelet_changes[i] =
-                    //             tmp_globe_before.facelets[i / width][i %
-                    //             width]
-                    //                 .data;
-                    // for (auto i = 0; i < width * 2; i++)
-                    //     if (facelet_changes.contains(
-                    //             tmp_globe.facelets[i / width][i %
-                    //             width].data))
-                    //         tmp_globe.facelets[i / width][i % width]
-                    //             .data = facelet_changes
-                    //             [tmp_globe.facelets[i / width][i %
-                    //             width].data];
-
-                    const auto [it, inserted] =
-                        found_permutations.insert(tmp_globe);
-                    if (inserted) {
-                        // tmp_formula.unit_moves.insert(
-                        //     tmp_formula.unit_moves.begin(), move_aug);
-                        // tmp_formula.unit_moves.push_back(move_aug.Inv());
-                        results.push_back(tmp_formula);
-                    }
+        // 0 番目はそのまま、続く width / 2 個は Flip で挟み、
+        // 最後の 4 個は Rotation で挟む
+        static const auto rotations = array<UnitMove, 4>{
+            UnitMove(UnitMove::Direction::R, 0),
+            UnitMove(UnitMove::Direction::R, 1),
+            UnitMove(UnitMove::Direction::Rp, 0),
+            UnitMove(UnitMove::Direction::Rp, 1)};
+        AugmentAndRemoveDuplicates(
+            width / 2 + 5, [](const UnitFormula& formula, const int variant,
+                              FixedFormula& moves) {
+                const auto n_moves = (int)formula.unit_moves.size();
+                if (variant == 0) {
+                    copy(formula.unit_moves.begin(), formula.unit_moves.end(),
+                         moves.begin());
+                    return n_moves;
                 }
-            }
-        } else {
-            // Flip で挟む
-            // for (auto i = 0; i < width / 2; i++) {
-            for (auto i = 0; i < width / 2; i++) {
-                const auto mov = UnitMove(UnitMove::Direction::F, i);
-                for (u64 idx_results = 0; idx_results < original_results_size;
-                     idx_results++) {
-                    auto formula = results[idx_results];
-                    formula.unit_moves.insert(formula.unit_moves.begin(), mov);
-                    formula.unit_moves.push_back(mov);
-                    results.push_back(formula);
-                }
-            }
-            // Rotation で挟む
-            for (const auto mov : {UnitMove(UnitMove::Direction::R, 0),
-                                   UnitMove(UnitMove::Direction::R, 1),
-                                   UnitMove(UnitMove::Direction::Rp, 0),
-                                   UnitMove(UnitMove::Direction::Rp, 1)}) {
-                for (u64 idx_results = 0; idx_results < original_results_size;
-                     idx_results++) {
-                    auto formula = results[idx_results];
-                    formula.unit_moves.insert(formula.unit_moves.begin(), mov);
-                    formula.unit_moves.push_back(mov.Inv());
-                    results.push_back(formula);
-                }
-            }
-        }
+                const auto mov =
+                    variant <= width / 2
+                        ? UnitMove(UnitMove::Direction::F, variant - 1)
+                        : rotations[variant - width / 2 - 1];
+                moves[0] = mov;
+                copy(formula.unit_moves.begin(), formula.unit_moves.end(),
+                     moves.begin() + 1);
+                moves[n_moves + 1] = mov.Inv();
+                return n_moves + 2;
+            });
+        CheckSanityAfterAugment();
     }
 };
 
@@ -856,21 +1049,11 @@ template <int width> struct ActionCandidateGenerator {
     using Action = ::Action<width>;
     vector<Action> actions;
 
-    // ファイルから手筋を読み取る
-    // ファイルには f1.r1.-r0.f1 みたいなのが 1 行に 1 つ書かれている想定
+    // ファイルから手筋を読み取る (ReadUnitFormulaFile)
     inline ActionCandidateGenerator(const string& filename,
                                     const bool is_normal)
         : actions() {
-        auto ifs = ifstream(filename);
-        if (!ifs.good()) {
-            cout << "Failed to open " << filename << endl;
-            abort();
-        }
-        string line;
-        while (getline(ifs, line)) {
-            if (line.empty() || line[0] == '#')
-                continue;
-            const auto formula = UnitFormula(line);
+        for (const auto& formula : ReadUnitFormulaFile(filename)) {
             // 虹は偶数長の手筋だけ使う
             // 偶数長であれば状態の置換の偶奇が入れ替わらないため
             if (!is_normal && formula.unit_moves.size() % 2 != 0)
@@ -997,6 +1180,8 @@ template <int width> struct BeamSearchSolver {
     int step_size;
     ActionCandidateGenerator action_candidate_generator;
     vector<vector<shared_ptr<Node>>> nodes;
+    TimeBudget time_budget; // 制限時間 (デフォルトは無制限)
+    BeamRoundStats round_stats; // Solve() の層の数と時間 (呼ぶたびに足す)
 
     inline BeamSearchSolver(const int n_colors, const int beam_width,
                             const string& formula_filename,
@@ -1042,11 +1227,20 @@ template <int width> struct BeamSearchSolver {
 
         for (auto current_cost = 0; current_cost < 10000;
              current_cost += step_size) {
+            if (time_budget.IsOver()) {
+                cout << "Time over." << endl;
+                return nullptr;
+            }
             auto current_minimum_score = 9999;
+            const auto layer_start = time_budget.Elapsed();
+            auto layer_telemetry = LayerTelemetry(
+                "globe_layer", current_cost, nodes[current_cost].size());
             if (n_threads == 1) {
+                auto n_candidates = 0ull, n_accepted = 0ull;
                 for (const auto& node : nodes[current_cost]) {
                     current_minimum_score =
                         min(current_minimum_score, node->state.score);
+                    layer_telemetry.AddNode(node->state.score);
                     if (node->state.score == 0) {
                         cout << "Unit solved!" << endl;
                         timer.Print();
@@ -1059,25 +1253,31 @@ template <int width> struct BeamSearchSolver {
                                         node->state.correction);
                         if (new_state.n_moves <= current_cost)
                             continue;
+                        n_candidates++;
                         if (new_state.n_moves >= (int)nodes.size())
                             nodes.resize(new_state.n_moves + 1);
                         if ((int)nodes[new_state.n_moves].size() < beam_width) {
+                            n_accepted++;
                             nodes[new_state.n_moves].emplace_back(
                                 new Node(new_state, node, action));
                         } else {
                             const auto idx = rngs[0].Next() % beam_width;
                             if (new_state.score <
-                                nodes[new_state.n_moves][idx]->state.score)
+                                nodes[new_state.n_moves][idx]->state.score) {
+                                n_accepted++;
                                 nodes[new_state.n_moves][idx].reset(
                                     new Node(new_state, node, action));
+                            }
                         }
                     }
                 }
+                layer_telemetry.AddCandidates(n_candidates, n_accepted);
             } else {
                 vector<thread> threads;
                 for (const auto& node : nodes[current_cost]) {
                     current_minimum_score =
                         min(current_minimum_score, node->state.score);
+                    layer_telemetry.AddNode(node->state.score);
                     if (node->state.score <= num_wildcards) {
                         cout << "Unit solved!" << endl;
                         timer.Print();
@@ -1087,6 +1287,7 @@ template <int width> struct BeamSearchSolver {
                 for (int ith = 0; ith < n_threads; ++ith) {
                     thread th(
                         [&](int ii) {
+                            auto n_candidates = 0ull;
                             for (int k = ii; k < beam_width; k += n_threads) {
                                 for (const auto& action :
                                      action_candidate_generator.actions) {
@@ -1099,6 +1300,7 @@ template <int width> struct BeamSearchSolver {
                                             ->state.correction);
                                     if (new_state.n_moves <= current_cost)
                                         continue;
+                                    n_candidates++;
                                     const auto idx =
                                         rngs[ii].Next() % beam_width;
                                     if (new_state.score <
@@ -1111,12 +1313,15 @@ template <int width> struct BeamSearchSolver {
                                                          action));
                                 }
                             }
+                            layer_telemetry.AddCandidates(n_candidates);
                         },
                         ith);
                     threads.emplace_back(move(th));
                 }
                 for (auto& th : threads)
                     th.join();
+                // 層に入った候補は、スレッドごとの層をまとめるときに数える
+                auto n_accepted = 0ull;
                 for (int ith = 0; ith < n_threads; ++ith) {
                     for (int k = 0; k < beam_width; ++k) {
                         // for (int c = current_cost + 1; c <= current_cost
@@ -1124,15 +1329,28 @@ template <int width> struct BeamSearchSolver {
                         for (int c = current_cost + 1; c <= current_cost + 2;
                              ++c) {
                             if (nodes_thread[ith][c][k]->state.score <
-                                nodes[c][k]->state.score)
+                                nodes[c][k]->state.score) {
+                                n_accepted++;
                                 nodes[c][k] = nodes_thread[ith][c][k];
+                            }
                         }
                     }
                 }
+                layer_telemetry.AddAccepted(n_accepted);
             }
-            cout << format("current_cost: {}, current_minimum_score: {}",
-                           current_cost, current_minimum_score)
-                 << endl;
+            layer_telemetry.Emit(beam_width);
+            round_stats.AddLayer(time_budget.Elapsed() - layer_start);
+            // 並列なら層の配列をスレッドごとにも持つ
+            round_stats.bytes_per_beam_width =
+                n_threads == 1
+                    ? (double)round_stats.n_layers *
+                          (sizeof(shared_ptr<Node>) + sizeof(Node))
+                    : (double)nodes.size() * (n_threads + 1) *
+                          sizeof(shared_ptr<Node>);
+            if constexpr (kTelemetryLevel >= 1)
+                cout << format("current_cost: {}, current_minimum_score: {}",
+                               current_cost, current_minimum_score)
+                     << endl;
             if (!nodes[current_cost].empty() &&
                 current_minimum_score ==
                     minimum_scores[current_cost % minimum_scores.size()]) {
@@ -1172,18 +1390,16 @@ template <int width> struct BeamSearchSolver {
 
 template <int half_width>
 void SearchFormula(const int max_cost, const int max_depth,
-                   const int max_conjugate_depth) {
+                   const int max_conjugate_depth, const int n_threads) {
     constexpr auto width = half_width * 2;
-    const auto results = GlobeFormulaSearcher<width>().Search(
+    const auto results = GlobeFormulaSearcher<width>(n_threads).Search(
         max_cost, max_depth, max_conjugate_depth);
-    const auto output_filename =
-        format("out/globe_formula_{}_{}_{}_{}.txt", half_width, max_cost,
-               max_depth, max_conjugate_depth);
-    auto ofs = ofstream(output_filename);
-    for (const auto& formula : results) {
-        formula.Print(ofs);
-        ofs << "\n";
-    }
+    auto writer = UnitFormulaWriter(
+        format("out/globe_formula_{}_{}_{}_{}.bin", half_width, max_cost,
+               max_depth, max_conjugate_depth));
+    for (const auto& formula : results)
+        writer.Write(formula);
+    writer.Close();
 }
 
 // max_cost が 56 の場合、変化する箇所が
@@ -1198,28 +1414,36 @@ void SearchFormula(const int max_cost, const int max_depth,
 [[maybe_unused]] static void SearchFormula(const int half_width,
                                            const int max_cost = 56,
                                            const int max_depth = 10,
-                                           const int max_conjugate_depth = 4) {
+                                           const int max_conjugate_depth = 4,
+                                           const int n_threads = 1) {
     switch (half_width) {
     case 4:
-        SearchFormula<4>(max_cost, max_depth, max_conjugate_depth);
+        SearchFormula<4>(max_cost, max_depth, max_conjugate_depth,
+                         n_threads);
         break;
     case 6:
-        SearchFormula<6>(max_cost, max_depth, max_conjugate_depth);
+        SearchFormula<6>(max_cost, max_depth, max_conjugate_depth,
+                         n_threads);
         break;
     case 8:
-        SearchFormula<8>(max_cost, max_depth, max_conjugate_depth);
+        SearchFormula<8>(max_cost, max_depth, max_conjugate_depth,
+                         n_threads);
         break;
     case 10:
-        SearchFormula<10>(max_cost, max_depth, max_conjugate_depth);
+        SearchFormula<10>(max_cost, max_depth, max_conjugate_depth,
+                          n_threads);
         break;
     case 16:
-        SearchFormula<16>(max_cost, max_depth, max_conjugate_depth);
+        SearchFormula<16>(max_cost, max_depth, max_conjugate_depth,
+                          n_threads);
         break;
     case 25:
-        SearchFormula<25>(max_cost, max_depth, max_conjugate_depth);
+        SearchFormula<25>(max_cost, max_depth, max_conjugate_depth,
+                          n_threads);
         break;
     case 33:
-        SearchFormula<33>(max_cost, max_depth, max_conjugate_depth);
+        SearchFormula<33>(max_cost, max_depth, max_conjugate_depth,
+                          n_threads);
         break;
     default:
         cout << "half_width must be 4, 6, 8, 10, 16, 25, 33" << endl;
@@ -1494,10 +1718,13 @@ vector<Move> MergeResultMoves(vector<Move> const& result_moves1,
     return merged_moves;
 }
 
+// 解けたら true を返す
 template <int n, int m>
-void Solve(const Problem& problem, const int beam_width = 2,
+bool Solve(const Problem& problem, const int beam_width = 2,
            const int max_cost = 56, const int max_depth = 10,
-           const int max_conjugate_depth = 4, const int n_threads = 1) {
+           const int max_conjugate_depth = 4, const int n_threads = 1,
+           const TimeBudget& time_budget = TimeBudget(),
+           BeamRoundStats* const round_stats = nullptr) {
     const auto formula_file = format("out/globe_formula_{}_{}_{}_{}.txt", m,
                                      max_cost, max_depth, max_conjugate_depth);
     constexpr auto height = n + 1;
@@ -1563,6 +1790,7 @@ void Solve(const Problem& problem, const int beam_width = 2,
     // auto n_pre_rotations = (int)result_moves.size();
     auto solver = BeamSearchSolver<width>(n_colors, beam_width, formula_file,
                                           problem.is_normal, n_threads);
+    solver.time_budget = time_budget;
     auto result_moves_by_unit = vector<vector<Move>>(globe.units.size());
     for (auto unit_id = 0; unit_id < (int)globe.units.size(); unit_id++) {
         cout << format("Solving unit {}/{}...", unit_id + 1,
@@ -1574,6 +1802,8 @@ void Solve(const Problem& problem, const int beam_width = 2,
             num_wildcards_used += 2;
         const auto node =
             solver.Solve(globe.units[unit_id], num_wildcards_used);
+        if (node == nullptr) // 失敗
+            return false;
 
         // 結果を復元する
         for (auto p = node; p->parent != nullptr; p = p->parent) {
@@ -1666,47 +1896,81 @@ void Solve(const Problem& problem, const int beam_width = 2,
         } else
             cout << "Failed to open " << best_solution_file << endl;
     }
+    if (round_stats != nullptr)
+        *round_stats = solver.round_stats;
+    return true;
 }
 
 [[maybe_unused]] static void
 Solve(const int problem_id, const int beam_width = 2, const int max_cost = 56,
       const int max_depth = 10, const int max_conjugate_depth = 4,
-      const int n_threads = 1) {
+      const int n_threads = 1, const TimeBudget& time_budget = TimeBudget()) {
     const auto filename_puzzles = "../input/puzzles.csv";
     const auto filename_sample = "../input/sample_submission.csv";
     const auto problem =
         ReadKaggleInput(filename_puzzles, filename_sample, problem_id);
-    if (problem.n == 1 && problem.m == 8)
-        Solve<1, 8>(problem, beam_width, max_cost, max_depth,
-                    max_conjugate_depth, n_threads);
-    else if (problem.n == 1 && problem.m == 16)
-        Solve<1, 16>(problem, beam_width, max_cost, max_depth,
-                     max_conjugate_depth, n_threads);
-    else if (problem.n == 2 && problem.m == 6)
-        Solve<2, 6>(problem, beam_width, max_cost, max_depth,
-                    max_conjugate_depth, n_threads);
-    else if (problem.n == 3 && problem.m == 4)
-        Solve<3, 4>(problem, beam_width, max_cost, max_depth,
-                    max_conjugate_depth, n_threads);
-    else if (problem.n == 6 && problem.m == 4)
-        Solve<6, 4>(problem, beam_width, max_cost, max_depth,
-                    max_conjugate_depth, n_threads);
-    else if (problem.n == 6 && problem.m == 8)
-        Solve<6, 8>(problem, beam_width, max_cost, max_depth,
-                    max_conjugate_depth, n_threads);
-    else if (problem.n == 6 && problem.m == 10)
-        Solve<6, 10>(problem, beam_width, max_cost, max_depth,
-                     max_conjugate_depth, n_threads);
-    else if (problem.n == 3 && problem.m == 33)
-        Solve<3, 33>(problem, beam_width, max_cost, max_depth,
-                     max_conjugate_depth, n_threads);
-    else if (problem.n == 8 && problem.m == 25)
-        Solve<8, 25>(problem, beam_width, max_cost, max_depth,
-                     max_conjugate_depth, n_threads);
-    else {
+    // 直前の solve() の層の数と時間
+    auto round_stats = BeamRoundStats();
+    const auto solve = [&](const int run_beam_width) {
+        if (problem.n == 1 && problem.m == 8)
+            return Solve<1, 8>(problem, run_beam_width, max_cost, max_depth,
+                               max_conjugate_depth, n_threads, time_budget,
+                               &round_stats);
+        else if (problem.n == 1 && problem.m == 16)
+            return Solve<1, 16>(problem, run_beam_width, max_cost, max_depth,
+                                max_conjugate_depth, n_threads, time_budget,
+                                &round_stats);
+        else if (problem.n == 2 && problem.m == 6)
+            return Solve<2, 6>(problem, run_beam_width, max_cost, max_depth,
+                               max_conjugate_depth, n_threads, time_budget,
+                               &round_stats);
+        else if (problem.n == 3 && problem.m == 4)
+            return Solve<3, 4>(problem, run_beam_width, max_cost, max_depth,
+                               max_conjugate_depth, n_threads, time_budget,
+                               &round_stats);
+        else if (problem.n == 6 && problem.m == 4)
+            return Solve<6, 4>(problem, run_beam_width, max_cost, max_depth,
+                               max_conjugate_depth, n_threads, time_budget,
+                               &round_stats);
+        else if (problem.n == 6 && problem.m == 8)
+            return Solve<6, 8>(problem, run_beam_width, max_cost, max_depth,
+                               max_conjugate_depth, n_threads, time_budget,
+                               &round_stats);
+        else if (problem.n == 6 && problem.m == 10)
+            return Solve<6, 10>(problem, run_beam_width, max_cost, max_depth,
+                                max_conjugate_depth, n_threads, time_budget,
+                                &round_stats);
+        else if (problem.n == 3 && problem.m == 33)
+            return Solve<3, 33>(problem, run_beam_width, max_cost, max_depth,
+                                max_conjugate_depth, n_threads, time_budget,
+                                &round_stats);
+        else if (problem.n == 8 && problem.m == 25)
+            return Solve<8, 25>(problem, run_beam_width, max_cost, max_depth,
+                                max_conjugate_depth, n_threads, time_budget,
+                                &round_stats);
         cout << format("n = {}, m = {} is not supported", problem.n, problem.m)
              << endl;
         abort();
+    };
+
+    // 時間制限があれば、残り時間に収まるビーム幅で解き直し続ける
+    // 解はその都度保存される
+    auto current_beam_width = beam_width;
+    while (true) {
+        const auto run_start = time_budget.Elapsed();
+        if (!solve(current_beam_width) || !time_budget.Enabled())
+            return;
+        auto next_beam_width =
+            time_budget.FitBeamWidth(current_beam_width,
+                                     time_budget.Elapsed() - run_start,
+                                     round_stats);
+        next_beam_width -= next_beam_width % n_threads;
+        if (next_beam_width <= current_beam_width) {
+            cout << "No time left for a wider beam." << endl;
+            return;
+        }
+        current_beam_width = next_beam_width;
+        cout << format("beam_width={}", current_beam_width) << endl;
     }
 }
 
@@ -1732,9 +1996,25 @@ int main(const int argc, const char* const* const argv) {
         SearchFormula(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]),
                       atoi(argv[4]));
         break;
+    case 6:
+        // GlobeFormulaSearcher は 1 以上を前提にしている
+        if (atoi(argv[5]) < 1) {
+            cout << format("n_threads must be at least 1, but got `{}`.",
+                           argv[5])
+                 << endl;
+            cout << "Usage: " << argv[0]
+                 << " half_width [max_cost] [max_depth] "
+                    "[max_conjugate_depth] [n_threads]"
+                 << endl;
+            return 1;
+        }
+        SearchFormula(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]),
+                      atoi(argv[4]), atoi(argv[5]));
+        break;
     default:
         cout << "Usage: " << argv[0]
-             << " half_width [max_cost] [max_depth] [max_conjugate_depth]"
+             << " half_width [max_cost] [max_depth] [max_conjugate_depth] "
+                "[n_threads]"
              << endl;
     }
 }
@@ -1748,38 +2028,43 @@ int main() { TestReadKaggleInput(); }
 // clang++ -std=c++20 -Wall -Wextra -O3 globe.cpp -DSOLVE
 #ifdef SOLVE
 int main(const int argc, const char* const* const argv) {
-    if (argc < 2) {
+    // --time-budget <秒> を付けると、時間いっぱいビーム幅を広げて解き直す
+    auto args = vector<const char*>(argv, argv + argc);
+    const auto time_budget = TimeBudget::FromArgs(args);
+    if (args.size() < 2) {
         cout << "Usage: " << argv[0]
              << " problem_id [beam_width] [max_cost] [max_depth] "
-                "[max_conjugate_depth] [n_threads]"
+                "[max_conjugate_depth] [n_threads] [--time-budget sec]"
              << endl;
         return 1;
     }
-    switch (argc) {
+    switch (args.size()) {
     case 2:
-        Solve(atoi(argv[1]));
+        Solve(atoi(args[1]), 2, 56, 10, 4, 1, time_budget);
         break;
     case 3:
-        Solve(atoi(argv[1]), atoi(argv[2]));
+        Solve(atoi(args[1]), atoi(args[2]), 56, 10, 4, 1, time_budget);
         break;
     case 4:
-        Solve(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+        Solve(atoi(args[1]), atoi(args[2]), atoi(args[3]), 10, 4, 1,
+              time_budget);
         break;
     case 5:
-        Solve(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+        Solve(atoi(args[1]), atoi(args[2]), atoi(args[3]), atoi(args[4]), 4, 1,
+              time_budget);
         break;
     case 6:
-        Solve(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]), atoi(argv[4]),
-              atoi(argv[5]));
+        Solve(atoi(args[1]), atoi(args[2]), atoi(args[3]), atoi(args[4]),
+              atoi(args[5]), 1, time_budget);
         break;
     case 7:
-        Solve(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]), atoi(argv[4]),
-              atoi(argv[5]), atoi(argv[6]));
+        Solve(atoi(args[1]), atoi(args[2]), atoi(args[3]), atoi(args[4]),
+              atoi(args[5]), atoi(args[6]), time_budget);
         break;
     default:
         cout << "Usage: " << argv[0]
              << " problem_id [beam_width] [max_cost] [max_depth] "
-                "[max_conjugate_depth] [n_threads]"
+                "[max_conjugate_depth] [n_threads] [--time-budget sec]"
              << endl;
     }
 }
@@ -1,18 +1,20 @@
-mkdir bin log log/kaggle solution_face
+mkdir bin log log/kaggle solution_face checkpoint
 
 make clean
 make all -j
 
 
-./bin/face_formula 4 7 &
-./bin/face_formula 4 8 &
-./bin/face_formula 5 7 &
-./bin/face_formula 5 8 &
-./bin/face_formula 6 7 &
-./bin/face_formula 6 8 &
-./bin/face_formula 7 7 &
-./bin/face_formula 7 8 &
-./bin/face_formula 8 7 &
-./bin/face_formula 8 8 &
-./bin/face_formula 9 7 &
-./bin/face_formula 9 8 
\ No newline at end of file
+# 1 つずつ全てのコアを使って探索する
+# 深さ 8 は深さ 7 の途中経過 (--save-state) の続きから探索する
+./bin/face_formula 4 7 --save-state
+./bin/face_formula 4 8
+./bin/face_formula 5 7 --save-state
+./bin/face_formula 5 8
+./bin/face_formula 6 7 --save-state
+./bin/face_formula 6 8
+./bin/face_formula 7 7 --save-state
+./bin/face_formula 7 8
+./bin/face_formula 8 7 --save-state
+./bin/face_formula 8 8
+./bin/face_formula 9 7 --save-state
+./bin/face_formula 9 8
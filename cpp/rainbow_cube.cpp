@@ -2,6 +2,7 @@
 
 using std::fill;
 using std::min;
+using std::move;
 
 using RainbowAction = Formula;
 
@@ -57,71 +58,45 @@ template <int order> struct RainbowActionCandidateGenerator {
     using RainbowCube = ::RainbowCube<order>;
     using RainbowState = ::RainbowState<order>;
     vector<RainbowAction> actions;
+    MoveTrie trie; // actions を手順の木にしたもの
 
     // ファイルから手筋を読み取る
     // ファイルには f1.d0.-r0.-f1 みたいなのが 1 行に 1 つ書かれている想定
-    inline void FromFile(const string& filename, const bool is_normal) {
+    inline void FromFile(const string& filename, const bool /*is_normal*/) {
         const int OrderFormula = 4;
         vector<RainbowAction> actions_original;
 
         // ファイルから読み取る
-        auto ifs = ifstream(filename);
-        if (!ifs.good()) {
-            cerr << format("Cannot open file `{}`.", filename) << endl;
-            abort();
-        }
-        string line;
-        while (getline(ifs, line)) {
-            if (line.empty() || line[0] == '#')
-                continue;
-            if (!is_normal && line[0] == '0')
-                continue;
-            actions_original.emplace_back(line.substr(0));
-        }
-
-        vector<Cube<OrderFormula, ColorType24>> cubes;
-
+        // 虹で使えるかどうかの列は無いので、is_normal は使わない
+        for (const auto& [prefix, formula] :
+             ReadFormulaFile<OrderFormula>(filename))
+            actions_original.emplace_back(formula);
+
+        // 全体を回転したもの (24 通り) を加える
+        // 中央のマスへの作用が同じものは、最も短いものだけ残す
+        const auto symmetry = FormulaSymmetry<OrderFormula>();
+        auto keys = vector<string>();
+        auto costs = vector<int>();
         for (auto& action_original : actions_original) {
-            for (int x_rot = 0; x_rot < 4; x_rot++) {
-                for (int y_rot = 0; y_rot < 4; y_rot++) {
-                    for (int x_rot2 = 0; x_rot2 < 4; x_rot2++) {
-                        for (int flag_inv = 0; flag_inv < 1; flag_inv++) {
-                            RainbowAction action;
-                            for (auto mov : action_original.moves) {
-                                mov = mov.RotateX(OrderFormula, x_rot);
-                                mov = mov.RotateY(OrderFormula, y_rot);
-                                mov = mov.RotateX(OrderFormula, x_rot2);
-                                action.moves.emplace_back(mov);
-                            }
-
-                            if (flag_inv)
-                                action = action.Inv();
-
-                            Cube<OrderFormula, ColorType24> cube;
-                            cube.Reset();
-                            // cube.Display(cerr);
-                            // cerr << endl;
-                            cube.Rotate(action);
-
-                            bool flag_new = true;
-                            for (auto& cube2 : cubes) {
-                                if (cube.ComputeFaceDiff(cube2) == 0) {
-                                    flag_new = false;
-                                    break;
-                                }
-                            }
-                            if (!flag_new)
-                                continue;
-
-                            // cube.Display(cerr);
-                            // cerr << endl;
-                            actions.emplace_back(action);
-                            cubes.emplace_back(cube);
-                        }
-                    }
-                }
+            for (const auto& sym : symmetry.symmetries) {
+                if (sym.mirror || sym.inverse)
+                    continue;
+                actions.emplace_back(
+                    symmetry.Apply(action_original.moves, sym));
+                keys.push_back(
+                    FormulaSymmetry<OrderFormula>::ComputePermutationKey(
+                        actions.back().moves, true));
+                costs.push_back(actions.back().Cost());
             }
         }
+        const auto indices = SelectCheapestPerKey(keys, costs);
+        cerr << format("Removed {} of {} actions with the same permutation.",
+                       actions.size() - indices.size(), actions.size())
+             << endl;
+        for (auto i = 0; i < (int)indices.size(); i++)
+            if (indices[i] != i)
+                actions[i] = move(actions[indices[i]]);
+        actions.resize(indices.size());
 
         for (auto& action : actions) {
             for (auto& mov : action.moves) {
@@ -130,7 +105,13 @@ template <int order> struct RainbowActionCandidateGenerator {
             }
         }
 
-        // TODO: 重複があるかもしれないので確認した方が良い
+        trie.Build(actions);
+        auto n_moves_total = 0;
+        for (const auto& action : actions)
+            n_moves_total += action.Cost();
+        cerr << format("actions={} moves={} trie_rotations={}",
+                       actions.size(), n_moves_total, trie.NRotations())
+             << endl;
     }
 
     inline const auto& Generate(const RainbowState&) const { return actions; }
@@ -190,23 +171,35 @@ template <int order> struct RainbowBeamSearchSolver {
                     cerr << "Solved!" << endl;
                     return node;
                 }
-                for (const auto& action :
-                     action_candidate_generator.Generate(node->state)) {
-                    auto new_state = node->state;
-                    new_state.Apply(action, target_cube);
-                    if (new_state.n_moves >= (int)nodes.size())
-                        nodes.resize(new_state.n_moves + 1);
-                    if ((int)nodes[new_state.n_moves].size() < beam_width) {
-                        nodes[new_state.n_moves].emplace_back(
-                            new RainbowNode(new_state, node, action));
+                // 共通の接頭辞を持つ手筋はまとめて回す
+                const auto& actions =
+                    action_candidate_generator.Generate(node->state);
+                auto cube = node->state.cube;
+                const auto expand = [&](const int action_id,
+                                        const RainbowCube& applied_cube) {
+                    const auto& action = actions[action_id];
+                    const auto new_score =
+                        applied_cube.ComputeScore(target_cube);
+                    const auto new_n_moves =
+                        node->state.n_moves + action.Cost();
+                    const auto new_node = [&] {
+                        auto new_state = node->state;
+                        new_state.cube = applied_cube;
+                        new_state.score = new_score;
+                        new_state.n_moves = new_n_moves;
+                        return new RainbowNode(new_state, node, action);
+                    };
+                    if (new_n_moves >= (int)nodes.size())
+                        nodes.resize(new_n_moves + 1);
+                    if ((int)nodes[new_n_moves].size() < beam_width) {
+                        nodes[new_n_moves].emplace_back(new_node());
                     } else {
                         const auto idx = rng.Next() % beam_width;
-                        if (new_state.score <
-                            nodes[new_state.n_moves][idx]->state.score)
-                            nodes[new_state.n_moves][idx].reset(
-                                new RainbowNode(new_state, node, action));
+                        if (new_score < nodes[new_n_moves][idx]->state.score)
+                            nodes[new_n_moves][idx].reset(new_node());
                     }
-                }
+                };
+                action_candidate_generator.trie.Dfs(cube, expand);
             }
 
             cout << format("current_cost={} current_minimum_score={}",
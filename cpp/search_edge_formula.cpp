@@ -1,5 +1,12 @@
 #include "cube.cpp"
 
+#include <algorithm>
+#include <thread>
+
+using std::find;
+using std::move;
+using std::thread;
+
 template <int order> struct EdgeFormulaSearcher {
     static constexpr auto kMaxNInnerRotations = 3;
 
@@ -8,18 +15,128 @@ template <int order> struct EdgeFormulaSearcher {
     Cube start_cube;
 
     EdgeFormulaSearcher(const int max_depth)
-        : max_depth(max_depth), start_cube(), results(), depth(), cube(),
-          move_history(), inner_rotation_counts() {
+        : max_depth(max_depth), start_cube(), results(), usable_for_rainbow(),
+          frontier(), resumed_root_depth(-1), resumed_max_depth(-1), depth(),
+          cube(), move_history(), inner_rotation_counts(), split_depth(-1),
+          subtrees() {
         start_cube.Reset();
     }
 
-    auto Search() {
-        results.clear();
+    // 探索して、見つかった手筋をそのまま results に入れる
+    void Search(const int n_threads = 1) {
+        ClearResults();
         cube = start_cube;
-        Dfs();
+        if (n_threads <= 1)
+            Dfs();
+        else
+            ParallelDfs(*this, n_threads);
+    }
+
+    // max_depth が previous_max_depth の探索で Save() したものの続きから
+    // 探索する (search_face_formula.cpp の Resume() と同じ)
+    // 結果は max_depth で始めから Search() したものと同じ手筋が同じ順番に並ぶ
+    // ファイルが無ければ false を返す
+    bool Resume(const string& results_filename,
+                const string& frontier_filename, const int previous_max_depth,
+                const int n_threads = 1) {
+        auto results_ifs = ifstream(results_filename, ios::binary);
+        auto frontier_ifs = ifstream(frontier_filename, ios::binary);
+        if (!results_ifs.good() || !frontier_ifs.good())
+            return false;
+        ClearResults();
+        auto reduced = false;
+        const auto read_results = ReadFormulaBinaryFile(
+            results_ifs, 1, reduced,
+            [this](const string& prefix, const vector<Move>& moves) {
+                results.Add(moves);
+                usable_for_rainbow.push_back(prefix[0] == '1');
+            });
+        auto old_frontier = PackedFormulas();
+        const auto read_frontier = ReadFormulaBinaryFile(
+            frontier_ifs, 0, reduced,
+            [&old_frontier](const string&, const vector<Move>& moves) {
+                old_frontier.Add(moves);
+            });
+        if (!read_results || !read_frontier) {
+            cerr << format("Broken state `{}`.", frontier_filename) << endl;
+            abort();
+        }
+        // frontier のノードを根とする部分木を探索する
+        for (auto i = 0; i < old_frontier.Size(); i++) {
+            const auto moves = old_frontier.Get(i);
+            auto subtree = Subtree();
+            subtree.depth = (int)moves.size();
+            copy(moves.begin(), moves.end(), subtree.move_history.begin());
+            subtree.inner_rotation_counts = InnerRotationCounts();
+            for (const auto& mov : moves)
+                if (!mov.IsFaceRotation<order>())
+                    subtree.inner_rotation_counts.Add(mov);
+            subtree.resumed_max_depth = previous_max_depth;
+            subtree.results_position = results.Size();
+            subtree.frontier_position = frontier.Size();
+            subtrees.push_back(move(subtree));
+        }
+        cout << format("Resuming from {} formulas and {} subtrees in `{}`.",
+                       results.Size(), subtrees.size(), frontier_filename)
+             << endl;
+        SearchSubtreesInParallel(*this, n_threads);
+        // 始めから Search() したときと同じ順番に並べ直す
+        Select(ComputeSearchOrder<order>(results));
+        frontier.Select(ComputeSearchOrder<order>(frontier));
+        return true;
+    }
+
+    // 見つかった手筋と frontier を書き出す
+    // 手筋の先頭の 1 文字は虹で使えるかどうか
+    void Save(const string& results_filename,
+              const string& frontier_filename) const {
+        auto results_writer = FormulaWriter(results_filename, false, 1);
+        for (auto i = 0; i < results.Size(); i++)
+            results_writer.Write(results.Get(i),
+                                 usable_for_rainbow[i] ? "1" : "0");
+        auto frontier_writer = FormulaWriter(frontier_filename, false);
+        for (auto i = 0; i < frontier.Size(); i++)
+            frontier_writer.Write(frontier.Get(i));
+    }
+
+    // 重複を除いた手筋を返す
+    auto Reduce(const int n_threads = 1) {
+        ReduceByPermutation(n_threads);
+        ReduceBySymmetry();
         return results;
     }
 
+    // 盤面への作用が同じものは、最も短いもの (同じ長さなら先に見つかった
+    // もの) だけ残す
+    // 虹で使えるかどうかは作用で決まる
+    void ReduceByPermutation(const int n_threads) {
+        Select(SelectCheapestPerPermutation(
+            results, n_threads, [](const vector<Move>& moves) {
+                return FormulaSymmetry<order>::ComputePermutationKey(moves);
+            }));
+    }
+
+    // 対称なもの (FormulaSymmetry) は最初の 1 つだけ残す
+    // 虹で使えるかどうかは対称なもの同士で同じ
+    void ReduceBySymmetry() {
+        const auto symmetry = FormulaSymmetry<order>();
+        auto seen = unordered_set<string>();
+        auto indices = vector<int>();
+        for (auto j = 0; j < results.Size(); j++)
+            if (seen.insert(symmetry.ComputeKey(results.Get(j))).second)
+                indices.push_back(j);
+        Select(indices);
+    }
+
+    // indices の手筋だけを、indices の順に残す
+    void Select(const vector<int>& indices) {
+        results.Select(indices);
+        auto selected_usable_for_rainbow = vector<bool>(indices.size());
+        for (auto j = 0; j < (int)indices.size(); j++)
+            selected_usable_for_rainbow[j] = usable_for_rainbow[indices[j]];
+        usable_for_rainbow = move(selected_usable_for_rainbow);
+    }
+
     struct InnerRotationCounts {
         array<array<i8, order>, 3> counts; // (axis, depth) -> count
         int distance_from_all_zero;
@@ -42,17 +159,70 @@ template <int order> struct EdgeFormulaSearcher {
         }
     };
 
-    struct Result {
-        bool can_use_for_rainbow_cube;
-        Formula formula;
-    };
-
-    vector<Result> results;
+    PackedFormulas results;
+    vector<bool> usable_for_rainbow; // results と同じ順
+    // max_depth が足りずに探索しなかった子を持つノード
+    // max_depth を大きくしたときは、ここから探索を再開すれば良い
+    PackedFormulas frontier;
+    // Resume() で再開した部分木の根の深さと、前回の max_depth
+    // 根では前回探索しなかった子だけを探索する (LoadSubtree() で設定する)
+    int resumed_root_depth;
+    int resumed_max_depth;
     int depth;
     Cube cube;
     array<Move, 12> move_history;
     InnerRotationCounts inner_rotation_counts;
 
+    // ParallelDfs() で分けた部分木
+    // cube は move_history から作り直す
+    struct Subtree {
+        int depth;
+        array<Move, 12> move_history;
+        InnerRotationCounts inner_rotation_counts;
+        int resumed_max_depth; // Resume() で再開した部分木でなければ -1
+        int results_position; // 部分木の結果は results のこの位置に入る
+        int frontier_position; // 部分木の frontier は frontier のこの位置
+        PackedFormulas results;
+        vector<bool> usable_for_rainbow;
+        PackedFormulas frontier;
+    };
+    int split_depth; // Dfs() はこの深さに来たら部分木を記録して戻る
+    vector<Subtree> subtrees;
+
+    void ClearResults() {
+        results.Clear();
+        usable_for_rainbow.clear();
+        frontier.Clear();
+    }
+
+    void LoadSubtree(const Subtree& subtree) {
+        depth = subtree.depth;
+        move_history = subtree.move_history;
+        inner_rotation_counts = subtree.inner_rotation_counts;
+        cube = start_cube;
+        for (auto d = 0; d < subtree.depth; d++)
+            cube.Rotate(subtree.move_history[d]);
+        resumed_root_depth =
+            subtree.resumed_max_depth >= 0 ? subtree.depth : -1;
+        resumed_max_depth = subtree.resumed_max_depth;
+    }
+
+    void StoreSubtree(Subtree& subtree) {
+        subtree.results = move(results);
+        subtree.usable_for_rainbow = move(usable_for_rainbow);
+        subtree.frontier = move(frontier);
+    }
+
+    void MergeSubtrees() {
+        SpliceSubtreeResults(results, subtrees, &Subtree::results_position,
+                             &Subtree::results);
+        SpliceSubtreeResults(usable_for_rainbow, subtrees,
+                             &Subtree::results_position,
+                             &Subtree::usable_for_rainbow);
+        SpliceSubtreeResults(frontier, subtrees, &Subtree::frontier_position,
+                             &Subtree::frontier);
+    }
+
     // 有効な手筋かチェックする
     // 虹でも使えるなら 2
     // 通常だけなら 1
@@ -108,13 +278,16 @@ template <int order> struct EdgeFormulaSearcher {
         return can_use_for_rainbow_cube ? 2 : 1;
     }
     void Dfs() {
+        if (depth == split_depth) {
+            subtrees.push_back({depth, move_history, inner_rotation_counts, -1,
+                                results.Size(), frontier.Size(), {}, {}, {}});
+            return;
+        }
+        // Resume() で再開した部分木の根は、前回の探索で既に調べている
+        const auto is_resumed_root = depth == resumed_root_depth;
         // 方針: ややこしすぎるので後で回転とか言わず全部列挙する
-        const auto valid = CheckValid();
+        const auto valid = is_resumed_root ? 0 : CheckValid();
         if (valid >= 1) {
-            const auto moves = vector<Move>(move_history.begin(),
-                                            move_history.begin() + depth);
-            auto facelet_changes_array =
-                array<Formula::FaceletChange, (Cube::order - 2) * 24>();
             auto n_facelet_changes = 0;
             for (auto face_id = 0; face_id < 6; face_id++) {
                 for (const auto y : {0, Cube::order - 1})
@@ -124,9 +297,7 @@ template <int order> struct EdgeFormulaSearcher {
                         const auto color = cube.Get(pos);
                         const auto original_pos =
                             Cube::ComputeOriginalFaceletPosition(y, x, color);
-                        if (pos != original_pos)
-                            facelet_changes_array[n_facelet_changes++] = {
-                                original_pos, pos};
+                        n_facelet_changes += pos != original_pos;
                     }
                 for (const auto x : {0, Cube::order - 1})
                     for (auto y = 1; y < Cube::order - 1; y++) {
@@ -135,21 +306,18 @@ template <int order> struct EdgeFormulaSearcher {
                         const auto color = cube.Get(pos);
                         const auto original_pos =
                             Cube::ComputeOriginalFaceletPosition(y, x, color);
-                        if (pos != original_pos)
-                            facelet_changes_array[n_facelet_changes++] = {
-                                original_pos, pos};
+                        n_facelet_changes += pos != original_pos;
                     }
             }
             if (n_facelet_changes != 0) {
-                // cout << n_facelet_changes << endl;
-                const auto facelet_changes = vector<Formula::FaceletChange>(
-                    facelet_changes_array.begin(),
-                    facelet_changes_array.begin() + n_facelet_changes);
-                results.push_back({valid == 2, {moves, facelet_changes}});
+                results.Add(move_history.data(), depth);
+                usable_for_rainbow.push_back(valid == 2);
             }
         }
         if (depth == max_depth) {
             assert(inner_rotation_counts.distance_from_all_zero == 0);
+            // 子は全て max_depth が足りない
+            frontier.Add(move_history.data(), depth);
             return;
         }
 
@@ -183,9 +351,33 @@ template <int order> struct EdgeFormulaSearcher {
                 return false; // 負の向きの回転が 2 回連続してはいけない
         };
 
+        // 子を探索するのに必要な max_depth
+        // max_depth をいくら大きくしても探索しないものは kUnreachable
+        constexpr auto kUnreachable = 1 << 30;
+        const auto distance = inner_rotation_counts.distance_from_all_zero;
+        const auto face_required_depth =
+            depth != 0 ? distance + depth + 1 : kUnreachable;
+        const auto increase_required_depth =
+            distance < kMaxNInnerRotations ? distance + depth + 2
+                                           : kUnreachable;
+        const auto decrease_required_depth =
+            depth >= 2 && distance >= 1 ? distance + depth : kUnreachable;
+        // max_depth が足りない子があれば frontier に入れる
+        for (const auto required_depth :
+             {face_required_depth, increase_required_depth,
+              decrease_required_depth})
+            if (max_depth < required_depth && required_depth != kUnreachable) {
+                frontier.Add(move_history.data(), depth);
+                break;
+            }
+        // 再開した根では、前回 max_depth が足りなかった子だけを探索する
+        const auto can_search = [this, is_resumed_root](const int required) {
+            return required <= max_depth &&
+                   (!is_resumed_root || required > resumed_max_depth);
+        };
+
         // 面の回転 (初手以外)
-        if (depth != 0 &&
-            inner_rotation_counts.distance_from_all_zero < max_depth - depth) {
+        if (can_search(face_required_depth)) {
             for (const i8 i : {0, Cube::order - 1}) {
                 for (auto direction = (i8)0; direction < 6; direction++) {
                     const auto mov = Move{(Move::Direction)direction, i};
@@ -213,17 +405,15 @@ template <int order> struct EdgeFormulaSearcher {
         }
 
         // 面以外の回転
-        const auto can_increase =
-            inner_rotation_counts.distance_from_all_zero <
-                max_depth - depth - 1 &&
-            inner_rotation_counts.distance_from_all_zero < kMaxNInnerRotations;
-        const auto can_decrease =
-            depth >= 2 && inner_rotation_counts.distance_from_all_zero >= 1 &&
-            inner_rotation_counts.distance_from_all_zero <= max_depth - depth;
+        const auto can_increase = can_search(increase_required_depth);
+        const auto can_decrease = can_search(decrease_required_depth);
         if (!can_increase && !can_decrease)
             return;
         for (auto i = (i8)1; i < Cube::order - 1; i++) {
             for (auto direction = (i8)0; direction < 6; direction++) {
+                // 初手は全体の回転と鏡映で f にできるので、f だけ調べる
+                if (depth == 0 && direction != (i8)Move::Direction::F)
+                    continue;
                 const auto mov = Move{(Move::Direction)direction, i};
                 if (!can_be_next_move(mov))
                     continue;
@@ -246,74 +436,102 @@ template <int order> struct EdgeFormulaSearcher {
     }
 };
 
+// save_state なら探索の途中経過を書き出し、max_depth を大きくして探索する
+// ときに使えるようにする (5x5x5 の深さ 7 で 24 MB になる)
 template <int order>
-static auto SearchEdgeFormulaWithOrder(const int max_depth) {
+static auto SearchEdgeFormulaWithOrder(const int max_depth,
+                                       const int n_threads,
+                                       const bool save_state) {
+    // Resume() と Save() で使う、探索の途中経過のファイル
+    const auto state_filenames = [](const int depth) {
+        return pair<string, string>{
+            format("out/edge_formula_{}_{}.results.bin", order, depth),
+            format("out/edge_formula_{}_{}.frontier.bin", order, depth)};
+    };
     auto searcher = EdgeFormulaSearcher<order>(max_depth);
-    const auto results = searcher.Search();
-    const auto filename =
-        format("out/edge_formula_{}_{}.txt", order, max_depth);
-    auto os = ofstream(filename);
-    if (!os.good()) {
-        cerr << format("Cannot open file `{}`.", filename) << endl;
-        abort();
+    // 浅い探索の途中経過があれば、その続きから探索する
+    auto resumed = false;
+    for (auto depth = max_depth - 1; depth >= 1 && !resumed; depth--) {
+        const auto [results_filename, frontier_filename] =
+            state_filenames(depth);
+        resumed = searcher.Resume(results_filename, frontier_filename, depth,
+                                  n_threads);
     }
-    os << "# Number of formulas: " << results.size() << endl;
-    for (const auto& [can_use_for_rainbow_cube, formula] : results) {
-        os << can_use_for_rainbow_cube << " ";
-        formula.Print(os);
-        // os << "  " << formula.facelet_changes.size();
-        if (0) {
-            for (const auto [from, to] : formula.facelet_changes)
-                os << format(" {}{}{}->{}{}{}", (int)from.face_id, (int)from.y,
-                             (int)from.x, (int)to.face_id, (int)to.y,
-                             (int)to.x);
-        }
-        os << endl;
+    if (!resumed)
+        searcher.Search(n_threads);
+    if (save_state) {
+        const auto [results_filename, frontier_filename] =
+            state_filenames(max_depth);
+        searcher.Save(results_filename, frontier_filename);
     }
+    const auto results = searcher.Reduce(n_threads);
+    // 先頭の 2 文字は、テキスト形式と同じく虹で使えるかどうかと空白
+    auto writer = FormulaWriter(
+        format("out/edge_formula_{}_{}.bin", order, max_depth), true, 2);
+    for (auto i = 0; i < results.Size(); i++)
+        writer.Write(results.Get(i),
+                     searcher.usable_for_rainbow[i] ? "1 " : "0 ");
+    writer.Close();
+    cout << format("Wrote {} formulas to `{}`.", writer.n_formulas,
+                   writer.filename)
+         << endl;
 }
 
 [[maybe_unused]] static auto SearchEdgeFormula(const int order,
-                                               const int max_depth) {
+                                               const int max_depth,
+                                               const int n_threads,
+                                               const bool save_state) {
     switch (order) {
     case 2:
-        return SearchEdgeFormulaWithOrder<2>(max_depth);
+        return SearchEdgeFormulaWithOrder<2>(max_depth, n_threads, save_state);
     case 3:
-        return SearchEdgeFormulaWithOrder<3>(max_depth);
+        return SearchEdgeFormulaWithOrder<3>(max_depth, n_threads, save_state);
     case 4:
-        return SearchEdgeFormulaWithOrder<4>(max_depth);
+        return SearchEdgeFormulaWithOrder<4>(max_depth, n_threads, save_state);
     case 5:
-        return SearchEdgeFormulaWithOrder<5>(max_depth);
+        return SearchEdgeFormulaWithOrder<5>(max_depth, n_threads, save_state);
     case 6:
-        return SearchEdgeFormulaWithOrder<6>(max_depth);
+        return SearchEdgeFormulaWithOrder<6>(max_depth, n_threads, save_state);
     case 7:
-        return SearchEdgeFormulaWithOrder<7>(max_depth);
+        return SearchEdgeFormulaWithOrder<7>(max_depth, n_threads, save_state);
     case 8:
-        return SearchEdgeFormulaWithOrder<8>(max_depth);
+        return SearchEdgeFormulaWithOrder<8>(max_depth, n_threads, save_state);
     case 9:
-        return SearchEdgeFormulaWithOrder<9>(max_depth);
+        return SearchEdgeFormulaWithOrder<9>(max_depth, n_threads, save_state);
     case 10:
-        return SearchEdgeFormulaWithOrder<10>(max_depth);
+        return SearchEdgeFormulaWithOrder<10>(max_depth, n_threads, save_state);
     case 19:
-        return SearchEdgeFormulaWithOrder<19>(max_depth);
+        return SearchEdgeFormulaWithOrder<19>(max_depth, n_threads, save_state);
     case 33:
-        return SearchEdgeFormulaWithOrder<33>(max_depth);
+        return SearchEdgeFormulaWithOrder<33>(max_depth, n_threads, save_state);
     default:
         assert(false);
     }
 }
 
 int main(const int argc, const char* const* const argv) {
-    if (argc < 3) {
-        cout << "Usage: " << argv[0] << " <order> <max_depth>" << endl;
+    // --save-state は位置によらない
+    auto args = vector<string>(argv, argv + argc);
+    const auto save_state_it = find(args.begin(), args.end(), "--save-state");
+    const auto save_state = save_state_it != args.end();
+    if (save_state)
+        args.erase(save_state_it);
+    if (args.size() < 3) {
+        cout << "Usage: " << argv[0]
+             << " <order> <max_depth> [n_threads] [--save-state]" << endl;
         return 1;
     }
-    const auto order = atoi(argv[1]);
-    const auto max_depth = atoi(argv[2]);
+    const auto order = stoi(args[1]);
+    const auto max_depth = stoi(args[2]);
+    const auto n_threads = args.size() >= 4
+                               ? stoi(args[3])
+                               : (int)thread::hardware_concurrency();
 
     cout << "Order: " << order << endl;
     cout << "Max Depth: " << max_depth << endl;
+    cout << "Threads: " << n_threads << endl;
 
-    SearchEdgeFormula(order, max_depth);
+    SearchEdgeFormula(order, max_depth, n_threads, save_state);
 }
 
 // clang++ -std=c++20 -Wall -Wextra -O3 search_edge_formula.cpp
\ No newline at end of file
@@ -2,11 +2,15 @@
 
 #include <algorithm>
 #include <numeric>
+#include <thread>
 
 using std::clamp;
+using std::find;
 using std::iota;
 using std::max_element;
+using std::move;
 using std::sort;
+using std::thread;
 
 template <int order> struct FaceFormulaSearcher {
     static constexpr auto kMaxNInnerRotations = 3;
@@ -17,27 +21,134 @@ template <int order> struct FaceFormulaSearcher {
     Cube start_cube;
 
     FaceFormulaSearcher(const int max_depth)
-        : max_depth(max_depth), start_cube(), results(), depth(), cube(),
-          move_history(), inner_rotation_counts(), slice_index_max(0) {
+        : max_depth(max_depth), start_cube(), results(), frontier(),
+          resumed_root_depth(-1), resumed_max_depth(-1), depth(), cube(),
+          move_history(), inner_rotation_counts(), slice_index_max(0),
+          face_color_counts(), split_depth(-1), subtrees() {
         start_cube.Reset();
     }
 
-    auto Search() {
-        results.clear();
+    // 探索して、見つかった手筋をそのまま results に入れる
+    void Search(const int n_threads = 1) {
+        ClearResults();
         cube = start_cube;
-        Dfs();
-        // add all face rotations
+        ComputeFaceColorCounts();
+        if (n_threads <= 1)
+            Dfs();
+        else
+            ParallelDfs(*this, n_threads);
+    }
+
+    // max_depth が previous_max_depth の探索で Save() したものの続きから
+    // 探索する
+    // 結果は max_depth で始めから Search() したものと同じ手筋が同じ順番に並ぶ
+    // ファイルが無ければ false を返す
+    bool Resume(const string& results_filename,
+                const string& frontier_filename, const int previous_max_depth,
+                const int n_threads = 1) {
+        auto results_ifs = ifstream(results_filename, ios::binary);
+        auto frontier_ifs = ifstream(frontier_filename, ios::binary);
+        if (!results_ifs.good() || !frontier_ifs.good())
+            return false;
+        ClearResults();
+        auto reduced = false;
+        const auto read_results = ReadFormulaBinaryFile(
+            results_ifs, 0, reduced,
+            [this](const string&, const vector<Move>& moves) {
+                results.Add(moves);
+            });
+        auto old_frontier = Frontier();
+        const auto read_frontier = ReadFormulaBinaryFile(
+            frontier_ifs, 1, reduced,
+            [&old_frontier](const string& prefix, const vector<Move>& moves) {
+                old_frontier.Add(moves.data(), (int)moves.size(), prefix[0]);
+            });
+        if (!read_results || !read_frontier) {
+            cerr << format("Broken state `{}`.", frontier_filename) << endl;
+            abort();
+        }
+        // frontier のノードを根とする部分木を探索する
+        // 根でまだ探索できない子があれば、根がまた frontier に入る
+        for (auto i = 0; i < old_frontier.Size(); i++) {
+            const vector<Move> moves = old_frontier.moves.Get(i);
+            auto subtree = Subtree();
+            subtree.depth = (int)moves.size();
+            copy(moves.begin(), moves.end(), subtree.move_history.begin());
+            subtree.inner_rotation_counts = InnerRotationCounts();
+            for (const auto& mov : moves)
+                if (!mov.IsFaceRotation<order>())
+                    subtree.inner_rotation_counts.Add(mov);
+            subtree.slice_index_max = old_frontier.slice_index_maxs[i];
+            subtree.resumed_max_depth = previous_max_depth;
+            subtree.results_position = results.Size();
+            subtree.frontier_position = frontier.Size();
+            subtrees.push_back(move(subtree));
+        }
+        cout << format("Resuming from {} formulas and {} subtrees in `{}`.",
+                       results.Size(), subtrees.size(), frontier_filename)
+             << endl;
+        SearchSubtreesInParallel(*this, n_threads);
+        // 前回の結果の後に新しい結果が並ぶので、始めから Search() したときと
+        // 同じ順番に並べ直す
+        // 同じ長さの手筋のうちどれを残すかが、始めから探索したときと揃う
+        results.Select(ComputeSearchOrder<order>(results));
+        frontier.Select(ComputeSearchOrder<order>(frontier.moves));
+        return true;
+    }
+
+    // 見つかった手筋と frontier を書き出す
+    // max_depth を大きくして探索するときに Resume() で読む
+    void Save(const string& results_filename,
+              const string& frontier_filename) const {
+        auto results_writer = FormulaWriter(results_filename, false);
+        for (auto i = 0; i < results.Size(); i++)
+            results_writer.Write(results.Get(i));
+        auto frontier_writer = FormulaWriter(frontier_filename, false, 1);
+        for (auto i = 0; i < frontier.Size(); i++)
+            frontier_writer.Write(frontier.moves.Get(i),
+                                  string(1, frontier.slice_index_maxs[i]));
+    }
 
+    // 面の回転を加えて、重複を除いた手筋を返す
+    auto Reduce(const int n_threads = 1) {
         for (auto direction = (i8)0; direction < 6; direction++) {
-            results.emplace_back(
-                vector<Move>{Move{(Move::Direction)direction, 0}});
-            results.emplace_back(
+            results.Add(vector<Move>{Move{(Move::Direction)direction, 0}});
+            results.Add(
                 vector<Move>{Move{(Move::Direction)direction, order - 1}});
         }
 
+        ReduceByPermutation(n_threads);
+        ReduceBySymmetry(n_threads);
         return results;
     }
 
+    // 中央のマスへの作用が同じものは、最も短いもの (同じ長さなら先に
+    // 見つかったもの) だけ残す
+    // 辺と角は面のソルバでは見ないので区別しない
+    void ReduceByPermutation(const int n_threads) {
+        results.Select(SelectCheapestPerPermutation(
+            results, n_threads, [](const vector<Move>& moves) {
+                return FormulaSymmetry<order>::ComputePermutationKey(moves,
+                                                                     true);
+            }));
+    }
+
+    // 対称なもの (FormulaSymmetry) は最初の 1 つだけ残す
+    // 読み込むときに FormulaSymmetry::Expand() で展開する
+    void ReduceBySymmetry(const int n_threads) {
+        const auto symmetry = FormulaSymmetry<order>();
+        auto keys = ComputeFormulaKeys(
+            results, n_threads, [&symmetry](const vector<Move>& moves) {
+                return symmetry.ComputeKey(moves);
+            });
+        auto seen = unordered_set<string>();
+        auto indices = vector<int>();
+        for (auto j = 0; j < results.Size(); j++)
+            if (seen.insert(move(keys[j])).second)
+                indices.push_back(j);
+        results.Select(indices);
+    }
+
     struct InnerRotationCounts {
         array<array<i8, order>, 3> counts; // (axis, depth) -> count
         int distance_from_all_zero;
@@ -60,12 +171,169 @@ template <int order> struct FaceFormulaSearcher {
         }
     };
 
-    vector<Formula> results;
+    // max_depth が足りずに探索しなかった子を持つノード
+    // max_depth を大きくしたときは、ここから探索を再開すれば良い
+    struct Frontier {
+        PackedFormulas moves;    // ノードまでの手順
+        string slice_index_maxs; // ノードでの slice_index_max
+
+        inline int Size() const { return moves.Size(); }
+
+        inline void Clear() {
+            moves.Clear();
+            slice_index_maxs.clear();
+        }
+
+        inline void Add(const Move* const moves_, const int n,
+                        const int slice_index_max) {
+            moves.Add(moves_, n);
+            slice_index_maxs += (char)slice_index_max;
+        }
+
+        inline void Append(const Frontier& other) {
+            moves.Append(other.moves);
+            slice_index_maxs += other.slice_index_maxs;
+        }
+
+        // indices のノードだけを、indices の順に残す
+        inline void Select(const vector<int>& indices) {
+            auto selected_slice_index_maxs = string();
+            for (const auto i : indices)
+                selected_slice_index_maxs += slice_index_maxs[i];
+            moves.Select(indices);
+            slice_index_maxs = move(selected_slice_index_maxs);
+        }
+
+        inline void Append(const Frontier& other, const int begin,
+                           const int end) {
+            moves.Append(other.moves, begin, end);
+            slice_index_maxs.append(other.slice_index_maxs, begin,
+                                    end - begin);
+        }
+    };
+
+    PackedFormulas results;
+    Frontier frontier;
+    // Resume() で再開した部分木の根の深さと、前回の max_depth
+    // 根では前回探索しなかった子だけを探索する (LoadSubtree() で設定する)
+    int resumed_root_depth;
+    int resumed_max_depth;
     int depth;                                        // Dfs(), CheckValid()
     Cube cube;                                        // Dfs(), CheckValid()
     array<Move, 10> move_history;                     // Dfs(), CheckValid()
     InnerRotationCounts inner_rotation_counts;
     int slice_index_max;
+    // 面ごとの、内側のマスの色ごとの数
+    // Rotate() で差分を更新するので、CheckValid() で数え直さなくて良い
+    array<array<int, 6>, 6> face_color_counts;
+
+    inline static int FaceColor(const ColorType color) {
+        return color.data / (ColorType::kNColors / 6);
+    }
+
+    void ComputeFaceColorCounts() {
+        for (auto face_id = 0; face_id < 6; face_id++) {
+            face_color_counts[face_id] = {};
+            for (auto y = 1; y < order - 1; y++)
+                for (auto x = 1; x < order - 1; x++)
+                    face_color_counts[face_id][FaceColor(
+                        cube.faces[face_id].GetIgnoringOrientation(y, x))]++;
+        }
+    }
+
+    // mov で動く内側のマスの数を sign 倍して足す
+    // 面の回転で動くマスは、回る面の中で動くか、隣の面の端にあるので関係無い
+    // Cube::Rotate() と同じ位置を見る
+    void AddMovedFaceColorCounts(const Move mov, const int sign) {
+        if (mov.depth == 0 || mov.depth == order - 1)
+            return;
+        const auto add = [this, sign](const int face_id,
+                                      const pair<int, int> yx) {
+            face_color_counts[face_id][FaceColor(
+                cube.faces[face_id].Get(yx.first, yx.second))] += sign;
+        };
+        const int d = mov.depth;
+        for (auto i = 1; i < order - 1; i++) {
+            const auto from_bottom = pair<int, int>{order - 1 - d, i};
+            const auto from_left = pair<int, int>{i, d};
+            const auto from_top = pair<int, int>{d, order - 1 - i};
+            const auto from_right =
+                pair<int, int>{order - 1 - i, order - 1 - d};
+            switch (mov.GetAxis()) {
+            case Move::Axis::F:
+                add(Cube::R1, from_right);
+                add(Cube::D0, from_top);
+                add(Cube::R0, from_left);
+                add(Cube::D1, from_bottom);
+                break;
+            case Move::Axis::D:
+                add(Cube::R1, from_bottom);
+                add(Cube::F1, from_bottom);
+                add(Cube::R0, from_bottom);
+                add(Cube::F0, from_bottom);
+                break;
+            case Move::Axis::R:
+                add(Cube::F0, from_right);
+                add(Cube::D0, from_right);
+                add(Cube::F1, from_left);
+                add(Cube::D1, from_right);
+                break;
+            }
+        }
+    }
+
+    void Rotate(const Move mov) {
+        AddMovedFaceColorCounts(mov, -1);
+        cube.Rotate(mov);
+        AddMovedFaceColorCounts(mov, 1);
+    }
+
+    // ParallelDfs() で分けた部分木
+    // cube は move_history から作り直す
+    struct Subtree {
+        int depth;
+        array<Move, 10> move_history;
+        InnerRotationCounts inner_rotation_counts;
+        int slice_index_max;
+        int resumed_max_depth; // Resume() で再開した部分木でなければ -1
+        int results_position; // 部分木の結果は results のこの位置に入る
+        int frontier_position; // 部分木の frontier は frontier のこの位置
+        PackedFormulas results;
+        Frontier frontier;
+    };
+    int split_depth; // Dfs() はこの深さに来たら部分木を記録して戻る
+    vector<Subtree> subtrees;
+
+    void ClearResults() {
+        results.Clear();
+        frontier.Clear();
+    }
+
+    void LoadSubtree(const Subtree& subtree) {
+        depth = subtree.depth;
+        move_history = subtree.move_history;
+        inner_rotation_counts = subtree.inner_rotation_counts;
+        slice_index_max = subtree.slice_index_max;
+        cube = start_cube;
+        for (auto d = 0; d < subtree.depth; d++)
+            cube.Rotate(subtree.move_history[d]);
+        ComputeFaceColorCounts();
+        resumed_root_depth =
+            subtree.resumed_max_depth >= 0 ? subtree.depth : -1;
+        resumed_max_depth = subtree.resumed_max_depth;
+    }
+
+    void StoreSubtree(Subtree& subtree) {
+        subtree.results = move(results);
+        subtree.frontier = move(frontier);
+    }
+
+    void MergeSubtrees() {
+        SpliceSubtreeResults(results, subtrees, &Subtree::results_position,
+                             &Subtree::results);
+        SpliceSubtreeResults(frontier, subtrees, &Subtree::frontier_position,
+                             &Subtree::frontier);
+    }
 
     // 有効な手筋かチェックする
     bool CheckValid() const {
@@ -101,7 +369,7 @@ template <int order> struct FaceFormulaSearcher {
         {
             constexpr int n_facecub_diff_min = 1;
             // constexpr int n_facecub_diff_max = 12;
-            vector<int> vec_n_facecub_diff_max = {
+            static constexpr auto vec_n_facecub_diff_max = array<int, 12>{
                 0,  0,  0,  // 0, 1, 2
                 36, 36, 30, // 3, 4, 5
                 24, 12, 6,  // 6, 7, 8
@@ -109,53 +377,12 @@ template <int order> struct FaceFormulaSearcher {
             };
             const int n_facecub_diff_max =
                 vec_n_facecub_diff_max[clamp(depth, 0, 11)];
+            // 各面で最も多い色以外のマスの数
             int n_facecube_diff = 0;
-            for (auto face_id = 0; face_id <= 5; face_id++) {
-                array<int, ColorType::kNColors> color_counts = {};
-                for (auto y = 1; y < Cube::order - 1; y++) {
-                    for (auto x = 1; x < Cube::order - 1; x++) {
-                        if (ColorType::kNColors == 24) {
-                            const auto color = cube.faces[face_id]
-                                                   .GetIgnoringOrientation(y, x)
-                                                   .data /
-                                               4;
-                            color_counts[color]++;
-                        } else if (ColorType::kNColors == 6) {
-                            const auto color = cube.faces[face_id]
-                                                   .GetIgnoringOrientation(y, x)
-                                                   .data;
-                            color_counts[color]++;
-                        } else
-                            assert(false);
-                    }
-                }
-                // 最大色
-                const auto color =
-                    i8(max_element(color_counts.begin(), color_counts.end()) -
-                       color_counts.begin());
-                for (auto y = 1; y < Cube::order - 1; y++) {
-                    for (auto x = 1; x < Cube::order - 1; x++) {
-                        bool flag_count = false;
-                        if (ColorType::kNColors == 24) {
-                            if (cube.faces[face_id]
-                                        .GetIgnoringOrientation(y, x)
-                                        .data /
-                                    4 !=
-                                color)
-                                flag_count = true;
-                        } else if (ColorType::kNColors == 6) {
-                            if (cube.faces[face_id]
-                                    .GetIgnoringOrientation(y, x)
-                                    .data != color)
-                                flag_count = true;
-                        } else
-                            assert(false);
-
-                        if (flag_count)
-                            n_facecube_diff++;
-                    }
-                }
-            }
+            for (const auto& color_counts : face_color_counts)
+                n_facecube_diff +=
+                    (order - 2) * (order - 2) -
+                    *max_element(color_counts.begin(), color_counts.end());
             assert(n_facecube_diff != 1);
             if (clamp(n_facecube_diff, n_facecub_diff_min,
                       n_facecub_diff_max) != n_facecube_diff)
@@ -164,10 +391,16 @@ template <int order> struct FaceFormulaSearcher {
         return true;
     }
     void Dfs() {
+        if (depth == split_depth) {
+            subtrees.push_back({depth, move_history, inner_rotation_counts,
+                                slice_index_max, -1, results.Size(),
+                                frontier.Size(), {}, {}});
+            return;
+        }
+        // Resume() で再開した部分木の根は、前回の探索で既に調べている
+        const auto is_resumed_root = depth == resumed_root_depth;
         // 方針: ややこしすぎるので後で回転とか言わず全部列挙する
         if (CheckValid()) {
-            const auto moves = vector<Move>(move_history.begin(),
-                                            move_history.begin() + depth);
             /*             auto facelet_changes_array =
                             array<Formula::FaceletChange, (Cube::order - 2) *
                24>(); auto n_facelet_changes = 0; for (auto face_id = 0; face_id
@@ -190,13 +423,13 @@ template <int order> struct FaceFormulaSearcher {
                                 }
                         } */
             // if (n_facelet_changes != 0) {
-            if (true) { // TODO デバッグ
+            if (depth != 0 && !is_resumed_root) { // 空の手順と再開した根は除く
                 // cout << n_facelet_changes << endl;
                 // const auto facelet_changes = vector<Formula::FaceletChange>(
                 //     facelet_changes_array.begin(),
                 //     facelet_changes_array.begin() + n_facelet_changes);
                 // results.emplace_back(moves, facelet_changes);
-                results.emplace_back(moves);
+                results.Add(move_history.data(), depth);
             }
             // valid ならば、それより深いところまで探索する必要は無い
             if (depth > 2)
@@ -204,6 +437,8 @@ template <int order> struct FaceFormulaSearcher {
         }
         if (depth == max_depth) {
             assert(inner_rotation_counts.distance_from_all_zero == 0);
+            // 子は全て max_depth が足りない
+            frontier.Add(move_history.data(), depth, slice_index_max);
             return;
         }
 
@@ -237,9 +472,33 @@ template <int order> struct FaceFormulaSearcher {
                 return false; // 負の向きの回転が 2 回連続してはいけない
         };
 
+        // 子を探索するのに必要な max_depth
+        // max_depth をいくら大きくしても探索しないものは kUnreachable
+        constexpr auto kUnreachable = 1 << 30;
+        const auto distance = inner_rotation_counts.distance_from_all_zero;
+        const auto face_required_depth =
+            depth != 0 ? distance + depth + 1 : kUnreachable;
+        const auto increase_required_depth =
+            distance < kMaxNInnerRotations ? distance + depth + 2
+                                           : kUnreachable;
+        const auto decrease_required_depth =
+            depth >= 2 && distance >= 1 ? distance + depth : kUnreachable;
+        // max_depth が足りない子があれば frontier に入れる
+        for (const auto required_depth :
+             {face_required_depth, increase_required_depth,
+              decrease_required_depth})
+            if (max_depth < required_depth && required_depth != kUnreachable) {
+                frontier.Add(move_history.data(), depth, slice_index_max);
+                break;
+            }
+        // 再開した根では、前回 max_depth が足りなかった子だけを探索する
+        const auto can_search = [this, is_resumed_root](const int required) {
+            return required <= max_depth &&
+                   (!is_resumed_root || required > resumed_max_depth);
+        };
+
         // 面の回転 (初手以外)
-        if (depth != 0 &&
-            inner_rotation_counts.distance_from_all_zero < max_depth - depth) {
+        if (can_search(face_required_depth)) {
             for (const i8 i : {0, Cube::order - 1}) {
                 for (auto direction = (i8)0; direction < 6; direction++) {
 
@@ -257,11 +516,11 @@ template <int order> struct FaceFormulaSearcher {
                             break;
                     }
                     move_history[depth] = mov;
-                    cube.Rotate(mov);
+                    Rotate(mov);
                     depth++;
                     Dfs();
                     depth--;
-                    cube.Rotate(inv_mov);
+                    Rotate(inv_mov);
                 next_face_move:;
                 }
             }
@@ -269,13 +528,8 @@ template <int order> struct FaceFormulaSearcher {
 
         // 面以外の回転であって、面の変化を増やすもの
         // 面以外の回転
-        const auto can_increase =
-            inner_rotation_counts.distance_from_all_zero <
-                max_depth - depth - 1 &&
-            inner_rotation_counts.distance_from_all_zero < kMaxNInnerRotations;
-        const auto can_decrease =
-            depth >= 2 && inner_rotation_counts.distance_from_all_zero >= 1 &&
-            inner_rotation_counts.distance_from_all_zero <= max_depth - depth;
+        const auto can_increase = can_search(increase_required_depth);
+        const auto can_decrease = can_search(decrease_required_depth);
         if (!can_increase && !can_decrease)
             return;
         for (auto i = (i8)1; i < Cube::order - 1; i++) {
@@ -302,6 +556,9 @@ template <int order> struct FaceFormulaSearcher {
             }
 
             for (auto direction = (i8)0; direction < 6; direction++) {
+                // 初手は全体の回転と鏡映で f にできるので、f だけ調べる
+                if (depth == 0 && direction != (i8)Move::Direction::F)
+                    continue;
                 const auto mov = Move{(Move::Direction)direction, i};
                 if (!can_be_next_move(mov))
                     continue;
@@ -313,7 +570,7 @@ template <int order> struct FaceFormulaSearcher {
                 inner_rotation_counts.Add(mov);
                 const auto inv_mov = mov.Inv();
                 move_history[depth] = mov;
-                cube.Rotate(mov);
+                Rotate(mov);
                 depth++;
                 if (flag_new_slice) {
                     slice_index_max++;
@@ -323,80 +580,107 @@ template <int order> struct FaceFormulaSearcher {
                 if (flag_new_slice) {
                     slice_index_max--;
                 }
-                cube.Rotate(inv_mov);
+                Rotate(inv_mov);
                 inner_rotation_counts.Add(inv_mov);
             }
         }
     }
 };
 
+// save_state なら探索の途中経過を書き出し、max_depth を大きくして探索する
+// ときに使えるようにする (出力の数十倍の大きさになる)
 template <int order>
-static auto SearchFaceFormulaWithOrder(const int max_depth) {
+static auto SearchFaceFormulaWithOrder(const int max_depth,
+                                       const int n_threads,
+                                       const bool save_state) {
+    // Resume() と Save() で使う、探索の途中経過のファイル
+    const auto state_filenames = [](const int depth) {
+        return pair<string, string>{
+            format("out/face_formula_{}_{}.results.bin", order, depth),
+            format("out/face_formula_{}_{}.frontier.bin", order, depth)};
+    };
     auto searcher = FaceFormulaSearcher<order>(max_depth);
-    const auto results = searcher.Search();
-    const auto filename =
-        format("out/face_formula_{}_{}.txt", order, max_depth);
-    auto os = ofstream(filename);
-    if (!os.good()) {
-        cerr << format("Cannot open file `{}`.", filename) << endl;
-        abort();
+    // 浅い探索の途中経過があれば、その続きから探索する
+    auto resumed = false;
+    for (auto depth = max_depth - 1; depth >= 1 && !resumed; depth--) {
+        const auto [results_filename, frontier_filename] =
+            state_filenames(depth);
+        resumed = searcher.Resume(results_filename, frontier_filename, depth,
+                                  n_threads);
     }
-    os << "# Number of formulas: " << results.size() << endl;
-    for (const auto& formula : results) {
-        formula.Print(os);
-        // os << "  " << formula.facelet_changes.size();
-        if (0) {
-            for (const auto [from, to] : formula.facelet_changes)
-                os << format(" {}{}{}->{}{}{}", (int)from.face_id, (int)from.y,
-                             (int)from.x, (int)to.face_id, (int)to.y,
-                             (int)to.x);
-        }
-        os << endl;
+    if (!resumed)
+        searcher.Search(n_threads);
+    if (save_state) {
+        const auto [results_filename, frontier_filename] =
+            state_filenames(max_depth);
+        searcher.Save(results_filename, frontier_filename);
     }
+    const auto results = searcher.Reduce(n_threads);
+    auto writer = FormulaWriter(
+        format("out/face_formula_{}_{}.bin", order, max_depth), true);
+    for (auto i = 0; i < results.Size(); i++)
+        writer.Write(results.Get(i));
+    writer.Close();
+    cout << format("Wrote {} formulas to `{}`.", writer.n_formulas,
+                   writer.filename)
+         << endl;
 }
 
 [[maybe_unused]] static auto SearchFaceFormula(const int order,
-                                               const int max_depth) {
+                                               const int max_depth,
+                                               const int n_threads,
+                                               const bool save_state) {
     switch (order) {
     case 2:
-        return SearchFaceFormulaWithOrder<2>(max_depth);
+        return SearchFaceFormulaWithOrder<2>(max_depth, n_threads, save_state);
     case 3:
-        return SearchFaceFormulaWithOrder<3>(max_depth);
+        return SearchFaceFormulaWithOrder<3>(max_depth, n_threads, save_state);
     case 4:
-        return SearchFaceFormulaWithOrder<4>(max_depth);
+        return SearchFaceFormulaWithOrder<4>(max_depth, n_threads, save_state);
     case 5:
-        return SearchFaceFormulaWithOrder<5>(max_depth);
+        return SearchFaceFormulaWithOrder<5>(max_depth, n_threads, save_state);
     case 6:
-        return SearchFaceFormulaWithOrder<6>(max_depth);
+        return SearchFaceFormulaWithOrder<6>(max_depth, n_threads, save_state);
     case 7:
-        return SearchFaceFormulaWithOrder<7>(max_depth);
+        return SearchFaceFormulaWithOrder<7>(max_depth, n_threads, save_state);
     case 8:
-        return SearchFaceFormulaWithOrder<8>(max_depth);
+        return SearchFaceFormulaWithOrder<8>(max_depth, n_threads, save_state);
     case 9:
-        return SearchFaceFormulaWithOrder<9>(max_depth);
+        return SearchFaceFormulaWithOrder<9>(max_depth, n_threads, save_state);
     case 10:
-        return SearchFaceFormulaWithOrder<10>(max_depth);
+        return SearchFaceFormulaWithOrder<10>(max_depth, n_threads, save_state);
     case 19:
-        return SearchFaceFormulaWithOrder<19>(max_depth);
+        return SearchFaceFormulaWithOrder<19>(max_depth, n_threads, save_state);
     case 33:
-        return SearchFaceFormulaWithOrder<33>(max_depth);
+        return SearchFaceFormulaWithOrder<33>(max_depth, n_threads, save_state);
     default:
         assert(false);
     }
 }
 
 int main(const int argc, const char* const* const argv) {
-    if (argc < 3) {
-        cout << "Usage: " << argv[0] << " <order> <max_depth>" << endl;
+    // --save-state は位置によらない
+    auto args = vector<string>(argv, argv + argc);
+    const auto save_state_it = find(args.begin(), args.end(), "--save-state");
+    const auto save_state = save_state_it != args.end();
+    if (save_state)
+        args.erase(save_state_it);
+    if (args.size() < 3) {
+        cout << "Usage: " << argv[0]
+             << " <order> <max_depth> [n_threads] [--save-state]" << endl;
         return 1;
     }
-    const auto order = atoi(argv[1]);
-    const auto max_depth = atoi(argv[2]);
+    const auto order = stoi(args[1]);
+    const auto max_depth = stoi(args[2]);
+    const auto n_threads = args.size() >= 4
+                               ? stoi(args[3])
+                               : (int)thread::hardware_concurrency();
 
     cout << "Order: " << order << endl;
     cout << "Max Depth: " << max_depth << endl;
+    cout << "Threads: " << n_threads << endl;
 
-    SearchFaceFormula(order, max_depth);
+    SearchFaceFormula(order, max_depth, n_threads, save_state);
 }
 
 // clang++ -std=c++20 -Wall -Wextra -O3 search_face_formula.cpp
\ No newline at end of file
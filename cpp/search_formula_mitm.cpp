@@ -0,0 +1,721 @@
+#include "cube.cpp"
+
+#include <numeric>
+
+using std::atomic;
+using std::copy;
+using std::iota;
+using std::max;
+using std::min;
+using std::move;
+using std::stable_sort;
+using std::swap;
+using std::thread;
+
+// 手筋を両側から半分ずつ探す (meet-in-the-middle)
+// 手筋 A.C で動くマスの数は、A を回した盤面と C^-1 を回した盤面で
+// 違うマスの数に等しい
+// 長さ half_depth 以下の手順を全て列挙して、盤面の違いが max_n_changes 以下の
+// 組をつなぐ
+// 違いが K 個以下の組は、マスを K+1 個のブロックに分けるとどれかのブロックで
+// 一致するので、ブロックごとにハッシュで突き合わせる
+//
+// 面の手筋: 中央のマスを比べる
+// 辺の手筋: 辺のマスを比べる。中央のマスは色が一致しなければならない
+// どちらも面以外の回転は戻し切る
+//
+// 列挙した手順は全てメモリに置く (ディスクには書かない)
+// 1 手順あたり 22 バイトと、追跡するマスの数 (256 個以下なら 1 マス 1 バイト、
+// それより多ければ 2 バイト) を使い、Join() ではさらに 1 手順あたり
+// 40 バイトほど使う
+// 5x5x5 の面の手筋 (追跡するマスは 54 個) では、half_depth 5 で約 800 万手順、
+// 最大 1.4 GB ほどになる。手順の数は 1 手ごとに約 20 倍になるので、
+// half_depth 6 は約 1.6 億手順で 20 GB 近くになる
+// 実用になるのは half_depth 5 (長さ 10) まで
+template <int order> struct MitmFormulaSearcher {
+    static constexpr auto kMaxHalfDepth = 8;
+    static constexpr auto kMaxNInnerRotations = 3;
+
+    using Cube = ::Cube<order, ColorType24>;
+
+    struct InnerRotationCounts {
+        array<array<i8, order>, 3> counts; // (axis, depth) -> count
+        int distance_from_all_zero;
+
+        inline void Add(const Move mov) {
+            auto& count = counts[(int)mov.GetAxis()][mov.depth];
+            distance_from_all_zero -= count == 3 ? 1 : count;
+            count = (count + (mov.IsClockWise() ? 1 : -1)) & 3;
+            distance_from_all_zero += count == 3 ? 1 : count;
+        }
+
+        inline auto ComputeDeltaDistance(const Move mov) const {
+            const auto count = counts[(int)mov.GetAxis()][mov.depth];
+            const auto old_distance = count == 3 ? 1 : count;
+            const auto new_count = (count + (mov.IsClockWise() ? 1 : -1)) & 3;
+            const auto new_distance = new_count == 3 ? 1 : new_count;
+            return new_distance - old_distance;
+        }
+    };
+
+    bool is_face;
+    int half_depth;
+    int max_n_changes;
+    // 追跡するマスの盤面上の番号 (face_id * order + y) * order + x
+    // 先頭の n_compared 個が比べるマス、残りは色だけ一致すれば良いマス
+    vector<int> tracked_positions;
+    int n_compared;
+    vector<int> tracked_indices; // 盤面上の番号 -> tracked_positions の番号
+
+    // 列挙した手順
+    // 手順 i は、手順 parents[i] (-1 なら空の手順) に last_moves[i] を
+    // 足したもの
+    // states の手順 i の部分の k 番目: 手順 i を回したとき
+    // tracked_positions[k] にあるマスの、tracked_positions での番号
+    // (state_size バイトずつ)
+    vector<int> parents;
+    vector<u8> last_moves; // Move::ToByte()
+    vector<i8> lengths;
+    int state_size;
+    vector<u8> states;
+    vector<u64> exact_keys;     // 手順の、一致しなければならない部分
+    vector<u64> exact_keys_inv; // 逆手順の、一致しなければならない部分
+
+    vector<Formula> results;
+
+    MitmFormulaSearcher(const bool is_face, const int half_depth,
+                        const int max_n_changes)
+        : is_face(is_face), half_depth(half_depth),
+          max_n_changes(max_n_changes), tracked_positions(), n_compared(),
+          tracked_indices(6 * order * order, -1), parents(), last_moves(),
+          lengths(), state_size(), states(), exact_keys(), exact_keys_inv(),
+          results(), depth(), lower(), upper(), move_history(),
+          record_indices(), inner_rotation_counts() {
+        if (half_depth < 1 || half_depth > kMaxHalfDepth) {
+            cerr << format("half_depth must be in [1, {}].", kMaxHalfDepth)
+                 << endl;
+            abort();
+        }
+        const auto is_center = [](const int y, const int x) {
+            return 1 <= y && y < order - 1 && 1 <= x && x < order - 1;
+        };
+        const auto is_edge = [&](const int y, const int x) {
+            return !is_center(y, x) && ((1 <= y && y < order - 1) ||
+                                        (1 <= x && x < order - 1));
+        };
+        for (const auto compared : {true, false})
+            for (auto face_id = 0; face_id < 6; face_id++)
+                for (auto y = 0; y < order; y++)
+                    for (auto x = 0; x < order; x++) {
+                        const auto tracked =
+                            is_face ? compared && is_center(y, x)
+                                    : (compared ? is_edge(y, x)
+                                                : is_center(y, x));
+                        if (!tracked)
+                            continue;
+                        const auto position =
+                            (face_id * order + y) * order + x;
+                        tracked_indices[position] =
+                            (int)tracked_positions.size();
+                        tracked_positions.push_back(position);
+                    }
+        n_compared = 0;
+        for (const auto position : tracked_positions) {
+            const auto y = position / order % order;
+            const auto x = position % order;
+            n_compared += is_face ? is_center(y, x) : is_edge(y, x);
+        }
+        state_size = tracked_positions.size() <= 256 ? 1 : 2;
+        // マスの番号を 7bit ずつ 2 つのキューブに分けて持つ
+        for (auto face_id = 0; face_id < 6; face_id++)
+            for (auto y = 0; y < order; y++)
+                for (auto x = 0; x < order; x++) {
+                    const auto position = (face_id * order + y) * order + x;
+                    lower.faces[face_id].Set(y, x, {(i8)(position & 127)});
+                    upper.faces[face_id].Set(y, x, {(i8)(position >> 7)});
+                }
+    }
+
+    auto Search(const int n_threads = 1) {
+        parents.clear();
+        last_moves.clear();
+        lengths.clear();
+        states.clear();
+        exact_keys.clear();
+        exact_keys_inv.clear();
+        results.clear();
+        Enumerate();
+        const auto n = parents.size();
+        cout << format("Enumerated {} sequences of length <= {} ({} MB).", n,
+                       half_depth,
+                       (n * (sizeof(int) + sizeof(u8) + sizeof(i8) +
+                             sizeof(u64) * 2) +
+                        states.size()) >>
+                           20)
+             << endl;
+        Join(n_threads);
+        cout << format("Joined {} formulas.", results.size()) << endl;
+        if (is_face) {
+            // search_face_formula.cpp と同様に、長さ 2 以下のものは全て加える
+            for (auto i = 0; i < (int)n; i++) {
+                if (lengths[i] > 2)
+                    continue;
+                const auto moves = Sequence(i);
+                if (IsCanonical(moves) && UsesSlicesFromOutside<order>(moves))
+                    results.emplace_back(moves);
+            }
+            for (auto direction = (i8)0; direction < 6; direction++) {
+                results.emplace_back(
+                    vector<Move>{Move{(Move::Direction)direction, 0}});
+                results.emplace_back(vector<Move>{
+                    Move{(Move::Direction)direction, (i8)(order - 1)}});
+            }
+        }
+        // 読み込むときは先にあるものが優先されるので、短い順に並べる
+        stable_sort(results.begin(), results.end(),
+                    [](const Formula& a, const Formula& b) {
+                        return a.Cost() < b.Cost();
+                    });
+        ReduceByPermutation();
+        ReduceBySymmetry();
+        return results;
+    }
+
+    // search_face_formula.cpp の can_be_next_move と、面の回転の条件
+    // open_start なら、moves の前にも手があるものとして扱う
+    inline static bool CanBeNextMove(const Move* const moves, const int n,
+                                     const Move mov, const bool open_start) {
+        if (n >= 1 && mov.GetAxis() == moves[n - 1].GetAxis()) {
+            const auto last_mov = moves[n - 1];
+            if (mov.depth < last_mov.depth)
+                return false;
+            if (mov.depth == last_mov.depth) {
+                if (mov != last_mov)
+                    return false;
+                if (!last_mov.IsClockWise())
+                    return false;
+                if (n >= 2 && moves[n - 2] == last_mov)
+                    return false;
+            }
+        }
+        if (mov.IsFaceRotation<order>()) {
+            const auto inv_mov = mov.Inv();
+            for (auto d = n - 1;; d--) {
+                if (d < 0) {
+                    if (open_start)
+                        break;
+                    return false;
+                }
+                if (inv_mov == moves[d])
+                    return false;
+                if (mov.GetAxis() != moves[d].GetAxis())
+                    break;
+            }
+        }
+        return true;
+    }
+
+    inline static bool IsCanonical(const vector<Move>& moves) {
+        for (auto d = 0; d < (int)moves.size(); d++)
+            if (!CanBeNextMove(moves.data(), d, moves[d], false))
+                return false;
+        return true;
+    }
+
+    // 面の回転の後には、別の軸の回転がある
+    // (search_face_formula.cpp, search_edge_formula.cpp の CheckValid)
+    inline static bool
+    IsFaceRotationFollowedByOtherAxis(const vector<Move>& moves) {
+        auto last_face_roration_axis = (i8)-1;
+        for (const auto& mov : moves) {
+            const auto axis = (i8)mov.GetAxis();
+            if (mov.IsFaceRotation<order>())
+                last_face_roration_axis = axis;
+            else if (axis != last_face_roration_axis)
+                last_face_roration_axis = (i8)-1;
+        }
+        return last_face_roration_axis == (i8)-1;
+    }
+
+  private:
+    int depth;
+    Cube lower, upper;
+    array<Move, kMaxHalfDepth> move_history;
+    // move_history の先頭 d 手の手順の番号 (d >= 1)
+    array<int, kMaxHalfDepth + 1> record_indices;
+    InnerRotationCounts inner_rotation_counts;
+
+    inline static u64 HashCombine(const u64 seed, const u64 value) {
+        auto x = seed ^ (value + 0x9e3779b97f4a7c15ull);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    inline int FaceOf(const int tracked_index) const {
+        return tracked_positions[tracked_index] / (order * order);
+    }
+
+    inline vector<Move> Sequence(int i) const {
+        auto moves = vector<Move>(lengths[i]);
+        for (auto d = (int)lengths[i] - 1; d >= 0; d--, i = parents[i])
+            moves[d] = Move::FromByte(last_moves[i]);
+        return moves;
+    }
+
+    inline Move FirstMove(int i) const {
+        while (parents[i] >= 0)
+            i = parents[i];
+        return Move::FromByte(last_moves[i]);
+    }
+
+    // 手順 i の状態の先頭
+    inline const u8* StateData(const int i) const {
+        return states.data() +
+               (size_t)i * tracked_positions.size() * state_size;
+    }
+
+    // StateData() の k 番目のマスの番号
+    inline u16 StateAt(const u8* const p, const int k) const {
+        return state_size == 1 ? p[k] : p[k * 2] | p[k * 2 + 1] << 8;
+    }
+
+    // 手順 i を回したときの状態
+    inline void LoadState(const int i, vector<u16>& state) const {
+        const auto n_tracked = (int)tracked_positions.size();
+        const auto p = StateData(i);
+        state.resize(n_tracked);
+        if (state_size == 1)
+            copy(p, p + n_tracked, state.begin());
+        else
+            for (auto k = 0; k < n_tracked; k++)
+                state[k] = p[k * 2] | p[k * 2 + 1] << 8;
+    }
+
+    // 手順 i の逆手順を回したときの状態
+    // state は作業用
+    inline void ComputeInverseState(const int i, vector<u16>& state,
+                                    vector<u16>& inv) const {
+        LoadState(i, state);
+        inv.resize(tracked_positions.size());
+        for (auto k = 0; k < (int)tracked_positions.size(); k++)
+            inv[state[k]] = (u16)k;
+    }
+
+    // 面以外の回転の回数と、(辺の手筋なら) 中央のマスの色
+    inline u64 ComputeExactKey(const u16* const state, const int sign) const {
+        auto key = (u64)0;
+        for (const auto& axis_counts : inner_rotation_counts.counts)
+            for (const auto count : axis_counts)
+                key = HashCombine(key, (u64)((sign * count) & 3));
+        for (auto k = n_compared; k < (int)tracked_positions.size(); k++)
+            key = HashCombine(key, (u64)FaceOf(state[k]));
+        return key;
+    }
+
+    void Record() {
+        const auto i = (int)parents.size();
+        record_indices[depth] = i;
+        parents.push_back(depth == 1 ? -1 : record_indices[depth - 1]);
+        last_moves.push_back(move_history[depth - 1].ToByte());
+        lengths.push_back((i8)depth);
+        auto state = vector<u16>();
+        for (const auto position : tracked_positions) {
+            const auto face_id = position / (order * order);
+            const auto y = position / order % order;
+            const auto x = position % order;
+            const auto from = lower.faces[face_id].Get(y, x).data |
+                              upper.faces[face_id].Get(y, x).data << 7;
+            assert(tracked_indices[from] >= 0);
+            state.push_back((u16)tracked_indices[from]);
+            states.push_back((u8)state.back());
+            if (state_size == 2)
+                states.push_back((u8)(state.back() >> 8));
+        }
+        exact_keys.push_back(ComputeExactKey(state.data(), 1));
+        auto inv = vector<u16>();
+        ComputeInverseState(i, state, inv);
+        exact_keys_inv.push_back(ComputeExactKey(inv.data(), -1));
+    }
+
+    void Enumerate() {
+        if (depth >= 1)
+            Record();
+        if (depth == half_depth)
+            return;
+        for (auto i = (i8)0; i < order; i++) {
+            for (auto direction = (i8)0; direction < 6; direction++) {
+                const auto mov = Move{(Move::Direction)direction, i};
+                if (!CanBeNextMove(move_history.data(), depth, mov, true))
+                    continue;
+                const auto is_inner = !mov.IsFaceRotation<order>();
+                if (is_inner &&
+                    inner_rotation_counts.ComputeDeltaDistance(mov) == 1 &&
+                    inner_rotation_counts.distance_from_all_zero >=
+                        kMaxNInnerRotations)
+                    continue;
+                if (is_inner)
+                    inner_rotation_counts.Add(mov);
+                move_history[depth] = mov;
+                lower.Rotate(mov);
+                upper.Rotate(mov);
+                depth++;
+                Enumerate();
+                depth--;
+                lower.Rotate(mov.Inv());
+                upper.Rotate(mov.Inv());
+                if (is_inner)
+                    inner_rotation_counts.Add(mov.Inv());
+            }
+        }
+    }
+
+    // 比べるマスを max_n_changes + 1 個のブロックに分ける
+    // 同じ面の同じ辺りのマスは一緒に動きやすいので、ばらばらに混ぜる
+    auto MakeBlocks() const {
+        auto indices = vector<int>(n_compared);
+        iota(indices.begin(), indices.end(), 0);
+        auto rng = RandomNumberGenerator(42);
+        for (auto k = n_compared - 1; k >= 1; k--)
+            swap(indices[k], indices[rng.Next() % (k + 1)]);
+        const auto n_blocks = min(max_n_changes + 1, n_compared);
+        auto blocks = vector<vector<int>>(n_blocks);
+        for (auto k = 0; k < n_compared; k++)
+            blocks[k % n_blocks].push_back(indices[k]);
+        return blocks;
+    }
+
+    inline static u64 ComputeBlockKey(const u64 exact_key,
+                                      const u16* const state,
+                                      const vector<int>& block) {
+        auto key = exact_key;
+        for (const auto k : block)
+            key = HashCombine(key, state[k]);
+        return key;
+    }
+
+    // begin から end まで (end は含まない) を n_threads 個の連続した範囲に
+    // 分け、スレッドごとに f(スレッドの番号, 番号) を呼ぶ
+    template <typename F>
+    inline static void ParallelFor(const int n_threads, const int begin,
+                                   const int end, const F& f) {
+        auto threads = vector<thread>();
+        for (auto t = 0; t < n_threads; t++)
+            threads.emplace_back([&, t] {
+                const auto size = (long long)(end - begin);
+                const auto i_end = begin + (int)(size * (t + 1) / n_threads);
+                for (auto i = begin + (int)(size * t / n_threads); i < i_end;
+                     i++)
+                    f(t, i);
+            });
+        for (auto& th : threads)
+            th.join();
+    }
+
+    // ブロックごとにキーを並べて突き合わせる
+    // キーの計算と、キーが一致した組をつなぐところを n_threads 個の
+    // スレッドで分ける
+    // つないだ手筋は、一致したキーの順 (スレッドの数によらない) に並べる
+    void Join(int n_threads) {
+        n_threads = max(n_threads, 1);
+        const auto blocks = MakeBlocks();
+        const auto n = (int)parents.size();
+        // 初手は全体の回転と鏡映で f にできるので、A は f から始まるものだけ
+        auto a_indices = vector<int>();
+        for (auto i = 0; i < n; i++) {
+            const auto first_move = FirstMove(i);
+            if (first_move.direction == Move::Direction::F &&
+                !first_move.template IsFaceRotation<order>())
+                a_indices.push_back(i);
+        }
+        const auto n_a = (int)a_indices.size();
+        // A の長さは C と同じか 1 長いので、長さもキーに入れる
+        auto keys = vector<pair<u64, int>>(n_a);
+        auto keys_inv = vector<pair<u64, int>>(n * 2);
+        auto buffers = vector<pair<vector<u16>, vector<u16>>>(n_threads);
+        for (auto b = 0; b < (int)blocks.size(); b++) {
+            ParallelFor(n_threads, 0, n_a, [&](const int t, const int p) {
+                auto& state = buffers[t].first;
+                const auto i = a_indices[p];
+                LoadState(i, state);
+                const auto key =
+                    ComputeBlockKey(exact_keys[i], state.data(), blocks[b]);
+                keys[p] = {HashCombine(key, (u64)lengths[i]), i};
+            });
+            ParallelFor(n_threads, 0, n, [&](const int t, const int i) {
+                auto& [state, inv] = buffers[t];
+                ComputeInverseState(i, state, inv);
+                const auto key_inv =
+                    ComputeBlockKey(exact_keys_inv[i], inv.data(), blocks[b]);
+                for (const auto d : {0, 1})
+                    keys_inv[i * 2 + d] = {
+                        HashCombine(key_inv, (u64)(lengths[i] + d)), i};
+            });
+            sort(keys.begin(), keys.end());
+            sort(keys_inv.begin(), keys_inv.end());
+            // キーが一致する範囲 (keys の p から, keys_inv の q から)
+            auto groups = vector<array<int, 4>>();
+            for (auto p = 0, q = 0; p < n_a && q < n * 2;) {
+                if (keys[p].first < keys_inv[q].first) {
+                    p++;
+                    continue;
+                }
+                if (keys_inv[q].first < keys[p].first) {
+                    q++;
+                    continue;
+                }
+                auto p_end = p, q_end = q;
+                while (p_end < n_a && keys[p_end].first == keys[p].first)
+                    p_end++;
+                while (q_end < n * 2 && keys_inv[q_end].first == keys[p].first)
+                    q_end++;
+                groups.push_back({p, p_end, q, q_end});
+                p = p_end;
+                q = q_end;
+            }
+            // 一致する組の数は範囲ごとにばらつくので、細かく分けて空いた
+            // スレッドから取っていく
+            const auto n_chunks = min((int)groups.size(), n_threads * 64);
+            auto chunk_results = vector<vector<Formula>>(n_chunks);
+            auto next_chunk = atomic<int>(0);
+            auto threads = vector<thread>();
+            for (auto t = 0; t < n_threads; t++)
+                threads.emplace_back([&, t] {
+                    auto& [state, inv] = buffers[t];
+                    for (auto c = next_chunk++; c < n_chunks;
+                         c = next_chunk++) {
+                        const auto g_begin =
+                            (int)((long long)groups.size() * c / n_chunks);
+                        const auto g_end =
+                            (int)((long long)groups.size() * (c + 1) /
+                                  n_chunks);
+                        for (auto g = g_begin; g < g_end; g++) {
+                            const auto [p, p_end, q, q_end] = groups[g];
+                            for (auto qq = q; qq < q_end; qq++) {
+                                const auto j = keys_inv[qq].second;
+                                ComputeInverseState(j, state, inv);
+                                for (auto pp = p; pp < p_end; pp++)
+                                    TryJoin(keys[pp].second, j, inv, blocks,
+                                            b, chunk_results[c]);
+                            }
+                        }
+                    }
+                });
+            for (auto& th : threads)
+                th.join();
+            for (auto& chunk_result : chunk_results)
+                for (auto& formula : chunk_result)
+                    results.push_back(move(formula));
+            cout << format("block {}/{}: {} formulas", b + 1, blocks.size(),
+                           results.size())
+                 << endl;
+        }
+    }
+
+    // 手順 i と手順 j をつないだものが手筋なら out に加える
+    // inv は手順 j の逆手順を回したときの状態
+    // 同じ手筋を 2 回見つけないように、A の長さは C と同じか 1 長いものに
+    // 限り、b より前のブロックで一致するものは除く
+    void TryJoin(const int i, const int j, const vector<u16>& inv,
+                 const vector<vector<int>>& blocks, const int b,
+                 vector<Formula>& out) const {
+        const auto length_a = (int)lengths[i];
+        const auto length_c = (int)lengths[j];
+        if (length_a - length_c != 0 && length_a - length_c != 1)
+            return;
+        if (exact_keys[i] != exact_keys_inv[j])
+            return;
+        const auto state = StateData(i);
+        for (auto b2 = 0; b2 < b; b2++) {
+            auto same = true;
+            for (const auto k : blocks[b2])
+                if (StateAt(state, k) != inv[k]) {
+                    same = false;
+                    break;
+                }
+            if (same)
+                return;
+        }
+        auto n_changes = 0;
+        for (auto k = 0; k < n_compared && n_changes <= max_n_changes; k++)
+            n_changes += StateAt(state, k) != inv[k];
+        if (n_changes == 0 || n_changes > max_n_changes)
+            return;
+        auto moves = Sequence(i);
+        const auto moves_c = Sequence(j);
+        moves.insert(moves.end(), moves_c.begin(), moves_c.end());
+        if (!IsCanonical(moves) || !IsFaceRotationFollowedByOtherAxis(moves))
+            return;
+        if (is_face ? !UsesSlicesFromOutside<order>(moves)
+                    : moves.size() < 4)
+            return;
+        out.emplace_back(moves);
+    }
+
+    // 作用が同じものは、最も短いもの (同じ長さなら先に見つかったもの)
+    // だけ残す
+    // 面の手筋は中央のマスだけ見る
+    void ReduceByPermutation() {
+        auto keys = vector<string>();
+        auto costs = vector<int>();
+        keys.reserve(results.size());
+        costs.reserve(results.size());
+        for (const auto& formula : results) {
+            keys.push_back(FormulaSymmetry<order>::ComputePermutationKey(
+                formula.moves, is_face));
+            costs.push_back(formula.Cost());
+        }
+        const auto indices = SelectCheapestPerKey(keys, costs);
+        cout << format("Removed {} of {} formulas with the same permutation.",
+                       results.size() - indices.size(), results.size())
+             << endl;
+        for (auto j = 0; j < (int)indices.size(); j++)
+            if (indices[j] != j)
+                results[j] = move(results[indices[j]]);
+        results.resize(indices.size());
+    }
+
+    // 対称なもの (FormulaSymmetry) は最初の 1 つだけ残す
+    void ReduceBySymmetry() {
+        const auto symmetry = FormulaSymmetry<order>();
+        auto seen = unordered_set<string>();
+        auto n_results = 0;
+        for (auto j = 0; j < (int)results.size(); j++) {
+            if (!seen.insert(symmetry.ComputeKey(results[j].moves)).second)
+                continue;
+            if (n_results != j)
+                results[n_results] = move(results[j]);
+            n_results++;
+        }
+        results.resize(n_results);
+    }
+};
+
+// search_edge_formula.cpp の CheckValid の、中央のマスについての条件
+// 虹でも使えるなら 2、通常だけなら 1、使えないなら 0
+template <int order>
+static int CheckEdgeFormulaCenters(const vector<Move>& moves) {
+    static const auto reference_cube = [] {
+        auto cube = Cube<order, ColorType24>();
+        cube.Reset();
+        return cube;
+    }();
+    auto cube = reference_cube;
+    for (const auto& mov : moves)
+        cube.Rotate(mov);
+    auto can_use_for_rainbow_cube = true;
+    for (auto face_id = 0; face_id < 6; face_id++)
+        for (auto y = 1; y < order - 1; y++)
+            for (auto x = 1; x < order - 1; x++) {
+                const auto reference_color =
+                    reference_cube.faces[face_id]
+                        .GetIgnoringOrientation(y, x)
+                        .data;
+                const auto color =
+                    cube.faces[face_id].GetIgnoringOrientation(y, x).data;
+                if (reference_color != color) {
+                    can_use_for_rainbow_cube = false;
+                    if (reference_color / 4 != color / 4)
+                        return 0;
+                }
+            }
+    return can_use_for_rainbow_cube ? 2 : 1;
+}
+
+// search_face_formula.cpp, search_edge_formula.cpp と同じ形式で書き出す
+// それらの結果を上書きしないように、名前の最後に _mitm を付ける
+template <int order>
+static auto SearchFormulaMitmWithOrder(const bool is_face,
+                                       const int half_depth,
+                                       const int max_n_changes,
+                                       const int n_threads) {
+    auto searcher =
+        MitmFormulaSearcher<order>(is_face, half_depth, max_n_changes);
+    const auto results = searcher.Search(n_threads);
+    auto writer = FormulaWriter(format("out/{}_formula_{}_{}_mitm.bin",
+                                       is_face ? "face" : "edge", order,
+                                       half_depth * 2),
+                                true, is_face ? 0 : 2);
+    for (const auto& formula : results) {
+        if (is_face) {
+            writer.Write(formula.moves);
+            continue;
+        }
+        const auto valid = CheckEdgeFormulaCenters<order>(formula.moves);
+        if (valid != 0)
+            writer.Write(formula.moves, valid == 2 ? "1 " : "0 ");
+    }
+    writer.Close();
+    cout << format("Wrote {} formulas to `{}`.", writer.n_formulas,
+                   writer.filename)
+         << endl;
+}
+
+[[maybe_unused]] static auto SearchFormulaMitm(const bool is_face,
+                                               const int order,
+                                               const int half_depth,
+                                               const int max_n_changes,
+                                               const int n_threads) {
+    switch (order) {
+    case 4:
+        return SearchFormulaMitmWithOrder<4>(is_face, half_depth,
+                                             max_n_changes, n_threads);
+    case 5:
+        return SearchFormulaMitmWithOrder<5>(is_face, half_depth,
+                                             max_n_changes, n_threads);
+    case 6:
+        return SearchFormulaMitmWithOrder<6>(is_face, half_depth,
+                                             max_n_changes, n_threads);
+    case 7:
+        return SearchFormulaMitmWithOrder<7>(is_face, half_depth,
+                                             max_n_changes, n_threads);
+    case 8:
+        return SearchFormulaMitmWithOrder<8>(is_face, half_depth,
+                                             max_n_changes, n_threads);
+    case 9:
+        return SearchFormulaMitmWithOrder<9>(is_face, half_depth,
+                                             max_n_changes, n_threads);
+    case 10:
+        return SearchFormulaMitmWithOrder<10>(is_face, half_depth,
+                                              max_n_changes, n_threads);
+    default:
+        cerr << format("Order {} is not supported.", order) << endl;
+        abort();
+    }
+}
+
+int main(const int argc, const char* const* const argv) {
+    if (argc < 5 || (string(argv[1]) != "face" && string(argv[1]) != "edge")) {
+        cout << "Usage: " << argv[0]
+             << " <face|edge> <order> <half_depth> <max_n_changes> "
+                "[n_threads]"
+             << endl;
+        cout << "All sequences are kept in memory. For 5x5x5 face formulas, "
+                "half_depth 5 needs about 1.4 GB and half_depth 6 about "
+                "20 GB."
+             << endl;
+        return 1;
+    }
+    const auto is_face = string(argv[1]) == "face";
+    const auto order = atoi(argv[2]);
+    const auto half_depth = atoi(argv[3]);
+    const auto max_n_changes = atoi(argv[4]);
+    const auto n_threads =
+        argc >= 6 ? atoi(argv[5]) : (int)thread::hardware_concurrency();
+
+    cout << "Kind: " << argv[1] << endl;
+    cout << "Order: " << order << endl;
+    cout << "Half Depth: " << half_depth << endl;
+    cout << "Max Changes: " << max_n_changes << endl;
+    cout << "Threads: " << n_threads << endl;
+
+    SearchFormulaMitm(is_face, order, half_depth, max_n_changes, n_threads);
+}
+
+// clang++ -std=c++20 -Wall -Wextra -O3 search_formula_mitm.cpp
+// 実行: ./a.out face 5 5 8 [n_threads]
+//       長さ 10 までの面の手筋のうち、中央のマスを 8 個以下動かすものを
+//       out/face_formula_5_10_mitm.bin に書き出す
+//       ソルバで使うときは、out/face_formula_5_10.bin に名前を変える
+//       辺の手筋で max_n_changes を辺のマスの数 (24 * (order - 2)) にすると、
+//       search_edge_formula.cpp と同じ手筋が得られる
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+// ソルバの途中経過を JSON lines で出す
+// TELEMETRY_LEVEL で出す量を決める
+//   0: 何も出さない (集計の処理もコンパイル時に消える)
+//   1: 層ごとの集計 (ノード数、評価した候補数、採用率、最小スコア、時間)
+//      標準出力の層ごとの進捗の行も出す
+//   2: 1 に加えて層ごとのスコアの分布
+//   3: 2 に加えて、層ごとの盤面の表示とノードごとの出力
+// 出力先は環境変数 TELEMETRY_FILE (無ければ telemetry.jsonl に追記する)
+// 標準出力や標準エラー出力の表示と混ざらないよう、別のファイルに書く
+// まとめて書き出すので、異常終了すると最後の方が残らないことがある
+#ifndef TELEMETRY_LEVEL
+#define TELEMETRY_LEVEL 1
+#endif
+constexpr int kTelemetryLevel = TELEMETRY_LEVEL;
+
+struct Telemetry {
+    static constexpr auto kFlushSize = 1 << 16;
+    static constexpr auto kDefaultFilename = "telemetry.jsonl";
+
+    std::mutex mtx;
+    std::string buffer;
+    std::ofstream ofs;
+    std::chrono::steady_clock::time_point start;
+
+    inline Telemetry()
+        : mtx(), buffer(), ofs(), start(std::chrono::steady_clock::now()) {
+        if constexpr (kTelemetryLevel >= 1) {
+            const auto filename = std::getenv("TELEMETRY_FILE");
+            ofs.open(filename ? filename : kDefaultFilename, std::ios::app);
+            if (!ofs) {
+                std::cerr << "Failed to open "
+                          << (filename ? filename : kDefaultFilename)
+                          << std::endl;
+                abort();
+            }
+        }
+    }
+
+    inline ~Telemetry() { Flush(); }
+
+    inline static Telemetry& Instance() {
+        static auto telemetry = Telemetry();
+        return telemetry;
+    }
+
+    inline double Elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    }
+
+    inline void Write(const std::string& line) {
+        const auto lock = std::lock_guard<std::mutex>(mtx);
+        buffer += line;
+        buffer += '\n';
+        if ((int)buffer.size() >= kFlushSize)
+            FlushLocked();
+    }
+
+    inline void Flush() {
+        const auto lock = std::lock_guard<std::mutex>(mtx);
+        FlushLocked();
+    }
+
+  private:
+    inline void FlushLocked() {
+        if (buffer.empty())
+            return;
+        ofs.write(buffer.data(), buffer.size());
+        ofs.flush();
+        buffer.clear();
+    }
+};
+
+// スコアなどの分布
+struct TelemetryHistogram {
+    std::map<long long, unsigned long long> counts;
+
+    inline void Add(const long long value) { counts[value]++; }
+};
+
+// JSON lines の 1 行
+// 全ての行に event と、プログラム開始からの秒数 t が付く
+struct TelemetryRecord {
+    std::string line;
+
+    inline TelemetryRecord(const char* event)
+        : line(std::format("{{\"event\":\"{}\",\"t\":{:.3f}", event,
+                           Telemetry::Instance().Elapsed())) {}
+
+    template <typename T>
+        requires std::integral<T> || std::floating_point<T>
+    inline TelemetryRecord& Add(const char* key, const T value) {
+        if constexpr (std::integral<T>)
+            line += std::format(",\"{}\":{}", key, value);
+        else
+            line += std::format(",\"{}\":{:.6g}", key, value);
+        return *this;
+    }
+
+    inline TelemetryRecord& Add(const char* key,
+                                const TelemetryHistogram& histogram) {
+        line += std::format(",\"{}\":{{", key);
+        auto first = true;
+        for (const auto& [value, count] : histogram.counts) {
+            line += std::format("{}\"{}\":{}", first ? "" : ",", value, count);
+            first = false;
+        }
+        line += '}';
+        return *this;
+    }
+
+    inline void Emit() {
+        line += '}';
+        Telemetry::Instance().Write(line);
+    }
+};
+
+// ビームサーチの 1 層分の集計
+// 候補の数はスレッドごとに数えてから AddCandidates でまとめて足す
+// 採用した候補は、次の層以降の枠に一度は入ったものを 1 候補 1 回だけ数える
+// (同じ層の展開中に後の候補に置き換えられたものも含む)
+// スレッドごとの memo に入っただけで、層にまとめるときに負けたものは数えない
+// TELEMETRY_LEVEL が 0 なら全てのメンバ関数は何もしない
+struct LayerTelemetry {
+    const char* event;
+    int cost;
+    std::chrono::steady_clock::time_point start;
+    long long n_nodes;    // 層にあったノード
+    long long n_expanded; // そのうち展開したノード
+    std::atomic<unsigned long long> n_candidates; // 評価した候補
+    std::atomic<unsigned long long> n_accepted;   // 次の層以降に入った候補
+    long long min_score;
+    TelemetryHistogram scores;
+
+    inline LayerTelemetry(const char* event, const int cost,
+                          const long long n_nodes)
+        : event(event), cost(cost), start(), n_nodes(n_nodes), n_expanded(0),
+          n_candidates(0), n_accepted(0), min_score(-1), scores() {
+        if constexpr (kTelemetryLevel >= 1)
+            start = std::chrono::steady_clock::now();
+    }
+
+    // 1 スレッドからだけ呼ぶこと
+    inline void AddNode(const long long score) {
+        if constexpr (kTelemetryLevel >= 1) {
+            n_expanded++;
+            min_score = min_score < 0 ? score : std::min(min_score, score);
+            if constexpr (kTelemetryLevel >= 2)
+                scores.Add(score);
+        }
+    }
+
+    inline void AddCandidates(const unsigned long long candidates,
+                              const unsigned long long accepted = 0) {
+        if constexpr (kTelemetryLevel >= 1) {
+            n_candidates.fetch_add(candidates, std::memory_order_relaxed);
+            n_accepted.fetch_add(accepted, std::memory_order_relaxed);
+        }
+    }
+
+    // スレッドごとの memo を層にまとめたあとで、入った数を足す
+    inline void AddAccepted(const unsigned long long accepted) {
+        AddCandidates(0, accepted);
+    }
+
+    inline void Emit(const int beam_width) {
+        if constexpr (kTelemetryLevel >= 1) {
+            const auto seconds = std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count();
+            const auto candidates = n_candidates.load();
+            const auto accepted = n_accepted.load();
+            auto record = TelemetryRecord(event);
+            record.Add("cost", cost)
+                .Add("beam_width", beam_width)
+                .Add("nodes", n_nodes)
+                .Add("expanded", n_expanded)
+                .Add("candidates", candidates)
+                .Add("accepted", accepted)
+                .Add("accept_rate",
+                     candidates ? (double)accepted / candidates : 0.0)
+                .Add("min_score", min_score)
+                .Add("seconds", seconds);
+            if constexpr (kTelemetryLevel >= 2)
+                record.Add("scores", scores);
+            record.Emit();
+        }
+    }
+};
@@ -0,0 +1,826 @@
+#include "cube.cpp"
+
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::copy;
+using std::fill;
+using std::make_unique;
+using std::max;
+using std::optional;
+using std::swap;
+
+// 面と辺が揃って 3x3x3 に帰着したキューブを 2 フェーズ法 (Kociemba) で解く
+// 1 フェーズ目で <U, D, R2, L2, F2, B2> で解ける状態にし、2 フェーズ目で解く
+// 手数は Kaggle と同じく 90 度回転を 1 手、180 度回転を 2 手と数える
+// 1 問あたり 0.4 秒程度かかる (ThreeOrderSolver::kDefaultMaxNodes) ので、
+// 1 秒に何千問も解くような使い方には向かない
+// face_edge_pipeline.cpp は辺を揃えた後、同じプロセスで SolveThreeOrderPhase
+// を呼ぶ (-DSOLVE のバイナリは solution_edge の解を読んで解く)
+
+// 面の番号は Cube と同じで、D1, F0, R0, F1, R1, D0 がそれぞれ U, F, R, B, L, D
+// 辺と角の位置の並びは Cube::PrintSingmaster と同じ
+//   辺: UF UR UB UL DF DR DB DL FR FL BR BL (8 番以降が E スライス)
+//   角: UFR URB UBL ULF DRF DFL DLB DBR
+// 向きは、ピースの基準の色 (U か D、無ければ F か B) が位置の何番目の面にあるか
+struct ThreeOrderCubie {
+    enum { U, F, R, B, L, D };
+
+    array<i8, 8> cp, co;  // 角の位置にあるピースと向き
+    array<i8, 12> ep, eo; // 辺の位置にあるピースと向き
+
+    static constexpr auto kEdgeFaces = array<array<i8, 2>, 12>{
+        array<i8, 2>{U, F}, {U, R}, {U, B}, {U, L}, {D, F}, {D, R},
+        {D, B},             {D, L}, {F, R}, {F, L}, {B, R}, {B, L},
+    };
+    static constexpr auto kCornerFaces = array<array<i8, 3>, 8>{
+        array<i8, 3>{U, F, R}, {U, R, B}, {U, B, L}, {U, L, F},
+        {D, R, F},             {D, F, L}, {D, L, B}, {D, B, R},
+    };
+
+    inline static ThreeOrderCubie Solved() {
+        auto cubie = ThreeOrderCubie();
+        for (auto i = 0; i < 8; i++)
+            cubie.cp[i] = (i8)i, cubie.co[i] = 0;
+        for (auto i = 0; i < 12; i++)
+            cubie.ep[i] = (i8)i, cubie.eo[i] = 0;
+        return cubie;
+    }
+
+    // this の後に rhs を適用したもの
+    // rhs.cp[i] は、位置 i に移ってくるピースが元々あった位置
+    inline ThreeOrderCubie Multiply(const ThreeOrderCubie& rhs) const {
+        auto result = ThreeOrderCubie();
+        for (auto i = 0; i < 8; i++) {
+            result.cp[i] = cp[rhs.cp[i]];
+            result.co[i] = (i8)((co[rhs.cp[i]] + rhs.co[i]) % 3);
+        }
+        for (auto i = 0; i < 12; i++) {
+            result.ep[i] = ep[rhs.ep[i]];
+            result.eo[i] = eo[rhs.ep[i]] ^ rhs.eo[i];
+        }
+        return result;
+    }
+
+    // 3x3x3 に帰着したキューブから読み取る
+    // 辺は各辺の端から 2 番目のマス、角は角のマスを見る
+    // 存在しないピースがあったり、解けない状態だったりすれば nullopt
+    template <int order>
+    inline static optional<ThreeOrderCubie>
+    FromCube(const Cube<order, ColorType6>& cube) {
+        static_assert(order >= 3);
+        constexpr auto o = order - 1;
+        static constexpr auto kEdgePositions =
+            array<array<FaceletPosition, 2>, 12>{
+                array<FaceletPosition, 2>{FaceletPosition{U, o, 1}, {F, 0, 1}},
+                {FaceletPosition{U, 1, o}, {R, 0, 1}},
+                {FaceletPosition{U, 0, 1}, {B, 0, 1}},
+                {FaceletPosition{U, 1, 0}, {L, 0, 1}},
+                {FaceletPosition{D, 0, 1}, {F, o, 1}},
+                {FaceletPosition{D, 1, o}, {R, o, 1}},
+                {FaceletPosition{D, o, 1}, {B, o, 1}},
+                {FaceletPosition{D, 1, 0}, {L, o, 1}},
+                {FaceletPosition{F, 1, o}, {R, 1, 0}},
+                {FaceletPosition{F, 1, 0}, {L, 1, o}},
+                {FaceletPosition{B, 1, 0}, {R, 1, o}},
+                {FaceletPosition{B, 1, o}, {L, 1, 0}},
+            };
+        static constexpr auto kCornerPositions =
+            array<array<FaceletPosition, 3>, 8>{
+                array<FaceletPosition, 3>{FaceletPosition{U, o, o}, {F, 0, o},
+                                          {R, 0, 0}},
+                {FaceletPosition{U, 0, o}, {R, 0, o}, {B, 0, 0}},
+                {FaceletPosition{U, 0, 0}, {B, 0, o}, {L, 0, 0}},
+                {FaceletPosition{U, o, 0}, {L, 0, o}, {F, 0, 0}},
+                {FaceletPosition{D, 0, o}, {R, o, 0}, {F, o, o}},
+                {FaceletPosition{D, 0, 0}, {F, o, 0}, {L, o, o}},
+                {FaceletPosition{D, o, 0}, {L, o, 0}, {B, o, o}},
+                {FaceletPosition{D, o, o}, {B, o, 0}, {R, o, o}},
+            };
+
+        auto cubie = ThreeOrderCubie();
+        auto used_corners = 0, used_edges = 0;
+        for (auto i = 0; i < 8; i++) {
+            array<i8, 3> colors;
+            for (auto k = 0; k < 3; k++)
+                colors[k] = cube.Get(kCornerPositions[i][k]).data;
+            auto found = false;
+            for (auto piece = 0; piece < 8 && !found; piece++)
+                for (auto ori = 0; ori < 3 && !found; ori++)
+                    if (colors[ori] == kCornerFaces[piece][0] &&
+                        colors[(ori + 1) % 3] == kCornerFaces[piece][1] &&
+                        colors[(ori + 2) % 3] == kCornerFaces[piece][2]) {
+                        cubie.cp[i] = (i8)piece;
+                        cubie.co[i] = (i8)ori;
+                        used_corners |= 1 << piece;
+                        found = true;
+                    }
+            if (!found)
+                return std::nullopt;
+        }
+        for (auto i = 0; i < 12; i++) {
+            const auto c0 = cube.Get(kEdgePositions[i][0]).data;
+            const auto c1 = cube.Get(kEdgePositions[i][1]).data;
+            auto found = false;
+            for (auto piece = 0; piece < 12 && !found; piece++)
+                for (auto ori = 0; ori < 2 && !found; ori++)
+                    if ((ori == 0 ? c0 : c1) == kEdgeFaces[piece][0] &&
+                        (ori == 0 ? c1 : c0) == kEdgeFaces[piece][1]) {
+                        cubie.ep[i] = (i8)piece;
+                        cubie.eo[i] = (i8)ori;
+                        used_edges |= 1 << piece;
+                        found = true;
+                    }
+            if (!found)
+                return std::nullopt;
+        }
+        if (used_corners != (1 << 8) - 1 || used_edges != (1 << 12) - 1)
+            return std::nullopt;
+        if (!cubie.IsSolvable())
+            return std::nullopt;
+        return cubie;
+    }
+
+    template <size_t n> inline static bool PermutationParity(array<i8, n> p) {
+        auto parity = false;
+        for (auto i = 0; i < (int)n; i++)
+            while (p[i] != i) {
+                swap(p[i], p[p[i]]);
+                parity = !parity;
+            }
+        return parity;
+    }
+
+    // 偶数のキューブでは、辺のフェーズで角のパリティに辺の置換を合わせている
+    // ここで合っていなければ、それより前の段階がおかしい
+    inline bool IsSolvable() const {
+        auto twist = 0, flip = 0;
+        for (const auto o : co)
+            twist += o;
+        for (const auto o : eo)
+            flip += o;
+        return twist % 3 == 0 && flip % 2 == 0 &&
+               PermutationParity(cp) == PermutationParity(ep);
+    }
+};
+
+// 2 フェーズ法で使う座標
+namespace three_order_coordinate {
+constexpr auto kNTwist = 6561;  // 3^8 (角の向き、8 個全部持つ)
+constexpr auto kNFlip = 4096;   // 2^12 (辺の向き、12 個全部持つ)
+constexpr auto kNSlice = 495;   // C(12, 4) (E スライスの辺がある位置の組)
+constexpr auto kNCPerm = 40320; // 8! (角の置換)
+constexpr auto kNEPerm = 40320; // 8! (U, D 面の辺の置換)
+constexpr auto kNSPerm = 24;    // 4! (E スライスの辺の置換)
+
+// 4 bit 立った 12 bit のマスクと番号の対応
+static const auto kSliceMasks = [] {
+    auto masks = array<u16, kNSlice>();
+    auto n = 0;
+    for (auto mask = 0; mask < 1 << 12; mask++)
+        if (__builtin_popcount(mask) == 4)
+            masks[n++] = (u16)mask;
+    return masks;
+}();
+static const auto kSliceIndices = [] {
+    auto indices = array<u16, 1 << 12>();
+    for (auto i = 0; i < kNSlice; i++)
+        indices[kSliceMasks[i]] = (u16)i;
+    return indices;
+}();
+constexpr auto kSolvedSlice = 0b1111'0000'0000;
+
+template <size_t n> inline int RankPermutation(const array<i8, n>& p) {
+    auto rank = 0;
+    for (auto i = 0; i < (int)n; i++) {
+        auto smaller = 0;
+        for (auto j = i + 1; j < (int)n; j++)
+            smaller += p[j] < p[i];
+        rank = rank * ((int)n - i) + smaller;
+    }
+    return rank;
+}
+
+template <size_t n> inline array<i8, n> UnrankPermutation(int rank) {
+    auto lehmer = array<int, n>();
+    for (auto i = (int)n - 1; i >= 0; i--) {
+        lehmer[i] = rank % ((int)n - i);
+        rank /= (int)n - i;
+    }
+    auto result = array<i8, n>();
+    auto used = 0;
+    for (auto i = 0; i < (int)n; i++) {
+        auto k = lehmer[i];
+        for (auto v = 0; v < (int)n; v++)
+            if (!(used >> v & 1) && k-- == 0) {
+                result[i] = (i8)v;
+                used |= 1 << v;
+                break;
+            }
+    }
+    return result;
+}
+
+inline int Twist(const ThreeOrderCubie& c) {
+    auto result = 0;
+    for (auto i = 7; i >= 0; i--)
+        result = result * 3 + c.co[i];
+    return result;
+}
+inline int Flip(const ThreeOrderCubie& c) {
+    auto result = 0;
+    for (auto i = 11; i >= 0; i--)
+        result = result * 2 + c.eo[i];
+    return result;
+}
+inline int Slice(const ThreeOrderCubie& c) {
+    auto mask = 0;
+    for (auto i = 0; i < 12; i++)
+        if (c.ep[i] >= 8)
+            mask |= 1 << i;
+    return kSliceIndices[mask];
+}
+inline int CPerm(const ThreeOrderCubie& c) { return RankPermutation(c.cp); }
+inline int EPerm(const ThreeOrderCubie& c) {
+    auto p = array<i8, 8>();
+    for (auto i = 0; i < 8; i++)
+        p[i] = c.ep[i];
+    return RankPermutation(p);
+}
+inline int SPerm(const ThreeOrderCubie& c) {
+    auto p = array<i8, 4>();
+    for (auto i = 0; i < 4; i++)
+        p[i] = (i8)(c.ep[8 + i] - 8);
+    return RankPermutation(p);
+}
+} // namespace three_order_coordinate
+
+// 移動表と枝刈り表
+// 作るのに数秒かかるので、一度作ったらファイルに書き出して mmap で読む
+struct ThreeOrderTables {
+    static constexpr auto kMagic = 0x3333'0001ull;
+    static constexpr auto kNMoves = 18;  // 面 * 3 + (90 度回転の回数 - 1)
+    static constexpr auto kNMoves2 = 10; // 2 フェーズ目で使う手
+    static constexpr auto kMoves2 =
+        array<i8, kNMoves2>{0, 1, 2, 15, 16, 17, 4, 7, 10, 13};
+
+    u64 magic;
+    array<array<u16, kNMoves>, three_order_coordinate::kNTwist> twist_move;
+    array<array<u16, kNMoves>, three_order_coordinate::kNFlip> flip_move;
+    array<array<u16, kNMoves>, three_order_coordinate::kNSlice> slice_move;
+    array<array<u16, kNMoves2>, three_order_coordinate::kNCPerm> cperm_move;
+    array<array<u16, kNMoves2>, three_order_coordinate::kNEPerm> eperm_move;
+    array<array<u8, kNMoves2>, three_order_coordinate::kNSPerm> sperm_move;
+    // ゴールまでの手数の下界
+    array<u8, three_order_coordinate::kNTwist * three_order_coordinate::kNSlice>
+        twist_slice_prune;
+    array<u8, three_order_coordinate::kNFlip * three_order_coordinate::kNSlice>
+        flip_slice_prune;
+    array<u8, three_order_coordinate::kNCPerm * three_order_coordinate::kNSPerm>
+        cperm_sperm_prune;
+    array<u8, three_order_coordinate::kNEPerm * three_order_coordinate::kNSPerm>
+        eperm_sperm_prune;
+
+    inline static int MoveCost(const int move) { return move % 3 == 1 ? 2 : 1; }
+
+    // 各面を Cube::GetFaceRotateMove で回した状態 (Cube<3> で実際に回して作る)
+    inline static const auto& MoveCubies() {
+        static const auto move_cubies = [] {
+            using Cube3 = Cube<3, ColorType6>;
+            auto result = array<ThreeOrderCubie, kNMoves>();
+            for (auto face = 0; face < 6; face++) {
+                auto cube = Cube3();
+                cube.Reset();
+                for (auto k = 0; k < 3; k++) {
+                    cube.Rotate(Cube3::GetFaceRotateMove((i8)face));
+                    result[face * 3 + k] = *ThreeOrderCubie::FromCube(cube);
+                }
+            }
+            return result;
+        }();
+        return move_cubies;
+    }
+    // 重みが 1 か 2 の幅優先探索
+    template <typename Next>
+    inline static void BuildPruneTable(u8* table, const int n_states,
+                                       const int goal, const int n_moves,
+                                       const Next& next) {
+        fill(table, table + n_states, (u8)255);
+        table[goal] = 0;
+        for (auto depth = 0; depth < 254; depth++) {
+            auto updated = false;
+            for (auto state = 0; state < n_states; state++) {
+                if (table[state] != depth)
+                    continue;
+                for (auto m = 0; m < n_moves; m++) {
+                    const auto [next_state, cost] = next(state, m);
+                    if (table[next_state] > depth + cost) {
+                        table[next_state] = (u8)(depth + cost);
+                        updated = true;
+                    }
+                }
+            }
+            if (!updated) {
+                // depth + 1 の状態が残っているかもしれない
+                auto remaining = false;
+                for (auto state = 0; state < n_states && !remaining; state++)
+                    remaining = table[state] > depth && table[state] != 255;
+                if (!remaining)
+                    break;
+            }
+        }
+    }
+
+    inline void Build() {
+        using namespace three_order_coordinate;
+        magic = kMagic;
+        const auto& move_cubies = MoveCubies();
+        const auto solved = ThreeOrderCubie::Solved();
+
+        for (auto twist = 0; twist < kNTwist; twist++) {
+            auto cubie = solved;
+            for (auto i = 0, t = twist; i < 8; i++, t /= 3)
+                cubie.co[i] = (i8)(t % 3);
+            for (auto m = 0; m < kNMoves; m++)
+                twist_move[twist][m] = (u16)Twist(cubie.Multiply(move_cubies[m]));
+        }
+        for (auto flip = 0; flip < kNFlip; flip++) {
+            auto cubie = solved;
+            for (auto i = 0; i < 12; i++)
+                cubie.eo[i] = (i8)(flip >> i & 1);
+            for (auto m = 0; m < kNMoves; m++)
+                flip_move[flip][m] = (u16)Flip(cubie.Multiply(move_cubies[m]));
+        }
+        for (auto slice = 0; slice < kNSlice; slice++) {
+            auto cubie = solved;
+            for (auto i = 0, in_slice = 8, out_slice = 0; i < 12; i++)
+                cubie.ep[i] = (i8)(kSliceMasks[slice] >> i & 1 ? in_slice++
+                                                                : out_slice++);
+            for (auto m = 0; m < kNMoves; m++)
+                slice_move[slice][m] = (u16)Slice(cubie.Multiply(move_cubies[m]));
+        }
+        for (auto cperm = 0; cperm < kNCPerm; cperm++) {
+            auto cubie = solved;
+            cubie.cp = UnrankPermutation<8>(cperm);
+            for (auto m = 0; m < kNMoves2; m++)
+                cperm_move[cperm][m] =
+                    (u16)CPerm(cubie.Multiply(move_cubies[kMoves2[m]]));
+        }
+        for (auto eperm = 0; eperm < kNEPerm; eperm++) {
+            auto cubie = solved;
+            const auto p = UnrankPermutation<8>(eperm);
+            copy(p.begin(), p.end(), cubie.ep.begin());
+            for (auto m = 0; m < kNMoves2; m++)
+                eperm_move[eperm][m] =
+                    (u16)EPerm(cubie.Multiply(move_cubies[kMoves2[m]]));
+        }
+        for (auto sperm = 0; sperm < kNSPerm; sperm++) {
+            auto cubie = solved;
+            const auto p = UnrankPermutation<4>(sperm);
+            for (auto i = 0; i < 4; i++)
+                cubie.ep[8 + i] = (i8)(p[i] + 8);
+            for (auto m = 0; m < kNMoves2; m++)
+                sperm_move[sperm][m] =
+                    (u8)SPerm(cubie.Multiply(move_cubies[kMoves2[m]]));
+        }
+
+        const auto solved_slice = kSliceIndices[kSolvedSlice];
+        BuildPruneTable(
+            twist_slice_prune.data(), kNTwist * kNSlice, solved_slice, kNMoves,
+            [&](const int state, const int m) {
+                const auto twist = state / kNSlice, slice = state % kNSlice;
+                return pair<int, int>{twist_move[twist][m] * kNSlice +
+                                          slice_move[slice][m],
+                                      MoveCost(m)};
+            });
+        BuildPruneTable(
+            flip_slice_prune.data(), kNFlip * kNSlice, solved_slice, kNMoves,
+            [&](const int state, const int m) {
+                const auto flip = state / kNSlice, slice = state % kNSlice;
+                return pair<int, int>{flip_move[flip][m] * kNSlice +
+                                          slice_move[slice][m],
+                                      MoveCost(m)};
+            });
+        BuildPruneTable(
+            cperm_sperm_prune.data(), kNCPerm * kNSPerm, 0, kNMoves2,
+            [&](const int state, const int m) {
+                const auto cperm = state / kNSPerm, sperm = state % kNSPerm;
+                return pair<int, int>{cperm_move[cperm][m] * kNSPerm +
+                                          sperm_move[sperm][m],
+                                      MoveCost(kMoves2[m])};
+            });
+        BuildPruneTable(
+            eperm_sperm_prune.data(), kNEPerm * kNSPerm, 0, kNMoves2,
+            [&](const int state, const int m) {
+                const auto eperm = state / kNSPerm, sperm = state % kNSPerm;
+                return pair<int, int>{eperm_move[eperm][m] * kNSPerm +
+                                          sperm_move[sperm][m],
+                                      MoveCost(kMoves2[m])};
+            });
+    }
+
+    // filename があればそれを mmap し、無ければ作って書き出してから mmap する
+    // プロセスの終わりまで解放しない
+    inline static const ThreeOrderTables& Load(const string& filename) {
+        const auto try_map = [&]() -> const ThreeOrderTables* {
+            const auto fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+                return nullptr;
+            struct stat st;
+            if (fstat(fd, &st) != 0 ||
+                st.st_size != (off_t)sizeof(ThreeOrderTables)) {
+                close(fd);
+                return nullptr;
+            }
+            const auto addr = mmap(nullptr, sizeof(ThreeOrderTables),
+                                   PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED)
+                return nullptr;
+            const auto tables = (const ThreeOrderTables*)addr;
+            if (tables->magic != kMagic) {
+                munmap(addr, sizeof(ThreeOrderTables));
+                return nullptr;
+            }
+            return tables;
+        };
+        if (const auto tables = try_map())
+            return *tables;
+
+        cerr << format("Building `{}`...", filename) << endl;
+        const auto t0 = TimeBudget();
+        auto tables = make_unique<ThreeOrderTables>();
+        tables->Build();
+        cerr << format("Built in {:.1f}s.", t0.Elapsed()) << endl;
+        const auto tmp_filename = filename + ".tmp";
+        {
+            auto ofs = ofstream(tmp_filename, ios::binary);
+            ofs.write((const char*)tables.get(), sizeof(ThreeOrderTables));
+            if (!ofs.good()) {
+                cerr << format("Cannot write file `{}`.", tmp_filename)
+                     << endl;
+                // 書き出せなくても解くことはできる
+                return *tables.release();
+            }
+        }
+        std::rename(tmp_filename.c_str(), filename.c_str());
+        if (const auto mapped = try_map())
+            return *mapped;
+        return *tables.release();
+    }
+};
+
+struct ThreeOrderSolver {
+    // 解が見つかった後、これだけ探索したら打ち切る
+    // 5x5x5 に 40 手の面の回転をかけたもの 20 個で測ると、1 問あたり
+    //   10^6: 31.2 手, 0.09 秒
+    //   10^7: 27.6 手, 0.43 秒
+    //   3*10^7: 27.2 手, 1.14 秒
+    //   10^8: 26.4 手, 3.32 秒
+    // 面と辺を揃えるのに比べれば 10^7 でも十分短いので、これを使う
+    static constexpr auto kDefaultMaxNodes = (u64)10000000;
+
+    const ThreeOrderTables& tables;
+    u64 max_nodes;
+
+    inline ThreeOrderSolver(
+        const string& table_file = "out/three_order_tables.bin",
+        const u64 max_nodes = kDefaultMaxNodes)
+        : tables(ThreeOrderTables::Load(table_file)), max_nodes(max_nodes) {}
+
+    // 3x3x3 に帰着した cube を解く Formula を返す
+    // 面の回転 (depth が 0 か order-1) だけを使う
+    // 解けなければ nullopt を返す (既に揃っていれば空の Formula)
+    template <int order>
+    inline optional<Formula> Solve(const Cube<order, ColorType6>& cube) const {
+        const auto cubie = ThreeOrderCubie::FromCube(cube);
+        if (!cubie) {
+            cerr << "The cube is not reduced to a solvable 3x3x3." << endl;
+            return std::nullopt;
+        }
+        const auto moves = Search(*cubie);
+        if (!moves) {
+            cerr << "No 3x3x3 solution was found." << endl;
+            return std::nullopt;
+        }
+        auto formula = Formula();
+        for (const auto m : *moves) {
+            const auto mov =
+                Cube<order, ColorType6>::GetFaceRotateMove((i8)(m / 3));
+            switch (m % 3) {
+            case 0:
+                formula.moves.push_back(mov);
+                break;
+            case 1:
+                formula.moves.push_back(mov);
+                formula.moves.push_back(mov);
+                break;
+            case 2:
+                formula.moves.push_back(mov.Inv());
+                break;
+            }
+        }
+        return formula;
+    }
+
+  private:
+    static constexpr auto kNotFound = 9999; // SearchState::best_cost の初期値
+
+    struct SearchState {
+        ThreeOrderCubie start;
+        vector<int> moves;
+        int best_cost;
+        vector<int> best_moves;
+        u64 n_nodes;
+    };
+
+    inline static bool IsOpposite(const int face0, const int face1) {
+        static constexpr auto kOpposite = array<int, 6>{5, 3, 4, 1, 2, 0};
+        return kOpposite[face0] == face1;
+    }
+
+    // 同じ面を続けて回さない、向かい合う面は番号の小さい方から回す
+    inline static bool CanFollow(const int last_face, const int face) {
+        if (last_face < 0)
+            return true;
+        if (face == last_face)
+            return false;
+        return !(IsOpposite(last_face, face) && face < last_face);
+    }
+
+    // 見つからなければ nullopt を返す
+    inline optional<vector<int>> Search(const ThreeOrderCubie& cubie) const {
+        using namespace three_order_coordinate;
+        auto state = SearchState{cubie, {}, kNotFound, {}, 0};
+        const auto twist = Twist(cubie), flip = Flip(cubie),
+                   slice = Slice(cubie);
+        for (auto bound = Phase1Heuristic(twist, flip, slice);
+             bound < state.best_cost; bound++) {
+            Phase1(state, twist, flip, slice, 0, bound, -1);
+            if (state.best_cost != kNotFound && state.n_nodes > max_nodes)
+                break;
+        }
+        if (state.best_cost == kNotFound)
+            return std::nullopt;
+        return state.best_moves;
+    }
+
+    inline int Phase1Heuristic(const int twist, const int flip,
+                               const int slice) const {
+        using namespace three_order_coordinate;
+        return max(tables.twist_slice_prune[twist * kNSlice + slice],
+                   tables.flip_slice_prune[flip * kNSlice + slice]);
+    }
+
+    inline int Phase2Heuristic(const int cperm, const int eperm,
+                               const int sperm) const {
+        using namespace three_order_coordinate;
+        return max(tables.cperm_sperm_prune[cperm * kNSPerm + sperm],
+                   tables.eperm_sperm_prune[eperm * kNSPerm + sperm]);
+    }
+
+    inline void Phase1(SearchState& state, const int twist, const int flip,
+                       const int slice, const int cost, const int bound,
+                       const int last_face) const {
+        state.n_nodes++;
+        const auto h = Phase1Heuristic(twist, flip, slice);
+        if (cost + h > bound)
+            return;
+        if (h == 0 && cost == bound) {
+            // 2 フェーズ目の手で終わるなら、もっと短い 1 フェーズ目がある
+            if (!state.moves.empty()) {
+                const auto last = state.moves.back();
+                for (const auto m : ThreeOrderTables::kMoves2)
+                    if (m == last)
+                        return;
+            }
+            StartPhase2(state, cost);
+            return;
+        }
+        if (state.best_cost != kNotFound && state.n_nodes > max_nodes)
+            return;
+        for (auto m = 0; m < ThreeOrderTables::kNMoves; m++) {
+            if (!CanFollow(last_face, m / 3))
+                continue;
+            state.moves.push_back(m);
+            Phase1(state, tables.twist_move[twist][m], tables.flip_move[flip][m],
+                   tables.slice_move[slice][m],
+                   cost + ThreeOrderTables::MoveCost(m), bound, m / 3);
+            state.moves.pop_back();
+        }
+    }
+
+    inline void StartPhase2(SearchState& state, const int phase1_cost) const {
+        using namespace three_order_coordinate;
+        auto cubie = state.start;
+        for (const auto m : state.moves)
+            cubie = cubie.Multiply(ThreeOrderTables::MoveCubies()[m]);
+        const auto cperm = CPerm(cubie), eperm = EPerm(cubie),
+                   sperm = SPerm(cubie);
+        const auto last_face = state.moves.empty() ? -1 : state.moves.back() / 3;
+        const auto n_phase1_moves = state.moves.size();
+        for (auto bound = Phase2Heuristic(cperm, eperm, sperm);
+             phase1_cost + bound < state.best_cost; bound++) {
+            if (Phase2(state, cperm, eperm, sperm, 0, bound, last_face)) {
+                state.best_cost = phase1_cost + bound;
+                state.best_moves = state.moves;
+                state.moves.resize(n_phase1_moves);
+                break;
+            }
+        }
+    }
+
+    // 見つかったら state.moves に手を残したまま true を返す
+    inline bool Phase2(SearchState& state, const int cperm, const int eperm,
+                       const int sperm, const int cost, const int bound,
+                       const int last_face) const {
+        state.n_nodes++;
+        const auto h = Phase2Heuristic(cperm, eperm, sperm);
+        if (cost + h > bound)
+            return false;
+        if (h == 0)
+            return cost == bound;
+        for (auto i = 0; i < ThreeOrderTables::kNMoves2; i++) {
+            const auto m = ThreeOrderTables::kMoves2[i];
+            if (!CanFollow(last_face, m / 3))
+                continue;
+            state.moves.push_back(m);
+            if (Phase2(state, tables.cperm_move[cperm][i],
+                       tables.eperm_move[eperm][i], tables.sperm_move[sperm][i],
+                       cost + ThreeOrderTables::MoveCost(m), bound, m / 3))
+                return true;
+            state.moves.pop_back();
+        }
+        return false;
+    }
+};
+
+// 面と辺を揃える解 (face_solution, edge_solution) に続けて 3x3x3 を解き、
+// 全体の解を返す
+// 3x3x3 が解けないか、全体の解で初期状態が揃わなければ nullopt を返す
+template <int order>
+static optional<Formula> SolveThreeOrderPhase(const ThreeOrderSolver& solver,
+                                              const Formula& sample_formula,
+                                              const Formula& face_solution,
+                                              const Formula& edge_solution) {
+    auto cube = Cube<order, ColorType6>();
+    cube.Reset();
+    cube.RotateInv(sample_formula);
+    cube.Rotate(face_solution);
+    cube.Rotate(edge_solution);
+    const auto three_order_solution = solver.Solve(cube);
+    if (!three_order_solution)
+        return std::nullopt;
+
+    auto solution = face_solution;
+    for (const auto& mov : edge_solution.moves)
+        solution.moves.push_back(mov);
+    for (const auto& mov : three_order_solution->moves)
+        solution.moves.push_back(mov);
+
+    // 初期状態に全体の解を当てはめて、揃うことを確かめる
+    auto solved_cube = Cube<order, ColorType6>();
+    solved_cube.Reset();
+    auto check_cube = solved_cube;
+    check_cube.RotateInv(sample_formula);
+    check_cube.Rotate(solution);
+    for (auto face_id = 0; face_id < 6; face_id++)
+        for (auto y = 0; y < order; y++)
+            for (auto x = 0; x < order; x++)
+                if (check_cube.Get(face_id, y, x) !=
+                    solved_cube.Get(face_id, y, x)) {
+                    cerr << "The solution does not solve the cube." << endl;
+                    check_cube.Display();
+                    return std::nullopt;
+                }
+    return solution;
+}
+
+// 面と辺の解 (solution_edge/{id}_best.txt) に続けて 3x3x3 を解き、
+// 全体の解を solution_three_order/{id}_best.txt に書き込む
+// 全体の解で初期状態が揃わなければ書き込まない
+template <int order>
+static void SolveWithOrder(const int problem_id, const bool is_normal,
+                           const Formula& sample_formula,
+                           const ThreeOrderSolver& solver) {
+    if (!is_normal) {
+        cerr << format("Problem {} is not normal.", problem_id) << endl;
+        return;
+    }
+
+    auto face_solution = Formula();
+    auto edge_solution = Formula();
+    if constexpr (order != 3) {
+        const auto edge_solution_file =
+            format("solution_edge/{}_best.txt", problem_id);
+        auto ifs = ifstream(edge_solution_file);
+        if (!ifs.good()) {
+            cerr << format("Cannot open file `{}`.", edge_solution_file)
+                 << endl;
+            return;
+        }
+        string line;
+        getline(ifs, line); // 面の解
+        face_solution = Formula(line);
+        getline(ifs, line); // 面のスコアを読み飛ばす
+        getline(ifs, line); // 辺の解
+        edge_solution = Formula(line);
+    }
+
+    const auto t0 = TimeBudget();
+    const auto found = SolveThreeOrderPhase<order>(
+        solver, sample_formula, face_solution, edge_solution);
+    if (!found) {
+        cerr << format("Failed to solve problem {}.", problem_id) << endl;
+        return;
+    }
+    const auto& solution = *found;
+    cout << format("problem_id={} face={} edge={} three_order={} total={} "
+                   "({:.2f}s)",
+                   problem_id, face_solution.Cost(), edge_solution.Cost(),
+                   solution.Cost() - face_solution.Cost() -
+                       edge_solution.Cost(),
+                   solution.Cost(), t0.Elapsed())
+         << endl;
+
+    const auto best_solution_file =
+        format("solution_three_order/{}_best.txt", problem_id);
+    auto best_score = 99999;
+    if (auto ifs_best = ifstream(best_solution_file); ifs_best.good()) {
+        string line;
+        getline(ifs_best, line); // 解を読み飛ばす
+        getline(ifs_best, line);
+        if (!line.empty())
+            best_score = stoi(line);
+    }
+    if (solution.Cost() < best_score) {
+        auto ofs_best = ofstream(best_solution_file);
+        if (ofs_best.good()) {
+            solution.Print(ofs_best);
+            ofs_best << endl << solution.Cost() << endl;
+        } else {
+            cerr << format("Cannot open file `{}`.", best_solution_file)
+                 << endl;
+        }
+    }
+}
+
+[[maybe_unused]] static void Solve(const int problem_id,
+                                   const ThreeOrderSolver& solver) {
+    const auto filename_puzzles = "../input/puzzles.csv";
+    const auto filename_sample = "../input/sample_submission.csv";
+    const auto [order, is_normal, sample_formula] =
+        ReadKaggleInput(filename_puzzles, filename_sample, problem_id);
+    switch (order) {
+    case 3:
+        SolveWithOrder<3>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 4:
+        SolveWithOrder<4>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 5:
+        SolveWithOrder<5>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 6:
+        SolveWithOrder<6>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 7:
+        SolveWithOrder<7>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 8:
+        SolveWithOrder<8>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 9:
+        SolveWithOrder<9>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 10:
+        SolveWithOrder<10>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 19:
+        SolveWithOrder<19>(problem_id, is_normal, sample_formula, solver);
+        break;
+    case 33:
+        SolveWithOrder<33>(problem_id, is_normal, sample_formula, solver);
+        break;
+    default:
+        assert(false);
+    }
+}
+
+// clang++ -std=c++20 -Wall -Wextra -O3 three_order_cube.cpp -DSOLVE
+#ifdef SOLVE
+int main(const int argc, const char* const* const argv) {
+    // 複数の problem_id を渡すと、枝刈り表を使い回して順に解く
+    if (argc < 2) {
+        cerr << format("Usage: {} <problem_id>...", argv[0]) << endl;
+        return 1;
+    }
+    const auto solver = ThreeOrderSolver();
+    for (auto i = 1; i < argc; i++)
+        Solve(atoi(argv[i]), solver);
+}
+#endif
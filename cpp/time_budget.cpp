@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ビームサーチ 1 回分の、層の処理にかかった時間と層の数
+// 解き直すときのビーム幅の見積もりに使う
+struct BeamRoundStats {
+    int n_layers;
+    double layer_seconds;
+    // ビーム幅 1 あたりに確保するメモリ (バイト)
+    double bytes_per_beam_width;
+
+    inline BeamRoundStats()
+        : n_layers(0), layer_seconds(0.0), bytes_per_beam_width(0.0) {}
+
+    inline void AddLayer(const double seconds) {
+        n_layers++;
+        layer_seconds += seconds;
+    }
+};
+
+// --time-budget <秒> で指定された制限時間
+// 層 1 つの処理にかかる時間はビーム幅にほぼ比例するとして、次のビーム幅を
+// 決める
+struct TimeBudget {
+    // 1 回で広げるビーム幅の倍率の上限
+    static constexpr auto kMaxGrowth = 4.0;
+    // ビーム幅に比例して確保するメモリの上限
+    static constexpr auto kMaxBeamMemoryBytes = 8.0 * (1ull << 30);
+
+    std::chrono::steady_clock::time_point start;
+    double seconds; // 0 以下なら制限なし
+
+    inline TimeBudget(const double seconds = 0.0)
+        : start(std::chrono::steady_clock::now()), seconds(seconds) {}
+
+    inline bool Enabled() const { return seconds > 0.0; }
+
+    inline double Elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+            .count();
+    }
+
+    inline double Remaining() const { return seconds - Elapsed(); }
+
+    inline bool IsOver() const { return Enabled() && Remaining() <= 0.0; }
+
+    // beam_width の 1 回の探索に round_seconds 秒かかったとき、同じ層の数で
+    // 残り時間に収まる最大のビーム幅
+    // 層の外の時間 (準備など) はビーム幅によらないとして差し引く
+    // 見積もりが外れても締め切りを守れるように 2 割の余裕を持たせる
+    // 1 回で kMaxGrowth 倍より広げず、メモリも kMaxBeamMemoryBytes に収める
+    inline int FitBeamWidth(const int beam_width, const double round_seconds,
+                            const BeamRoundStats& stats) const {
+        // 層を数えていなければ、全体を 1 層とみなす
+        const auto n_layers = std::max(stats.n_layers, 1);
+        const auto layer_seconds =
+            stats.n_layers == 0 ? round_seconds : stats.layer_seconds;
+        const auto overhead_seconds =
+            std::max(round_seconds - layer_seconds, 0.0);
+        // 1 層で 1 秒に処理できるビーム幅
+        const auto throughput =
+            (double)beam_width * n_layers / std::max(layer_seconds, 1e-3);
+        std::cerr << std::format("throughput={:.1f} beam_width*layers/s "
+                                 "layers={} remaining={:.1f}s",
+                                 throughput, n_layers, Remaining())
+                  << std::endl;
+        auto next_beam_width =
+            std::max(Remaining() * 0.8 - overhead_seconds, 0.0) * throughput /
+            n_layers;
+        next_beam_width = std::min(next_beam_width, beam_width * kMaxGrowth);
+        if (stats.bytes_per_beam_width > 0.0)
+            next_beam_width =
+                std::min(next_beam_width,
+                         kMaxBeamMemoryBytes / stats.bytes_per_beam_width);
+        next_beam_width = std::min(next_beam_width, (double)INT_MAX);
+        return (int)next_beam_width;
+    }
+
+    // コマンドライン引数から --time-budget <秒> を取り除いて読む
+    inline static TimeBudget FromArgs(std::vector<const char*>& args) {
+        auto seconds = 0.0;
+        for (auto i = 0; i < (int)args.size(); i++) {
+            if (std::string(args[i]) != "--time-budget")
+                continue;
+            if (i + 1 >= (int)args.size()) {
+                std::cerr << "--time-budget requires seconds" << std::endl;
+                abort();
+            }
+            seconds = std::stod(args[i + 1]);
+            args.erase(args.begin() + i, args.begin() + i + 2);
+            break;
+        }
+        return TimeBudget(seconds);
+    }
+};
@@ -2,6 +2,7 @@
 #include <array>
 #include <bitset>
 #include <cassert>
+#include <chrono>
 #include <format>
 #include <fstream>
 #include <iostream>
@@ -11,6 +12,9 @@
 #include <string>
 #include <vector>
 
+#include "telemetry.cpp"
+#include "time_budget.cpp"
+
 using std::array;
 using std::bitset;
 using std::cerr;
@@ -667,6 +671,8 @@ template <int siz, int scoring_depth> struct BeamSearchSolver {
 
     int beam_width_for_each_depth;
     vector<vector<shared_ptr<Node>>> nodes;
+    TimeBudget time_budget; // 制限時間 (デフォルトは無制限)
+    BeamRoundStats round_stats; // 直前の Solve() の層の数と時間
 
     inline BeamSearchSolver(int beam_width_for_each_depth)
         : beam_width_for_each_depth(beam_width_for_each_depth) {}
@@ -679,15 +685,25 @@ template <int siz, int scoring_depth> struct BeamSearchSolver {
         nodes.clear();
         nodes.resize(1);
         nodes[0].push_back(start_node);
+        round_stats = BeamRoundStats();
 
         for (auto current_cost = 0; current_cost < 1000; current_cost++) {
+            if (time_budget.IsOver()) {
+                cerr << "Time over." << endl;
+                return nullptr;
+            }
             auto current_minimum_score = (int)1e9;
+            const auto layer_start = time_budget.Elapsed();
+            auto layer_telemetry = LayerTelemetry(
+                "wreath_layer", current_cost, nodes[current_cost].size());
+            auto n_candidates = 0ull, n_accepted = 0ull;
             for (auto&& node : nodes[current_cost]) {
                 if (node == nullptr || node->children_expanded)
                     continue;
                 node->children_expanded = true;
                 current_minimum_score =
                     min(current_minimum_score, node->state.scores[0]);
+                layer_telemetry.AddNode(node->state.scores[0]);
                 if (node->state.scores[0] == 0) {
                     // TODO: wildcard
                     cerr << "Solved!" << endl;
@@ -700,12 +716,15 @@ template <int siz, int scoring_depth> struct BeamSearchSolver {
                         continue;
                     auto new_state = node->state;
                     new_state.Apply(action);
+                    n_candidates++;
                     if (new_state.n_moves >= (int)nodes.size()) {
                         nodes.resize(new_state.n_moves + 1);
                         // 全ての depth で同じビーム幅なの効率悪そう
                         nodes[new_state.n_moves].resize(
                             beam_width_for_each_depth * (scoring_depth + 1));
                     }
+                    // 複数の depth に入っても 1 回と数える
+                    auto accepted = false;
                     for (auto depth = 0; depth <= scoring_depth; depth++) {
                         const auto idx =
                             depth * beam_width_for_each_depth +
@@ -713,17 +732,29 @@ template <int siz, int scoring_depth> struct BeamSearchSolver {
                         if (nodes[new_state.n_moves][idx] == nullptr ||
                             new_state.scores[depth] <
                                 nodes[new_state.n_moves][idx]
-                                    ->state.scores[depth])
+                                    ->state.scores[depth]) {
+                            accepted = true;
                             nodes[new_state.n_moves][idx].reset(
                                 new Node(new_state, node));
+                        }
                     }
+                    n_accepted += accepted;
                 }
             }
-            cout << format("current_cost={} current_minimum_score={}",
-                           current_cost, current_minimum_score)
-                 << endl;
-            if (nodes[current_cost][0] != nullptr)
-                nodes[current_cost][0]->state.wreath.Display();
+            layer_telemetry.AddCandidates(n_candidates, n_accepted);
+            layer_telemetry.Emit(beam_width_for_each_depth);
+            round_stats.AddLayer(time_budget.Elapsed() - layer_start);
+            // 各層に scoring_depth + 1 個ずつのビームがある
+            round_stats.bytes_per_beam_width =
+                (double)round_stats.n_layers * (scoring_depth + 1) *
+                (sizeof(shared_ptr<Node>) + sizeof(Node));
+            if constexpr (kTelemetryLevel >= 1)
+                cout << format("current_cost={} current_minimum_score={}",
+                               current_cost, current_minimum_score)
+                     << endl;
+            if constexpr (kTelemetryLevel >= 3)
+                if (nodes[current_cost][0] != nullptr)
+                    nodes[current_cost][0]->state.wreath.Display();
             nodes[current_cost].clear();
         }
         cerr << "Failed." << endl;
@@ -827,7 +858,9 @@ template <int siz, int scoring_depth> struct BeamSearchSolver {
     }
 }
 
-template <int siz> static void Solve(const Problem problem) {
+template <int siz>
+static void Solve(const Problem problem,
+                  const TimeBudget& time_budget = TimeBudget()) {
     static constexpr auto kBeamWidthForEachDepth = 50;
     static constexpr auto kScoringDepth = 55;
 
@@ -838,9 +871,13 @@ template <int siz> static void Solve(const Problem problem) {
     cout << endl;
 
     auto solver = BeamSearchSolver<siz, kScoringDepth>(kBeamWidthForEachDepth);
-    const auto node = solver.Solve(wreath, problem.n_wildcards);
-    if (node != nullptr) {
+    solver.time_budget = time_budget;
+
+    // 解を表示して保存する
+    const auto save_solution = [&](const shared_ptr<Node<siz, kScoringDepth>>&
+                                       node) {
         cout << node->state.n_moves << endl;
+        auto solved_wreath = wreath;
         auto moves = vector<Move>();
         for (auto p = node; p->parent != nullptr; p = p->parent)
             moves.push_back(Move{(Move::MoveType)p->state.last_move});
@@ -851,16 +888,17 @@ template <int siz> static void Solve(const Problem problem) {
             mov.Print(oss);
             if (i != (int)moves.size() - 1)
                 oss << ".";
-            wreath.Rotate(mov);
+            solved_wreath.Rotate(mov);
         }
         const auto solution_string = oss.str();
         cout << solution_string << endl;
-        wreath.Display();
+        solved_wreath.Display();
 
         // ファイルに結果を書き出す
         auto ofs = ofstream(format("result/wreath/{}.txt", problem.id), ios::app);
         ofs << format("# n_moves={}\n", node->state.n_moves);
-        ofs << format("# kBeamWidthForEachDepth={}\n", kBeamWidthForEachDepth);
+        ofs << format("# kBeamWidthForEachDepth={}\n",
+                      solver.beam_width_for_each_depth);
         ofs << format("# kScoringDepth={}\n", kScoringDepth);
         ofs << solution_string << endl;
         ofs.close();
@@ -886,10 +924,31 @@ template <int siz> static void Solve(const Problem problem) {
         } else {
             cout << "Couldn't update best score." << endl;
         }
+    };
+
+    // 時間制限があれば、残り時間に収まるビーム幅で解き直し続ける
+    while (true) {
+        const auto run_start = time_budget.Elapsed();
+        const auto node = solver.Solve(wreath, problem.n_wildcards);
+        if (node == nullptr)
+            return;
+        save_solution(node);
+        if (!time_budget.Enabled())
+            return;
+        const auto next_beam_width = time_budget.FitBeamWidth(
+            solver.beam_width_for_each_depth,
+            time_budget.Elapsed() - run_start, solver.round_stats);
+        if (next_beam_width <= solver.beam_width_for_each_depth) {
+            cerr << "No time left for a wider beam." << endl;
+            return;
+        }
+        solver.beam_width_for_each_depth = next_beam_width;
+        cout << format("beam_width_for_each_depth={}", next_beam_width) << endl;
     }
 }
 
-[[maybe_unused]] static void Solve(const int problem_id) {
+[[maybe_unused]] static void
+Solve(const int problem_id, const TimeBudget& time_budget = TimeBudget()) {
     const auto it = find_if(kProblemData.begin(), kProblemData.end(),
                             [problem_id](const Problem& problem) {
                                 return problem.id == problem_id;
@@ -901,22 +960,22 @@ template <int siz> static void Solve(const Problem problem) {
     const auto problem = *it;
     switch (problem.size) {
     case 6:
-        Solve<6>(problem);
+        Solve<6>(problem, time_budget);
         break;
     case 7:
-        Solve<7>(problem);
+        Solve<7>(problem, time_budget);
         break;
     case 12:
-        Solve<12>(problem);
+        Solve<12>(problem, time_budget);
         break;
     case 21:
-        Solve<21>(problem);
+        Solve<21>(problem, time_budget);
         break;
     case 33:
-        Solve<33>(problem);
+        Solve<33>(problem, time_budget);
         break;
     case 100:
-        Solve<100>(problem);
+        Solve<100>(problem, time_budget);
         break;
     default:
         assert(false);
@@ -941,10 +1000,14 @@ int main() { TestBeamSearch(); }
 // clang++ -std=c++20 -Wall -Wextra -O3 wreath.cpp -DSOLVE
 #ifdef SOLVE
 int main(const int argc, const char* const* const argv) {
-    if (argc != 2) {
-        cerr << format("Usage: {} <problem_id>", argv[0]) << endl;
+    // --time-budget <秒> を付けると、時間いっぱいビーム幅を広げて解き直す
+    auto args = vector<const char*>(argv, argv + argc);
+    const auto time_budget = TimeBudget::FromArgs(args);
+    if (args.size() != 2) {
+        cerr << format("Usage: {} <problem_id> [--time-budget <sec>]", argv[0])
+             << endl;
         return 1;
     }
-    Solve(atoi(argv[1]));
+    Solve(atoi(args[1]), time_budget);
 }
 #endif
\ No newline at end of file